@@ -0,0 +1,943 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <memory_resource>
+#include <new>
+#include <optional>
+#include <random>
+#include <string>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include <nbt.hpp>
+
+#include "test_support.hpp"
+
+// Every heap allocation in the process goes through here so the suite can report allocations per document.
+// The replacements are kept out of line: once inlined, GCC pairs their malloc and free with the
+// operator new and delete calls it can see at each call site and reports them as mismatched.
+#if defined(_MSC_VER)
+#define BENCH_NOINLINE __declspec(noinline)
+#else
+#define BENCH_NOINLINE __attribute__((noinline))
+#endif
+
+static std::atomic<size_t> allocationCount = 0;
+
+BENCH_NOINLINE void* operator new(size_t size) {
+	allocationCount.fetch_add(1, std::memory_order_relaxed);
+	if (void* ptr = std::malloc(size == 0 ? 1 : size))
+		return ptr;
+	throw std::bad_alloc();
+}
+
+BENCH_NOINLINE void operator delete(void* ptr) noexcept {
+	std::free(ptr);
+}
+
+BENCH_NOINLINE void operator delete(void* ptr, size_t) noexcept {
+	std::free(ptr);
+}
+
+// std::pmr::new_delete_resource allocates through the aligned overloads.
+BENCH_NOINLINE void* operator new(size_t size, std::align_val_t alignment) {
+	allocationCount.fetch_add(1, std::memory_order_relaxed);
+	size_t align = size_t(alignment);
+#if defined(_WIN32)
+	if (void* ptr = _aligned_malloc(size == 0 ? 1 : size, align))
+		return ptr;
+#else
+	if (void* ptr = std::aligned_alloc(align, (size + align - 1) / align * align + (size == 0 ? align : 0)))
+		return ptr;
+#endif
+	throw std::bad_alloc();
+}
+
+BENCH_NOINLINE void operator delete(void* ptr, std::align_val_t) noexcept {
+#if defined(_WIN32)
+	_aligned_free(ptr);
+#else
+	std::free(ptr);
+#endif
+}
+
+BENCH_NOINLINE void operator delete(void* ptr, size_t, std::align_val_t alignment) noexcept {
+	operator delete(ptr, alignment);
+}
+
+static size_t peakRssKiB() {
+#if defined(_WIN32)
+	PROCESS_MEMORY_COUNTERS counters;
+	GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+	return counters.PeakWorkingSetSize / 1024;
+#else
+	rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+	return usage.ru_maxrss / 1024;
+#else
+	return usage.ru_maxrss;
+#endif
+#endif
+}
+
+static nbt::Tag makeChunk(uint32_t seed) {
+	static const char* blocks[] = { "minecraft:stone", "minecraft:dirt", "minecraft:grass_block", "minecraft:deepslate", "minecraft:water", "minecraft:oak_log", "minecraft:iron_ore", "minecraft:air" };
+	std::mt19937 rng(seed);
+
+	nbt::Tag sections = nbt::Tag::List("sections", {});
+	for (int y = -4; y < 20; ++y) {
+		nbt::Tag palette = nbt::Tag::List("palette", {});
+		for (const char* block : blocks) {
+			palette.addChild(nbt::Tag::Compound({
+				nbt::Tag::String("Name", block),
+				nbt::Tag::Compound("Properties", { nbt::Tag::String("axis", "y") })
+			}));
+		}
+
+		std::pmr::vector<int64_t> states(256);
+		for (auto& state : states)
+			state = int64_t(rng()) << 32 | rng();
+
+		sections.addChild(nbt::Tag::Compound({
+			nbt::Tag::Byte("Y", int8_t(y)),
+			nbt::Tag::Compound("block_states", {
+				std::move(palette),
+				nbt::Tag::LongArray("data", std::move(states))
+			}),
+			nbt::Tag::Compound("biomes", {
+				nbt::Tag::List("palette", { nbt::Tag::String("minecraft:plains"), nbt::Tag::String("minecraft:river") }),
+				nbt::Tag::LongArray("data", { int64_t(rng()) })
+			}),
+			nbt::Tag::ByteArray("BlockLight", std::pmr::vector<int8_t>(2048, 0x0f)),
+			nbt::Tag::ByteArray("SkyLight", std::pmr::vector<int8_t>(2048, 0x0f))
+		}));
+	}
+
+	nbt::Tag blockEntities = nbt::Tag::List("block_entities", {});
+	for (int i = 0; i < 16; ++i) {
+		blockEntities.addChild(nbt::Tag::Compound({
+			nbt::Tag::String("id", "minecraft:chest"),
+			nbt::Tag::Int("x", int32_t(rng() % 16)),
+			nbt::Tag::Int("y", int32_t(rng() % 256)),
+			nbt::Tag::Int("z", int32_t(rng() % 16)),
+			nbt::Tag::List("Items", {
+				nbt::Tag::Compound({ nbt::Tag::Byte("Slot", 0), nbt::Tag::String("id", "minecraft:diamond"), nbt::Tag::Byte("Count", 3) }),
+				nbt::Tag::Compound({ nbt::Tag::Byte("Slot", 1), nbt::Tag::String("id", "minecraft:torch"), nbt::Tag::Byte("Count", 64) })
+			})
+		}));
+	}
+
+	return nbt::Tag::Compound("", {
+		nbt::Tag::Int("DataVersion", 3465),
+		nbt::Tag::Int("xPos", int32_t(seed % 32)),
+		nbt::Tag::Int("zPos", int32_t(seed / 32)),
+		nbt::Tag::String("Status", "minecraft:full"),
+		nbt::Tag::Long("LastUpdate", 123456789),
+		std::move(sections),
+		std::move(blockEntities),
+		nbt::Tag::Compound("Heightmaps", {
+			nbt::Tag::LongArray("MOTION_BLOCKING", std::pmr::vector<int64_t>(37, 0x0123456789abcdef)),
+			nbt::Tag::LongArray("WORLD_SURFACE", std::pmr::vector<int64_t>(37, 0x0123456789abcdef))
+		})
+	});
+}
+
+template<typename F>
+static double measureSeconds(F&& f) {
+	auto start = std::chrono::steady_clock::now();
+	f();
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void benchAllocation(const char* mode, const std::vector<nbt::Data>& chunks, int rounds) {
+	bool useArena = std::strcmp(mode, "arena") == 0;
+	size_t bytes = 0;
+	for (const auto& chunk : chunks)
+		bytes += chunk.size();
+
+	std::pmr::monotonic_buffer_resource arena(size_t(64) << 20);
+	std::pmr::memory_resource* resource = useArena ? static_cast<std::pmr::memory_resource*>(&arena) : std::pmr::get_default_resource();
+
+	double seconds = measureSeconds([&]() {
+		for (int round = 0; round < rounds; ++round) {
+			std::vector<nbt::Tag> loaded;
+			loaded.reserve(chunks.size());
+			for (const auto& chunk : chunks)
+				loaded.push_back(nbt::Tag::deserialize(chunk.data(), chunk.data() + chunk.size(), nbt::SerializationFlag::None, resource));
+			loaded.clear();
+			arena.release();
+		}
+	});
+
+	std::cout << "deserialize," << mode << "," << (double(bytes) * rounds / seconds / 1e6) << " MB/s," << (seconds * 1e3 / rounds) << " ms/round," << peakRssKiB() << " KiB peak" << std::endl;
+}
+
+static void benchArrays(nbt::SerializationFlag flags, const char* label) {
+	std::pmr::vector<int64_t> values(size_t(1) << 21);
+	std::mt19937_64 rng(42);
+	for (auto& value : values)
+		value = int64_t(rng());
+
+	nbt::Tag tag = nbt::Tag::LongArray("data", std::move(values));
+	nbt::Data data = tag.serialize(flags);
+	const int rounds = 50;
+
+	double serializeSeconds = measureSeconds([&]() {
+		for (int round = 0; round < rounds; ++round)
+			data = tag.serialize(flags);
+	});
+
+	double deserializeSeconds = measureSeconds([&]() {
+		for (int round = 0; round < rounds; ++round)
+			tag = nbt::Tag::deserialize(data.data(), data.data() + data.size(), flags);
+	});
+
+	double bytes = double(data.size()) * rounds;
+	std::cout << "longarray_serialize," << label << "," << (bytes / serializeSeconds / 1e9) << " GB/s" << std::endl;
+	std::cout << "longarray_deserialize," << label << "," << (bytes / deserializeSeconds / 1e9) << " GB/s" << std::endl;
+}
+
+// 1, 2, 4, ... up to and including the number of hardware threads.
+static std::vector<unsigned> threadCounts() {
+	unsigned hardware = std::max(std::thread::hardware_concurrency(), 1u);
+	std::vector<unsigned> counts;
+	for (unsigned threads = 1; threads < hardware; threads *= 2)
+		counts.push_back(threads);
+	counts.push_back(hardware);
+	return counts;
+}
+
+static void benchRegion() {
+	std::string path = (std::filesystem::temp_directory_path() / "nbt_bench_region.mca").string();
+	std::remove(path.c_str());
+
+	{
+		nbt::RegionFile region;
+		if (!region.open(path, true)) {
+			std::cerr << "region: cannot create " << path << std::endl;
+			return;
+		}
+		for (uint32_t i = 0; i < nbt::RegionFile::ChunkCount; ++i)
+			region.writeChunk(int(i % nbt::RegionFile::Width), int(i / nbt::RegionFile::Width), makeChunk(i));
+	}
+
+	nbt::RegionFile region;
+	region.open(path);
+	const int rounds = 4;
+	for (unsigned threads : threadCounts()) {
+		nbt::ThreadPool pool(threads);
+		double seconds = measureSeconds([&]() {
+			for (int round = 0; round < rounds; ++round)
+				region.readChunks(pool);
+		});
+
+		std::cout << "region_read," << threads << " threads," << (nbt::RegionFile::ChunkCount * rounds / seconds) << " chunks/s" << std::endl;
+	}
+
+	region.close();
+	std::remove(path.c_str());
+}
+
+static nbt::Tag makeItem(uint32_t seed) {
+	return nbt::Tag::Compound("", {
+		nbt::Tag::String("id", seed % 2 ? "minecraft:diamond_sword" : "minecraft:bread"),
+		nbt::Tag::Byte("Count", int8_t(seed % 64 + 1)),
+		nbt::Tag::Compound("tag", { nbt::Tag::Int("Damage", int32_t(seed % 1561)) })
+	});
+}
+
+static nbt::Tag makePlayer(uint32_t seed) {
+	nbt::Tag inventory = nbt::Tag::List("Inventory", {});
+	for (uint32_t slot = 0; slot < 36; ++slot) {
+		nbt::Tag item = makeItem(seed + slot);
+		item.addChild(nbt::Tag::Byte("Slot", int8_t(slot)));
+		inventory.addChild(std::move(item));
+	}
+
+	return nbt::Tag::Compound("", {
+		nbt::Tag::List("Pos", { nbt::Tag::Double(seed * 1.5), nbt::Tag::Double(64.0), nbt::Tag::Double(seed * -0.5) }),
+		nbt::Tag::Float("Health", 20.0f),
+		nbt::Tag::Int("XpLevel", int32_t(seed % 100)),
+		std::move(inventory)
+	});
+}
+
+// A tick's worth of mixed payloads: mostly item stacks, some player saves and a few chunks.
+static void benchBatch() {
+	std::vector<nbt::Tag> tags;
+	for (uint32_t i = 0; i < 4096; ++i)
+		tags.push_back(i % 64 == 0 ? makeChunk(i) : i % 8 == 0 ? makePlayer(i) : makeItem(i));
+
+	std::vector<nbt::Data> data;
+	for (const auto& tag : tags)
+		data.push_back(tag.serialize());
+
+	std::vector<nbt::Tag::Payload> payloads;
+	size_t bytes = 0;
+	for (const auto& payload : data) {
+		payloads.push_back({ payload.data(), payload.size() });
+		bytes += payload.size();
+	}
+
+	const int rounds = 4;
+	for (unsigned threads : threadCounts()) {
+		nbt::ThreadPool pool(threads);
+		double deserializeSeconds = measureSeconds([&]() {
+			for (int round = 0; round < rounds; ++round)
+				nbt::Tag::deserialize(payloads, pool);
+		});
+		double serializeSeconds = measureSeconds([&]() {
+			for (int round = 0; round < rounds; ++round)
+				nbt::Tag::serialize(tags, pool);
+		});
+
+		std::cout << "batch_deserialize," << threads << " threads," << (tags.size() * rounds / deserializeSeconds) << " items/s," << (double(bytes) * rounds / deserializeSeconds / 1e6) << " MB/s" << std::endl;
+		std::cout << "batch_serialize," << threads << " threads," << (tags.size() * rounds / serializeSeconds) << " items/s," << (double(bytes) * rounds / serializeSeconds / 1e6) << " MB/s" << std::endl;
+	}
+}
+
+static void benchQuery(const std::vector<nbt::Data>& chunks) {
+	size_t bytes = 0;
+	for (const auto& chunk : chunks)
+		bytes += chunk.size();
+
+	const int rounds = 10;
+	double fullSeconds = measureSeconds([&]() {
+		for (int round = 0; round < rounds; ++round)
+			for (const auto& chunk : chunks)
+				nbt::Tag::deserialize(chunk.data(), chunk.data() + chunk.size());
+	});
+	std::cout << "query,full_deserialize," << (double(bytes) * rounds / fullSeconds / 1e6) << " MB/s" << std::endl;
+
+	for (const char* path : { "Heightmaps.MOTION_BLOCKING", "sections[*].Y", "sections[*].block_states.data" }) {
+		nbt::Query query(path);
+		size_t matches = 0;
+		double seconds = measureSeconds([&]() {
+			for (int round = 0; round < rounds; ++round)
+				for (const auto& chunk : chunks)
+					matches += query.extract(chunk.data(), chunk.data() + chunk.size()).size();
+		});
+		std::cout << "query," << path << "," << (double(bytes) * rounds / seconds / 1e6) << " MB/s," << (fullSeconds / seconds) << "x full," << (matches / rounds / chunks.size()) << " matches/chunk" << std::endl;
+	}
+}
+
+// Repeated lookups into the same cached blob: re-running a query every time versus indexing once.
+static void benchIndex(const std::vector<nbt::Data>& chunks) {
+	size_t bytes = 0;
+	for (const auto& chunk : chunks)
+		bytes += chunk.size();
+
+	const int rounds = 10;
+	std::vector<nbt::TagIndex> indices(chunks.size());
+	double buildSeconds = measureSeconds([&]() {
+		for (int round = 0; round < rounds; ++round)
+			for (size_t i = 0; i < chunks.size(); ++i)
+				indices[i] = nbt::TagIndex(chunks[i].data(), chunks[i].data() + chunks[i].size());
+	});
+	std::cout << "index,build," << (double(bytes) * rounds / buildSeconds / 1e6) << " MB/s," << indices[0].size() << " entries/chunk" << std::endl;
+
+	const int lookups = 100;
+	nbt::Query query("Heightmaps.WORLD_SURFACE");
+	int64_t sum = 0;
+	double querySeconds = measureSeconds([&]() {
+		for (int lookup = 0; lookup < lookups; ++lookup)
+			for (const auto& chunk : chunks)
+				query.forEach(chunk.data(), chunk.data() + chunk.size(), [&](const nbt::TagView& view) { sum += view.longArrayValue()[0]; });
+	});
+
+	double indexSeconds = measureSeconds([&]() {
+		for (int lookup = 0; lookup < lookups; ++lookup)
+			for (const auto& index : indices)
+				sum += index.view(index.find(index.find(index.root(), "Heightmaps"), "WORLD_SURFACE")).longArrayValue()[0];
+	});
+
+	double count = double(lookups) * chunks.size();
+	std::cout << "index,lookup_query," << (querySeconds * 1e9 / count) << " ns/lookup" << std::endl;
+	// Printing the sum keeps both loops from being optimized away.
+	std::cout << "index,lookup_index," << (indexSeconds * 1e9 / count) << " ns/lookup," << sum << " checksum" << std::endl;
+}
+
+static nbt::Tag makeEntities(uint32_t seed) {
+	static const char* ids[] = { "minecraft:zombie", "minecraft:cow", "minecraft:item", "minecraft:arrow", "minecraft:villager" };
+	std::mt19937 rng(seed);
+
+	nbt::Tag entities = nbt::Tag::List("Entities", {});
+	for (int i = 0; i < 256; ++i) {
+		entities.addChild(nbt::Tag::Compound({
+			nbt::Tag::String("id", ids[rng() % 5]),
+			nbt::Tag::List("Pos", { nbt::Tag::Double(rng() / 1e3), nbt::Tag::Double(rng() % 320), nbt::Tag::Double(rng() / 1e3) }),
+			nbt::Tag::List("Motion", { nbt::Tag::Double(0.0), nbt::Tag::Double(-0.0784), nbt::Tag::Double(0.0) }),
+			nbt::Tag::List("Rotation", { nbt::Tag::Float(float(rng() % 360)), nbt::Tag::Float(0.0f) }),
+			nbt::Tag::IntArray("UUID", { int32_t(rng()), int32_t(rng()), int32_t(rng()), int32_t(rng()) }),
+			nbt::Tag::Float("Health", 20.0f),
+			nbt::Tag::Short("Fire", -1),
+			nbt::Tag::Byte("OnGround", 1)
+		}));
+	}
+
+	return nbt::Tag::Compound("", { nbt::Tag::Int("DataVersion", 3465), std::move(entities) });
+}
+
+static nbt::Tag makeDeep(uint32_t seed) {
+	nbt::Tag leaf = nbt::Tag::Compound("leaf", { nbt::Tag::Int("value", int32_t(seed)) });
+	for (int depth = 0; depth < 256; ++depth) {
+		if (depth % 2)
+			leaf = nbt::Tag::List("l", { nbt::Tag::Compound({ std::move(leaf), nbt::Tag::Int("depth", depth) }) });
+		else
+			leaf = nbt::Tag::Compound("c", { std::move(leaf), nbt::Tag::Byte("depth", int8_t(depth)) });
+	}
+	return nbt::Tag::Compound("", { std::move(leaf) });
+}
+
+static nbt::Tag makeItems(uint32_t seed) {
+	static const char* enchantments[] = { "minecraft:sharpness", "minecraft:unbreaking", "minecraft:mending", "minecraft:looting" };
+	std::mt19937 rng(seed);
+
+	nbt::Tag items = nbt::Tag::List("Items", {});
+	for (int slot = 0; slot < 27; ++slot) {
+		nbt::Tag lore = nbt::Tag::List("Lore", {});
+		for (int line = 0; line < 4; ++line)
+			lore.addChild(nbt::Tag::String(std::pmr::string("{\"text\":\"Forged in the depths, line ") + char('0' + line) + "\",\"color\":\"gray\",\"italic\":false}"));
+
+		nbt::Tag enchants = nbt::Tag::List("Enchantments", {});
+		for (const char* id : enchantments)
+			enchants.addChild(nbt::Tag::Compound({ nbt::Tag::String("id", id), nbt::Tag::Short("lvl", int16_t(rng() % 5 + 1)) }));
+
+		items.addChild(nbt::Tag::Compound({
+			nbt::Tag::Byte("Slot", int8_t(slot)),
+			nbt::Tag::String("id", "minecraft:netherite_sword"),
+			nbt::Tag::Byte("Count", 1),
+			nbt::Tag::Compound("tag", {
+				nbt::Tag::Compound("display", {
+					nbt::Tag::String("Name", "{\"text\":\"Blade of the \\\"Ancients\\\"\",\"color\":\"gold\"}"),
+					std::move(lore)
+				}),
+				std::move(enchants),
+				nbt::Tag::Int("Damage", int32_t(rng() % 2031))
+			})
+		}));
+	}
+
+	return nbt::Tag::Compound("", { std::move(items) });
+}
+
+static size_t countTags(const nbt::Tag& tag) {
+	size_t count = 1;
+	if (tag.type() == nbt::Tag::Type::List)
+		for (const auto& child : tag.listValue())
+			count += countTags(child);
+	else if (tag.type() == nbt::Tag::Type::Compound)
+		for (const auto& child : tag.compoundValue())
+			count += countTags(child);
+	return count;
+}
+
+// Repeats `f` until at least a tenth of a second has passed and returns the average time per run
+// together with the allocations per run.
+template<typename F>
+static std::pair<double, double> measureRun(F&& f) {
+	size_t runs = 0;
+	size_t allocations = allocationCount;
+	auto start = std::chrono::steady_clock::now();
+	double seconds = 0.0;
+	do {
+		f();
+		++runs;
+		seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	} while (seconds < 0.1);
+	return { seconds / runs, double(allocationCount - allocations) / runs };
+}
+
+// Prints one CSV row per corpus, operation and flag variant.
+static void benchSuite() {
+	struct Corpus {
+		const char* name;
+		std::vector<nbt::Tag> documents;
+	};
+
+	std::vector<Corpus> corpora(4);
+	corpora[0].name = "chunk";
+	corpora[1].name = "entities";
+	corpora[2].name = "deep";
+	corpora[3].name = "items";
+	for (uint32_t seed = 0; seed < 16; ++seed) {
+		corpora[0].documents.push_back(makeChunk(seed));
+		corpora[1].documents.push_back(makeEntities(seed));
+		corpora[2].documents.push_back(makeDeep(seed));
+		corpora[3].documents.push_back(makeItems(seed));
+	}
+
+	const std::pair<nbt::SerializationFlag, const char*> variants[] = {
+		{ nbt::SerializationFlag::None, "big_endian" },
+		{ nbt::SerializationFlag::Bedrock, "bedrock" },
+		{ nbt::SerializationFlag::JavaNetwork, "java_network" }
+	};
+
+	std::cout << "corpus,operation,flags,MB/s,ns/tag,allocations/doc" << std::endl;
+	for (const auto& corpus : corpora) {
+		size_t tags = 0;
+		for (const auto& document : corpus.documents)
+			tags += countTags(document);
+
+		auto report = [&](const char* operation, const char* flags, size_t bytes, std::pair<double, double> run) {
+			std::cout << corpus.name << "," << operation << "," << flags << "," << (bytes / run.first / 1e6) << "," << (run.first * 1e9 / tags) << "," << (run.second / corpus.documents.size()) << std::endl;
+		};
+
+		for (const auto& [flags, label] : variants) {
+			std::vector<nbt::Data> encoded;
+			size_t bytes = 0;
+			for (const auto& document : corpus.documents) {
+				encoded.push_back(document.serialize(flags));
+				bytes += encoded.back().size();
+			}
+
+			report("serialize", label, bytes, measureRun([&]() {
+				for (const auto& document : corpus.documents)
+					document.serialize(flags);
+			}));
+
+			nbt::Data buffer;
+			report("serialize_reuse", label, bytes, measureRun([&]() {
+				for (const auto& document : corpus.documents) {
+					buffer.clear();
+					document.serialize(buffer, flags);
+				}
+			}));
+
+			report("deserialize", label, bytes, measureRun([&]() {
+				for (const auto& data : encoded)
+					nbt::Tag::deserialize(data.data(), data.data() + data.size(), flags);
+			}));
+
+			report("visit", label, bytes, measureRun([&]() {
+				for (const auto& data : encoded) {
+					nbt::Visitor visitor;
+					nbt::Tag::visit(data.data(), data.data() + data.size(), visitor, flags);
+				}
+			}));
+		}
+
+		size_t textBytes = 0;
+		for (const auto& document : corpus.documents)
+			textBytes += document.stringify().size();
+		report("stringify", "none", textBytes, measureRun([&]() {
+			for (const auto& document : corpus.documents)
+				document.stringify();
+		}));
+
+		std::vector<std::string> texts;
+		for (const auto& document : corpus.documents)
+			texts.push_back(document.stringify());
+		report("parse", "none", textBytes, measureRun([&]() {
+			for (const auto& text : texts)
+				nbt::Tag::parse(text);
+		}));
+	}
+}
+
+static void benchMemory(const std::vector<nbt::Data>& chunks) {
+	CountingResource resource;
+	std::vector<nbt::Tag> loaded;
+	for (const auto& chunk : chunks)
+		loaded.push_back(nbt::Tag::deserialize(chunk.data(), chunk.data() + chunk.size(), nbt::SerializationFlag::None, &resource));
+
+	size_t tags = 0;
+	for (const auto& tag : loaded)
+		tags += countTags(tag);
+
+	// Names live in the NameTable rather than the resource and are shared by every chunk, so
+	// each chunk is charged an equal part of the whole table.
+	size_t names = nbt::NameTable::bytes();
+	std::cout << "memory,sizeof(Tag)," << sizeof(nbt::Tag) << " bytes" << std::endl;
+	std::cout << "memory,chunk," << (resource.bytes + sizeof(nbt::Tag) * loaded.size() + names) / loaded.size() << " bytes/chunk," << tags / loaded.size() << " tags/chunk," << nbt::NameTable::size() << " distinct names," << names << " name bytes" << std::endl;
+}
+
+struct ItemData {
+	int32_t damage = 0;
+};
+
+struct Item {
+	std::string id;
+	int8_t count = 0;
+	std::optional<ItemData> tag;
+	int8_t slot = 0;
+};
+
+struct Player {
+	std::array<double, 3> pos{};
+	float health = 0.0f;
+	int32_t xpLevel = 0;
+	std::vector<Item> inventory;
+};
+
+template<> struct nbt::Schema<ItemData> {
+	static constexpr auto fields = std::tuple(nbt::field("Damage", &ItemData::damage));
+};
+
+template<> struct nbt::Schema<Item> {
+	static constexpr auto fields = std::tuple(nbt::field("id", &Item::id), nbt::field("Count", &Item::count), nbt::field("tag", &Item::tag), nbt::field("Slot", &Item::slot));
+};
+
+template<> struct nbt::Schema<Player> {
+	static constexpr auto fields = std::tuple(nbt::field("Pos", &Player::pos), nbt::field("Health", &Player::health), nbt::field("XpLevel", &Player::xpLevel), nbt::field("Inventory", &Player::inventory));
+};
+
+// What decoding a player looks like without a schema: a Tag tree, then copying the fields out.
+static Player extractPlayer(const nbt::Tag& tag) {
+	Player player;
+	const auto& pos = tag["Pos"].listValue();
+	for (size_t i = 0; i < 3; ++i)
+		player.pos[i] = pos[i].doubleValue();
+	player.health = tag["Health"].floatValue();
+	player.xpLevel = tag["XpLevel"].intValue();
+	for (const auto& stack : tag["Inventory"].listValue()) {
+		Item& item = player.inventory.emplace_back();
+		item.id = stack["id"].stringValue();
+		item.count = stack["Count"].byteValue();
+		item.slot = stack["Slot"].byteValue();
+		if (const nbt::Tag* data = stack.find("tag"))
+			item.tag = ItemData{ (*data)["Damage"].intValue() };
+	}
+	return player;
+}
+
+static void benchSchema() {
+	std::vector<nbt::Data> players;
+	size_t bytes = 0;
+	for (uint32_t i = 0; i < 256; ++i) {
+		players.push_back(makePlayer(i).serialize());
+		bytes += players.back().size();
+	}
+
+	std::vector<Player> decoded(players.size());
+	auto viaTag = measureRun([&] {
+		for (size_t i = 0; i < players.size(); ++i)
+			decoded[i] = extractPlayer(nbt::Tag::deserialize(players[i].data(), players[i].data() + players[i].size()));
+	});
+	auto viaSchema = measureRun([&] {
+		for (size_t i = 0; i < players.size(); ++i)
+			nbt::decode(players[i].data(), players[i].data() + players[i].size(), decoded[i]);
+	});
+
+	auto encodeViaTag = measureRun([&] {
+		for (const auto& player : decoded) {
+			nbt::Tag inventory = nbt::Tag::List("Inventory", {});
+			for (const auto& item : player.inventory) {
+				nbt::Tag stack = nbt::Tag::Compound({ nbt::Tag::String("id", std::pmr::string(item.id)), nbt::Tag::Byte("Count", item.count) });
+				if (item.tag)
+					stack.addChild(nbt::Tag::Compound("tag", { nbt::Tag::Int("Damage", item.tag->damage) }));
+				stack.addChild(nbt::Tag::Byte("Slot", item.slot));
+				inventory.addChild(std::move(stack));
+			}
+			nbt::Tag::Compound("", {
+				nbt::Tag::List("Pos", { nbt::Tag::Double(player.pos[0]), nbt::Tag::Double(player.pos[1]), nbt::Tag::Double(player.pos[2]) }),
+				nbt::Tag::Float("Health", player.health),
+				nbt::Tag::Int("XpLevel", player.xpLevel),
+				std::move(inventory)
+			}).serialize();
+		}
+	});
+	nbt::Data buffer;
+	auto encodeViaSchema = measureRun([&] {
+		for (const auto& player : decoded) {
+			buffer.clear();
+			nbt::encode(buffer, player);
+		}
+	});
+
+	auto row = [&](const char* operation, const char* path, std::pair<double, double> run) {
+		std::cout << "schema," << operation << "," << path << "," << bytes / run.first / 1e6 << " MB/s," << run.first * 1e6 / players.size() << " us/player," << run.second / players.size() << " allocations/player" << std::endl;
+	};
+	row("decode", "tag", viaTag);
+	row("decode", "schema", viaSchema);
+	row("encode", "tag", encodeViaTag);
+	row("encode", "schema", encodeViaSchema);
+}
+
+// Packet-sized payloads as a Bedrock server sends them: item stacks, player data and small
+// block entities, in the fixed-width disk format and the VarInt network format.
+static void benchNetwork() {
+	std::vector<nbt::Tag> packets;
+	for (uint32_t i = 0; i < 4096; ++i) {
+		if (i % 16 == 0) {
+			packets.push_back(makePlayer(i));
+		} else if (i % 4 == 0) {
+			std::pmr::vector<int32_t> colors;
+			for (uint32_t j = 0; j < 16; ++j)
+				colors.push_back(int32_t((i * 31 + j) % 512) - 256);
+			packets.push_back(nbt::Tag::Compound("", {
+				nbt::Tag::String("id", "Banner"),
+				nbt::Tag::Int("x", int32_t(i * 7) - 10000), nbt::Tag::Int("y", int32_t(i % 320) - 64), nbt::Tag::Int("z", -int32_t(i * 3)),
+				nbt::Tag::Long("Time", int64_t(i) * 20),
+				nbt::Tag::IntArray("Colors", std::move(colors))
+			}));
+		} else {
+			packets.push_back(makeItem(i));
+		}
+	}
+
+	for (auto [flags, label] : { std::pair(nbt::SerializationFlag::Bedrock, "fixed"), std::pair(nbt::SerializationFlag::BedrockNetwork, "varint") }) {
+		std::vector<nbt::Data> data;
+		size_t bytes = 0;
+		for (const auto& packet : packets) {
+			data.push_back(packet.serialize(flags));
+			bytes += data.back().size();
+		}
+
+		const int rounds = 20;
+		double serializeSeconds = measureSeconds([&]() {
+			for (int round = 0; round < rounds; ++round)
+				for (size_t i = 0; i < packets.size(); ++i) {
+					data[i].clear();
+					packets[i].serialize(data[i], flags);
+				}
+		});
+		double deserializeSeconds = measureSeconds([&]() {
+			for (int round = 0; round < rounds; ++round)
+				for (const auto& packet : data)
+					nbt::Tag::deserialize(packet.data(), packet.data() + packet.size(), flags);
+		});
+
+		double count = double(packets.size()) * rounds;
+		std::cout << "network," << label << "," << double(bytes) / packets.size() << " bytes/packet,"
+			<< "serialize " << bytes * rounds / serializeSeconds / 1e6 << " MB/s " << serializeSeconds * 1e6 / count << " us/packet,"
+			<< "deserialize " << bytes * rounds / deserializeSeconds / 1e6 << " MB/s " << deserializeSeconds * 1e6 / count << " us/packet" << std::endl;
+	}
+}
+
+// Chunks arriving off a socket in MTU-sized pieces: the resumable parser consumes each piece
+// as it comes, the one-shot path has to wait for and parse the whole buffer.
+static void benchParser(const std::vector<nbt::Data>& chunks) {
+	size_t bytes = 0;
+	for (const auto& chunk : chunks)
+		bytes += chunk.size();
+
+	const size_t packetSize = 1400;
+	const int rounds = 4;
+	double oneShot = measureSeconds([&]() {
+		for (int round = 0; round < rounds; ++round)
+			for (const auto& chunk : chunks)
+				nbt::Tag::deserialize(chunk.data(), chunk.data() + chunk.size());
+	});
+
+	nbt::TagParser parser;
+	double incremental = measureSeconds([&]() {
+		for (int round = 0; round < rounds; ++round) {
+			for (const auto& chunk : chunks) {
+				for (size_t offset = 0; offset < chunk.size(); offset += packetSize)
+					parser.feed(std::span(chunk.data() + offset, std::min(packetSize, chunk.size() - offset)));
+				parser.take();
+			}
+		}
+	});
+
+	std::cout << "parser,one_shot," << bytes * rounds / oneShot / 1e6 << " MB/s" << std::endl;
+	std::cout << "parser,incremental " << packetSize << " byte packets," << bytes * rounds / incremental / 1e6 << " MB/s" << std::endl;
+}
+
+static void benchSnapshot(const std::vector<nbt::Data>& chunks) {
+	std::vector<nbt::Tag> world;
+	for (const auto& chunk : chunks)
+		world.push_back(nbt::Tag::deserialize(chunk.data(), chunk.data() + chunk.size()));
+
+	// A full copy is what taking a snapshot costs without sharing.
+	auto deep = measureRun([&] {
+		std::vector<nbt::Tag> snapshot = world;
+	});
+
+	for (auto& chunk : world)
+		chunk.share();
+
+	auto shared = measureRun([&] {
+		std::vector<nbt::Tag> snapshot = world;
+	});
+
+	// Snapshot, then edit one block state per chunk, which clones the path to it.
+	size_t edits = 0;
+	auto edit = measureRun([&] {
+		std::vector<nbt::Tag> snapshot = world;
+		for (auto& chunk : world) {
+			nbt::Tag& section = chunk.editChild("sections")->editChild(edits++ % 24);
+			section.editChild("block_states")->editChild("data")->editLongArray()[0] ^= 1;
+		}
+	});
+
+	std::cout << "snapshot,deep_copy," << deep.first * 1e6 / world.size() << " us/chunk," << deep.second / world.size() << " allocations/chunk" << std::endl;
+	std::cout << "snapshot,shared_copy," << shared.first * 1e6 / world.size() << " us/chunk," << shared.second / world.size() << " allocations/chunk" << std::endl;
+	std::cout << "snapshot,shared_copy_and_edit," << edit.first * 1e6 / world.size() << " us/chunk," << edit.second / world.size() << " allocations/chunk" << std::endl;
+}
+
+// Autosave of a shared world: edit a number of sections per chunk, then serialize every chunk
+// either from scratch or through a cache that reuses the bytes of untouched subtrees.
+static void benchIncremental(const std::vector<nbt::Data>& chunks) {
+	std::vector<nbt::Tag> world;
+	for (const auto& chunk : chunks) {
+		world.push_back(nbt::Tag::deserialize(chunk.data(), chunk.data() + chunk.size()));
+		world.back().share();
+	}
+	std::vector<nbt::SerializationCache> caches(world.size());
+	for (size_t i = 0; i < world.size(); ++i)
+		world[i].serialize(caches[i]);
+
+	size_t bytes = 0;
+	for (const auto& chunk : chunks)
+		bytes += chunk.size();
+
+	for (size_t editedSections : { 0, 1, 4, 24 }) {
+		uint32_t round = 0;
+		auto edit = [&] {
+			++round;
+			for (auto& chunk : world) {
+				for (size_t i = 0; i < editedSections; ++i) {
+					nbt::Tag& section = chunk.editChild("sections")->editChild(i);
+					section.editChild("block_states")->editChild("data")->editLongArray()[round % 256] ^= 1;
+				}
+			}
+		};
+
+		// Edits are timed apart from the save, as the cache's copy of the last saved tree makes
+		// them clone the path to each edited tag.
+		auto save = [&](bool useCache) {
+			double editSeconds = 0.0;
+			double saveSeconds = 0.0;
+			for (int i = 0; i < 10; ++i) {
+				editSeconds += measureSeconds(edit);
+				saveSeconds += measureSeconds([&] {
+					for (size_t i = 0; i < world.size(); ++i) {
+						if (useCache)
+							world[i].serialize(caches[i]);
+						else
+							world[i].serialize();
+					}
+				});
+			}
+
+			std::cout << "incremental," << editedSections << " sections/chunk," << (useCache ? "cached" : "full") << "," << bytes * 10 / saveSeconds / 1e6 << " MB/s," << saveSeconds * 1e6 / 10 / world.size() << " us/chunk saved," << editSeconds * 1e6 / 10 / world.size() << " us/chunk edited" << std::endl;
+		};
+
+		save(false);
+		save(true);
+	}
+}
+
+// Block states of a chunk's sections, unpacked from the serialized LongArray the way a
+// naive loop would and through unpackBits, then packed back.
+static void benchPacked() {
+	const int rounds = 2000;
+	std::cout << "packed,bits,layout,naive ns/section,unpack ns/section,view ns/section,pack ns/section" << std::endl;
+	for (unsigned bits : { 4u, 5u, 8u, 12u, 15u }) {
+		for (auto [layout, label] : { std::pair(nbt::PackedLayout::Padded, "padded"), std::pair(nbt::PackedLayout::Spanning, "spanning") }) {
+			std::vector<uint16_t> states(4096);
+			for (size_t i = 0; i < states.size(); ++i)
+				states[i] = uint16_t((i * 2654435761u >> 7) & ((1u << bits) - 1));
+			std::pmr::vector<int64_t> packed;
+			nbt::packBits(states, bits, layout, packed);
+			nbt::Data data = nbt::Tag::LongArray("data", packed).serialize();
+			nbt::TagView view(data.data(), data.data() + data.size());
+
+			std::vector<uint16_t> out(states.size());
+			double naive = measureSeconds([&]() {
+				for (int round = 0; round < rounds; ++round) {
+					std::pmr::vector<int64_t> longs = view.longArrayValue().toVector();
+					uint64_t mask = (uint64_t(1) << bits) - 1;
+					size_t perLong = 64 / bits;
+					for (size_t i = 0; i < out.size(); ++i) {
+						if (layout == nbt::PackedLayout::Padded) {
+							out[i] = uint16_t(uint64_t(longs[i / perLong]) >> (i % perLong * bits) & mask);
+						} else {
+							size_t bit = i * bits, index = bit / 64, shift = bit % 64;
+							uint64_t value = uint64_t(longs[index]) >> shift;
+							if (shift + bits > 64)
+								value |= uint64_t(longs[index + 1]) << (64 - shift);
+							out[i] = uint16_t(value & mask);
+						}
+					}
+				}
+			});
+			double unpack = measureSeconds([&]() {
+				for (int round = 0; round < rounds; ++round) {
+					nbt::unpackBits(std::span<const int64_t>(packed), bits, layout, out);
+				}
+			});
+			double fromView = measureSeconds([&]() {
+				for (int round = 0; round < rounds; ++round) {
+					nbt::unpackBits(view.longArrayValue(), bits, layout, out);
+				}
+			});
+			double pack = measureSeconds([&]() {
+				for (int round = 0; round < rounds; ++round) {
+					nbt::packBits(out, bits, layout, std::span<int64_t>(packed));
+				}
+			});
+			if (out != states)
+				std::cout << "packed," << bits << "," << label << ",mismatch" << std::endl;
+
+			std::cout << "packed," << bits << "," << label << "," << naive * 1e9 / rounds << "," << unpack * 1e9 / rounds << ","
+				<< fromView * 1e9 / rounds << "," << pack * 1e9 / rounds << std::endl;
+		}
+	}
+}
+
+int main(int argc, char** argv) {
+	const char* mode = argc > 1 ? argv[1] : "all";
+
+	if (std::strcmp(mode, "all") == 0 || std::strcmp(mode, "suite") == 0)
+		benchSuite();
+
+	if (std::strcmp(mode, "all") == 0 || std::strcmp(mode, "arrays") == 0) {
+		benchArrays(nbt::SerializationFlag::None, "big_endian");
+		benchArrays(nbt::SerializationFlag::Bedrock, "little_endian");
+	}
+
+	if (std::strcmp(mode, "all") == 0 || std::strcmp(mode, "region") == 0)
+		benchRegion();
+	if (std::strcmp(mode, "all") == 0 || std::strcmp(mode, "batch") == 0)
+		benchBatch();
+
+	if (std::strcmp(mode, "all") == 0 || std::strcmp(mode, "schema") == 0)
+		benchSchema();
+
+	if (std::strcmp(mode, "all") == 0 || std::strcmp(mode, "network") == 0)
+		benchNetwork();
+
+	if (std::strcmp(mode, "all") == 0 || std::strcmp(mode, "packed") == 0)
+		benchPacked();
+
+	std::vector<nbt::Data> chunks;
+	for (uint32_t i = 0; i < 256; ++i)
+		chunks.push_back(makeChunk(i).serialize());
+
+	if (std::strcmp(mode, "all") == 0 || std::strcmp(mode, "query") == 0)
+		benchQuery(chunks);
+
+	if (std::strcmp(mode, "all") == 0 || std::strcmp(mode, "index") == 0)
+		benchIndex(chunks);
+
+	if (std::strcmp(mode, "all") == 0 || std::strcmp(mode, "parser") == 0)
+		benchParser(chunks);
+
+	if (std::strcmp(mode, "all") == 0 || std::strcmp(mode, "memory") == 0)
+		benchMemory(chunks);
+
+	if (std::strcmp(mode, "all") == 0 || std::strcmp(mode, "snapshot") == 0)
+		benchSnapshot(chunks);
+
+	if (std::strcmp(mode, "all") == 0 || std::strcmp(mode, "incremental") == 0)
+		benchIncremental(chunks);
+
+	// Peak RSS only grows, so run one allocator per process for a fair memory comparison.
+	if (std::strcmp(mode, "all") == 0 || std::strcmp(mode, "default") == 0)
+		benchAllocation("default", chunks, 10);
+	if (std::strcmp(mode, "all") == 0 || std::strcmp(mode, "arena") == 0)
+		benchAllocation("arena", chunks, 10);
+}
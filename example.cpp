@@ -1,4 +1,6 @@
 #include <iostream>
+#include <string>
+#include <vector>
 
 #include <nbt.hpp>
 
@@ -26,4 +28,13 @@ int main() {
 
 	std::cout << test1.stringify() << std::endl;
 	std::cout << test2.stringify() << std::endl;
+
+	// Tags store std::pmr strings and vectors. The factories also take std::string and
+	// std::vector, but the accessors return the pmr types, so copy out explicitly.
+	std::string owner = "Spheya";
+	std::vector<int32_t> scores = { 3, 1, 4 };
+	nbt::Tag test3 = nbt::Tag::Compound({ nbt::Tag::String("owner", owner), nbt::Tag::IntArray("scores", scores) });
+	std::string name(test3["owner"].stringValue());
+	std::vector<int32_t> values(test3["scores"].intArrayValue().begin(), test3["scores"].intArrayValue().end());
+	std::cout << name << " has " << values.size() << " scores" << std::endl;
 }
\ No newline at end of file
@@ -0,0 +1,84 @@
+#include <cstdint>
+#include <cstdlib>
+#include <memory_resource>
+#include <string>
+
+#include <nbt.hpp>
+
+#include "test_support.hpp"
+
+// libFuzzer entry point checking that untrusted input stays within DeserializeLimits. The first
+// byte picks the serialization flags, the rest is the document.
+
+static const nbt::DeserializeLimits limits{ 1 << 20, 64, 1 << 16, 1 << 14 };
+
+static void check(bool condition) {
+	if (!condition)
+		std::abort();
+}
+
+// Checks the decoded tree against the limits, returning the number of tags in it.
+static size_t checkTree(const nbt::Tag& tag, size_t depth) {
+	size_t tags = 1;
+	switch (tag.type()) {
+	case nbt::Tag::Type::ByteArray: check(tag.byteArrayValue().size() <= limits.maxArrayLength); break;
+	case nbt::Tag::Type::IntArray: check(tag.intArrayValue().size() <= limits.maxArrayLength); break;
+	case nbt::Tag::Type::LongArray: check(tag.longArrayValue().size() <= limits.maxArrayLength); break;
+
+	case nbt::Tag::Type::List:
+	case nbt::Tag::Type::Compound:
+		check(depth < limits.maxDepth);
+		check(tag.type() == nbt::Tag::Type::Compound || tag.listValue().size() <= limits.maxArrayLength);
+		for (const auto& child : tag.type() == nbt::Tag::Type::List ? tag.listValue() : tag.compoundValue())
+			tags += checkTree(child, depth + 1);
+		break;
+
+	default: break;
+	}
+	return tags;
+}
+
+// Accepts every callback, so the whole document is walked.
+struct Walker : nbt::Visitor {};
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+	if (size == 0)
+		return 0;
+
+	auto flags = nbt::SerializationFlag(data[0] & 0x7);
+	const uint8_t* begin = data + 1;
+	const uint8_t* end = data + size;
+
+	// Array and list lengths are checked against the limits before allocating, so the peak
+	// stays within a small multiple of maxBytes however large the lengths claim to be.
+	CountingResource resource;
+	nbt::Tag tag = nbt::Tag::deserialize(begin, end, flags, limits, &resource);
+	check(resource.peak <= 4 * limits.maxBytes + 64 * 1024);
+
+	if (tag.isValid()) {
+		check(checkTree(tag, 0) <= limits.maxTags);
+
+		nbt::Data encoded = tag.serialize(flags);
+		nbt::Tag decoded = nbt::Tag::deserialize(encoded.data(), encoded.data() + encoded.size(), flags, limits);
+		check(decoded.isValid() && decoded.serialize(flags) == encoded);
+	}
+
+	// The other decoders have to agree with the buffer one.
+	nbt::StreamInput in(nbt::StreamInput::memorySource(begin, size_t(end - begin)), 64);
+	nbt::Tag streamed = nbt::Tag::deserialize(in, flags, limits);
+	check(streamed.isValid() == tag.isValid());
+
+	nbt::TagParser parser(flags, limits);
+	size_t half = size_t(end - begin) / 2;
+	size_t used = parser.feed(std::span(begin, half));
+	if (used == half)
+		parser.feed(std::span(begin + half, end));
+	check(parser.isComplete() == tag.isValid());
+	if (tag.isValid())
+		check(parser.take().serialize(flags) == tag.serialize(flags));
+
+	Walker walker;
+	nbt::Tag::visit(begin, end, walker, flags);
+	nbt::TagIndex index(begin, end, flags);
+	return 0;
+}
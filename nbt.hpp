@@ -1,11 +1,61 @@
 #pragma once
 
 #include <string>
-#include <sstream>
+#include <string_view>
+#include <charconv>
+#include <cmath>
+#include <istream>
+#include <ostream>
+#include <memory>
+#include <functional>
 #include <vector>
+#include <memory_resource>
 #include <variant>
 #include <algorithm>
+#include <array>
+#include <iterator>
+#include <span>
 #include <bit>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <limits>
+#include <numeric>
+#include <optional>
+#include <tuple>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <ctime>
+
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#ifdef NBT_WITH_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef NBT_WITH_STATS
+#include <chrono>
+#endif
+
+#if defined(__AVX2__) || defined(__SSSE3__) || defined(__BMI2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 namespace nbt {
 	
@@ -13,13 +63,117 @@ namespace nbt {
 		None = 0x0, 
 		LittleEndian = 0x1,
 		UnnamedRootComponent = 0x2,
+		// Ints, Longs and the int lengths in front of arrays and lists are zigzag encoded VarInts
+		// and VarLongs, string and name lengths unsigned VarInts. Other values keep their width.
+		VarInt = 0x4,
 
 		Bedrock = LittleEndian,
+		BedrockNetwork = LittleEndian | VarInt,
 		JavaNetwork = UnnamedRootComponent
 	};
 
 	using Data = std::vector<uint8_t>;
 
+	// Returned by visitor callbacks to steer Tag::visit. Skip from beginCompound/beginList
+	// skips that whole subtree, from any other callback it skips the remaining siblings.
+	enum class VisitResult : uint8_t {
+		Continue, Skip, Abort
+	};
+
+	// Controls Tag::stringify. Containers nested deeper than `maxDepth` are abbreviated to
+	// `{...}` or `[...]`, and containers and arrays list at most `maxElements` entries before
+	// noting how many were left out, so logging a huge tree stays cheap.
+	struct StringifyOptions {
+		bool pretty = false;
+		uint8_t indent = 4;
+		size_t maxDepth = SIZE_MAX;
+		size_t maxElements = SIZE_MAX;
+	};
+
+	// Where and why Tag::parse gave up. `offset` counts bytes from the start of the text,
+	// `line` and `column` count from 1.
+	struct ParseError {
+		size_t offset = 0;
+		size_t line = 0;
+		size_t column = 0;
+		std::string_view message;
+	};
+
+	// Caps on what Tag::deserialize and TagParser build from untrusted input; a document that
+	// would go past one fails to decode. `maxBytes` covers the tags, names, strings and array
+	// elements of the decoded tree and `maxArrayLength` the length of any one array or list.
+	// Only the depth is capped by default, at the nesting Minecraft itself accepts, so that
+	// deeply nested input cannot overflow the stack.
+	struct DeserializeLimits {
+		size_t maxBytes = SIZE_MAX;
+		size_t maxDepth = 512;
+		size_t maxArrayLength = SIZE_MAX;
+		size_t maxTags = SIZE_MAX;
+	};
+
+	template<typename T>
+	class ArrayView;
+	class TagView;
+	class StreamInput;
+	class StreamOutput;
+	class SerializationCache;
+	class TagWriter;
+	class TagParser;
+	class RegionFile;
+	class ThreadPool;
+	class Query;
+	class TagIndex;
+	class SchemaCodec;
+	class BitPacking;
+	class Stats;
+
+	// Process-wide intern table for tag names. Every distinct name is stored once and shared by
+	// all tags carrying it, so the keys repeated across a world ("id", "Count", "Pos") cost one
+	// string each. Entries are reference counted by the tags and recycled once the last one lets
+	// go, so untrusted input cannot grow the table for good. Each thread keeps a small cache of
+	// recently used names in front of the shared, locked table.
+	class NameTable {
+	public:
+		// Number of distinct names currently alive.
+		static size_t size();
+
+		// Heap memory held by the table: its buckets, and each entry with any name too long to
+		// be stored inline.
+		static size_t bytes();
+
+	private:
+		friend class Tag;
+		friend class TagView;
+
+		// Entries are allocated one by one and never move, so tags refer to them by pointer and
+		// reading a name is a single dereference.
+		struct Entry {
+			std::atomic<uint32_t> references = 0;
+			uint32_t hash = 0;
+			Entry* next = nullptr;
+			std::pmr::string value{ std::pmr::new_delete_resource() };
+		};
+
+		static constexpr size_t BucketCount = 1024;
+		static constexpr size_t CacheSize = 256;
+
+		// A null entry means "no name"; acquire returns an entry holding one reference.
+		static Entry* acquire(std::string_view name);
+		static void retain(Entry* entry) noexcept;
+		static void release(Entry* entry) noexcept;
+		static const std::pmr::string& get(const Entry* entry) noexcept;
+		static uint32_t hash(const Entry* entry) noexcept;
+		static uint32_t hashName(std::string_view name) noexcept;
+
+		static NameTable& instance();
+		Entry* find(std::string_view name, uint32_t hash);
+		void remove(Entry* entry);
+
+		std::mutex m_mutex;
+		std::vector<Entry*> m_buckets = std::vector<Entry*>(BucketCount, nullptr);
+		size_t m_size = 0;
+	};
+
 	class Tag {
 	public:
 		enum class Type : size_t {
@@ -29,31 +183,65 @@ namespace nbt {
 		};
 
 	public:
-		static Tag End()                                                   { Tag t;                  t.m_value.emplace<size_t(Type::End)>(0);                      return t; };
-		static Tag Byte(int8_t value)                                      { Tag t;                  t.m_value.emplace<size_t(Type::Byte)>(value);                 return t; }
-		static Tag Byte(std::string name, int8_t value)                    { Tag t(std::move(name)); t.m_value.emplace<size_t(Type::Byte)>(value);                 return t; }
-		static Tag Short(int16_t value)                                    { Tag t;                  t.m_value.emplace<size_t(Type::Short)>(value);                return t; }
-		static Tag Short(std::string name, int16_t value)                  { Tag t(std::move(name)); t.m_value.emplace<size_t(Type::Short)>(value);                return t; }
-		static Tag Int(int32_t value)                                      { Tag t;                  t.m_value.emplace<size_t(Type::Int)>(value);                  return t; }
-		static Tag Int(std::string name, int32_t value)                    { Tag t(std::move(name)); t.m_value.emplace<size_t(Type::Int)>(value);                  return t; }
-		static Tag Long(int64_t value)                                     { Tag t;                  t.m_value.emplace<size_t(Type::Long)>(value);                 return t; }
-		static Tag Long(std::string name, int64_t value)                   { Tag t(std::move(name)); t.m_value.emplace<size_t(Type::Long)>(value);                 return t; }
-		static Tag Float(float value)                                      { Tag t;                  t.m_value.emplace<size_t(Type::Float)>(value);                return t; }
-		static Tag Float(std::string name, float value)                    { Tag t(std::move(name)); t.m_value.emplace<size_t(Type::Float)>(value);                return t; }
-		static Tag Double(double value)                                    { Tag t;                  t.m_value.emplace<size_t(Type::Double)>(value);               return t; }
-		static Tag Double(std::string name, double value)                  { Tag t(std::move(name)); t.m_value.emplace<size_t(Type::Double)>(value);               return t; }
-		static Tag ByteArray(std::vector<int8_t> value)                    { Tag t;                  t.m_value.emplace<size_t(Type::ByteArray)>(std::move(value)); return t; }
-		static Tag ByteArray(std::string name, std::vector<int8_t> value)  { Tag t(std::move(name)); t.m_value.emplace<size_t(Type::ByteArray)>(std::move(value)); return t; }
-		static Tag String(std::string value)                               { Tag t;                  t.m_value.emplace<size_t(Type::String)>(std::move(value));    return t; }
-		static Tag String(std::string name, std::string value)             { Tag t(std::move(name)); t.m_value.emplace<size_t(Type::String)>(std::move(value));    return t; }
-		static Tag List(std::vector<Tag> value)                            { Tag t;                  t.m_value.emplace<size_t(Type::List)>(std::move(value));      return t; }
-		static Tag List(std::string name, std::vector<Tag> value)          { Tag t(std::move(name)); t.m_value.emplace<size_t(Type::List)>(std::move(value));      return t; }
-		static Tag Compound(std::vector<Tag> value)                        { Tag t;                  t.m_value.emplace<size_t(Type::Compound)>(std::move(value));  return t; }
-		static Tag Compound(std::string name, std::vector<Tag> value)      { Tag t(std::move(name)); t.m_value.emplace<size_t(Type::Compound)>(std::move(value));  return t; }
-		static Tag IntArray(std::vector<int32_t> value)                    { Tag t;                  t.m_value.emplace<size_t(Type::IntArray)>(std::move(value));  return t; }
-		static Tag IntArray(std::string name, std::vector<int32_t> value)  { Tag t(std::move(name)); t.m_value.emplace<size_t(Type::IntArray)>(std::move(value));  return t; }
-		static Tag LongArray(std::vector<int64_t> value)                   { Tag t;                  t.m_value.emplace<size_t(Type::LongArray)>(std::move(value)); return t; }
-		static Tag LongArray(std::string name, std::vector<int64_t> value) { Tag t(std::move(name)); t.m_value.emplace<size_t(Type::LongArray)>(std::move(value)); return t; }
+		Tag(const Tag& other);
+		Tag(Tag&& other) noexcept;
+		Tag& operator=(const Tag& other);
+		Tag& operator=(Tag&& other) noexcept;
+		~Tag();
+
+		static Tag End()                                                             { Tag t;                  t.m_value.emplace<size_t(Type::End)>(0);                      return t; };
+		static Tag Byte(int8_t value)                                                { Tag t;                  t.m_value.emplace<size_t(Type::Byte)>(value);                 return t; }
+		static Tag Byte(std::string_view name, int8_t value)                         { Tag t(name);            t.m_value.emplace<size_t(Type::Byte)>(value);                 return t; }
+		static Tag Short(int16_t value)                                              { Tag t;                  t.m_value.emplace<size_t(Type::Short)>(value);                return t; }
+		static Tag Short(std::string_view name, int16_t value)                       { Tag t(name);            t.m_value.emplace<size_t(Type::Short)>(value);                return t; }
+		static Tag Int(int32_t value)                                                { Tag t;                  t.m_value.emplace<size_t(Type::Int)>(value);                  return t; }
+		static Tag Int(std::string_view name, int32_t value)                         { Tag t(name);            t.m_value.emplace<size_t(Type::Int)>(value);                  return t; }
+		static Tag Long(int64_t value)                                               { Tag t;                  t.m_value.emplace<size_t(Type::Long)>(value);                 return t; }
+		static Tag Long(std::string_view name, int64_t value)                        { Tag t(name);            t.m_value.emplace<size_t(Type::Long)>(value);                 return t; }
+		static Tag Float(float value)                                                { Tag t;                  t.m_value.emplace<size_t(Type::Float)>(value);                return t; }
+		static Tag Float(std::string_view name, float value)                         { Tag t(name);            t.m_value.emplace<size_t(Type::Float)>(value);                return t; }
+		static Tag Double(double value)                                              { Tag t;                  t.m_value.emplace<size_t(Type::Double)>(value);               return t; }
+		static Tag Double(std::string_view name, double value)                       { Tag t(name);            t.m_value.emplace<size_t(Type::Double)>(value);               return t; }
+		static Tag ByteArray(std::pmr::vector<int8_t> value)                         { Tag t;                  t.m_value.emplace<size_t(Type::ByteArray)>(std::move(value)); return t; }
+		static Tag ByteArray(std::string_view name, std::pmr::vector<int8_t> value)  { Tag t(name);            t.m_value.emplace<size_t(Type::ByteArray)>(std::move(value)); return t; }
+		static Tag String(std::pmr::string value)                                    { Tag t;                  t.m_value.emplace<size_t(Type::String)>(std::move(value));    return t; }
+		static Tag String(std::string_view name, std::pmr::string value)             { Tag t(name);            t.m_value.emplace<size_t(Type::String)>(std::move(value));    return t; }
+		static Tag List(std::pmr::vector<Tag> value)                                 { Tag t;                  t.m_value.emplace<size_t(Type::List)>(std::move(value));      return t; }
+		static Tag List(std::string_view name, std::pmr::vector<Tag> value)          { Tag t(name);            t.m_value.emplace<size_t(Type::List)>(std::move(value));      return t; }
+		static Tag Compound(std::pmr::vector<Tag> value)                             { Tag t;                  t.m_value.emplace<size_t(Type::Compound)>(std::move(value));  t.buildIndex(); return t; }
+		static Tag Compound(std::string_view name, std::pmr::vector<Tag> value)      { Tag t(name);            t.m_value.emplace<size_t(Type::Compound)>(std::move(value));  t.buildIndex(); return t; }
+		static Tag IntArray(std::pmr::vector<int32_t> value)                         { Tag t;                  t.m_value.emplace<size_t(Type::IntArray)>(std::move(value));  return t; }
+		static Tag IntArray(std::string_view name, std::pmr::vector<int32_t> value)  { Tag t(name);            t.m_value.emplace<size_t(Type::IntArray)>(std::move(value));  return t; }
+		static Tag LongArray(std::pmr::vector<int64_t> value)                        { Tag t;                  t.m_value.emplace<size_t(Type::LongArray)>(std::move(value)); return t; }
+		static Tag LongArray(std::string_view name, std::pmr::vector<int64_t> value) { Tag t(name);            t.m_value.emplace<size_t(Type::LongArray)>(std::move(value)); return t; }
+
+
+		// The same from std::string and std::vector, whose contents are copied (or for tags
+		// moved) into the std::pmr types above on the default resource.
+		template<typename S> requires std::is_same_v<S, std::string>
+		static Tag String(const S& value)                                            { return String(std::pmr::string(value)); }
+		template<typename S> requires std::is_same_v<S, std::string>
+		static Tag String(std::string_view name, const S& value)                     { return String(name, std::pmr::string(value)); }
+		template<typename V> requires std::is_same_v<V, std::vector<int8_t>>
+		static Tag ByteArray(const V& value)                                         { return ByteArray(std::pmr::vector<int8_t>(value.begin(), value.end())); }
+		template<typename V> requires std::is_same_v<V, std::vector<int8_t>>
+		static Tag ByteArray(std::string_view name, const V& value)                  { return ByteArray(name, std::pmr::vector<int8_t>(value.begin(), value.end())); }
+		template<typename V> requires std::is_same_v<V, std::vector<int32_t>>
+		static Tag IntArray(const V& value)                                          { return IntArray(std::pmr::vector<int32_t>(value.begin(), value.end())); }
+		template<typename V> requires std::is_same_v<V, std::vector<int32_t>>
+		static Tag IntArray(std::string_view name, const V& value)                   { return IntArray(name, std::pmr::vector<int32_t>(value.begin(), value.end())); }
+		template<typename V> requires std::is_same_v<V, std::vector<int64_t>>
+		static Tag LongArray(const V& value)                                         { return LongArray(std::pmr::vector<int64_t>(value.begin(), value.end())); }
+		template<typename V> requires std::is_same_v<V, std::vector<int64_t>>
+		static Tag LongArray(std::string_view name, const V& value)                  { return LongArray(name, std::pmr::vector<int64_t>(value.begin(), value.end())); }
+		template<typename V> requires std::is_same_v<V, std::vector<Tag>>
+		static Tag List(V value)                                                     { return List(std::pmr::vector<Tag>(std::make_move_iterator(value.begin()), std::make_move_iterator(value.end()))); }
+		template<typename V> requires std::is_same_v<V, std::vector<Tag>>
+		static Tag List(std::string_view name, V value)                              { return List(name, std::pmr::vector<Tag>(std::make_move_iterator(value.begin()), std::make_move_iterator(value.end()))); }
+		template<typename V> requires std::is_same_v<V, std::vector<Tag>>
+		static Tag Compound(V value)                                                 { return Compound(std::pmr::vector<Tag>(std::make_move_iterator(value.begin()), std::make_move_iterator(value.end()))); }
+		template<typename V> requires std::is_same_v<V, std::vector<Tag>>
+		static Tag Compound(std::string_view name, V value)                          { return Compound(name, std::pmr::vector<Tag>(std::make_move_iterator(value.begin()), std::make_move_iterator(value.end()))); }
 
 		Type type() const noexcept;
 		bool isValid() const noexcept;
@@ -64,41 +252,360 @@ namespace nbt {
 		int64_t longValue() const;
 		float floatValue() const;
 		double doubleValue() const;
-		const std::vector<int8_t>& byteArrayValue() const;
-		const std::string& stringValue() const;
-		const std::vector<Tag>& listValue() const;
-		const std::vector<Tag>& compoundValue() const;
-		const std::vector<int32_t>& intArrayValue() const;
-		const std::vector<int64_t>& longArrayValue() const;
+		const std::pmr::vector<int8_t>& byteArrayValue() const;
+		const std::pmr::string& stringValue() const;
+		const std::pmr::vector<Tag>& listValue() const;
+		const std::pmr::vector<Tag>& compoundValue() const;
+		const std::pmr::vector<int32_t>& intArrayValue() const;
+		const std::pmr::vector<int64_t>& longArrayValue() const;
 
 		void addChild(Tag tag);
 
-		const std::string& name() const noexcept;
+		// Copy-on-write sharing. share() moves every container and array of the tree into
+		// reference-counted nodes, after which copying the tree is O(1) and a copy is an
+		// immutable snapshot: the edit functions below clone a node only while another copy
+		// still refers to it, so an edit copies just the path from the root to the edited tag.
+		// A snapshot may be read or serialized on another thread while the original is being
+		// edited; the tree is not otherwise thread-safe. Children added to a shared tree are
+		// shared as well. A reference returned by the edit functions must not be kept across a
+		// copy of the tree, as edits through it would reach the copy too.
+		void share();
+		bool isShared() const noexcept;
+
+		// Mutable access to members and list elements. The lookup index of a compound is keyed on
+		// member names, so a member reached through these keeps its name when assigned to, as in
+		// `*root.editChild("a") = Tag::Int("b", 1)`, and setName() throws std::logic_error rather
+		// than rename it. To rename a member, remove it and add a renamed copy.
+		Tag* editChild(std::string_view name);
+		Tag& editChild(size_t position);
+		bool removeChild(std::string_view name);
+		void removeChild(size_t position);
+		std::pmr::string& editString();
+		std::pmr::vector<int8_t>& editByteArray();
+		std::pmr::vector<int32_t>& editIntArray();
+		std::pmr::vector<int64_t>& editLongArray();
+
+		// Replaces the value and its type, keeping this tag's name.
+		void setValue(Tag value);
+
+		// Compound member lookup. Compounds with many members keep a hash index next to the
+		// members, so lookups stay O(1) while the members keep their serialized order.
+		const Tag* find(std::string_view name) const;
+		const Tag& operator[](std::string_view name) const;
+
+		const std::pmr::string& name() const noexcept;
 		bool hasName() const noexcept;
 		void setName(const std::string* name);
-		void setName(std::string name) noexcept;
+		void setName(std::string_view name);
+
+		std::string stringify(const StringifyOptions& options = {}) const;
 
-		std::string stringify() const;
+		// Appends the SNBT text to `out`, so one buffer can be reused across calls.
+		void stringify(std::string& out, const StringifyOptions& options = {}) const;
+
+		// Reads SNBT as written by stringify: b/s/l/f/d suffixed numbers, [B;/[I;/[L; arrays,
+		// single- or double-quoted strings with escapes, unquoted strings, and an optional name
+		// in front of the root value. Floats beyond their range read as infinities, as in Java,
+		// and NaNf/NaNd as NaN, which is how stringify writes non-finite values. Returns an invalid tag on malformed text; the second
+		// overload also reports where.
+		static Tag parse(std::string_view text, std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+		static Tag parse(std::string_view text, ParseError& error, std::pmr::memory_resource* resource = std::pmr::get_default_resource());
 		Data serialize(SerializationFlag flags = SerializationFlag::None) const;
-		static Tag deserialize(const void* data, const void* end, SerializationFlag flags = SerializationFlag::None);
+
+		// Exact number of bytes serialize() produces for these flags.
+		size_t serializedSize(SerializationFlag flags = SerializationFlag::None) const;
+
+		// Appends the encoding to `data`, growing it exactly once.
+		void serialize(Data& data, SerializationFlag flags = SerializationFlag::None) const;
+
+		// Writes the encoding into a caller-owned buffer and returns the number of bytes written,
+		// or 0 without touching the buffer when it is too small.
+		size_t serialize(std::span<uint8_t> buffer, SerializationFlag flags = SerializationFlag::None) const;
+
+		// Streams the encoding through `out`'s fixed-size buffer. Returns false once the sink
+		// has rejected a write.
+		bool serialize(StreamOutput& out, SerializationFlag flags = SerializationFlag::None) const;
+
+		// Encodes a shared tree, reusing the bytes `cache` kept from the previous call for every
+		// node that has not been edited since. The result lives in the cache and stays valid
+		// until its next use.
+		const Data& serialize(SerializationCache& cache, SerializationFlag flags = SerializationFlag::None) const;
+
+		// Every string and container of the returned tree is allocated from `resource`, so a
+		// whole document can be dropped at once by releasing a monotonic arena. Names are not:
+		// they are shared through the global NameTable and freed with their last tag.
+		static Tag deserialize(const void* data, const void* end, SerializationFlag flags = SerializationFlag::None, std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+
+		// Decodes a document pulled from `in`, which only ever buffers a window of the input.
+		static Tag deserialize(StreamInput& in, SerializationFlag flags = SerializationFlag::None, std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+
+		// Versions of deserialize for untrusted input that give up once the document goes past
+		// `limits`, before allocating for it.
+		static Tag deserialize(const void* data, const void* end, SerializationFlag flags, const DeserializeLimits& limits, std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+		static Tag deserialize(StreamInput& in, SerializationFlag flags, const DeserializeLimits& limits, std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+
+		template<typename Visitor>
+		static bool visit(const void* data, const void* end, Visitor& visitor, SerializationFlag flags = SerializationFlag::None);
+
+		// One encoded document of a batch.
+		struct Payload {
+			const void* data;
+			size_t size;
+			SerializationFlag flags = SerializationFlag::None;
+		};
+
+		// Batch versions of deserialize and serialize that spread the items across `pool`.
+		// Results are in input order; a payload that fails to decode yields an invalid tag.
+		// `resource` is shared by every thread, so it has to be thread-safe.
+		static std::vector<Tag> deserialize(std::span<const Payload> payloads, ThreadPool& pool, std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+		static std::vector<Data> serialize(std::span<const Tag> tags, ThreadPool& pool, SerializationFlag flags = SerializationFlag::None);
 
 	private:
+		friend class TagView;
+		friend class StreamInput;
+		friend class StreamOutput;
+		friend class SerializationCache;
+		friend class TagWriter;
+		friend class TagParser;
+		friend class RegionFile;
+		friend class Query;
+		friend class TagIndex;
+		friend class SchemaCodec;
+		friend class BitPacking;
+		friend class Stats;
+		template<typename T>
+		friend class ArrayView;
+
 		Tag() = default;
-		Tag(std::string name) : m_hasName(true), m_name(std::move(name)) {}
+		explicit Tag(std::string_view name) : m_name(reinterpret_cast<uintptr_t>(NameTable::acquire(name))) {}
+
+		static constexpr size_t IndexThreshold = 8;
+
+		// Compound payload: the members plus, from IndexThreshold members on, an open-addressing
+		// table of member positions allocated from the members' resource. Its first word holds
+		// the slot count.
+		struct CompoundValue {
+			std::pmr::vector<Tag> children;
+			uint32_t* index = nullptr;
+
+			CompoundValue(std::pmr::vector<Tag> children) : children(std::move(children)) {}
+			CompoundValue(const CompoundValue& other);
+			CompoundValue(CompoundValue&& other) noexcept;
+			CompoundValue& operator=(const CompoundValue& other);
+			CompoundValue& operator=(CompoundValue&& other);
+			~CompoundValue();
+
+			void allocateIndex(size_t slots);
+			void copyIndex(const uint32_t* other);
+			void freeIndex() noexcept;
+			void unpinMembers() noexcept;
+		};
+
+		void buildIndex();
+		void indexChild(uint32_t position);
+
+		// A shared tag holds its value in a node; the tag itself keeps the name and error flag.
+		struct SharedNode;
+		struct SharedValue {
+			SharedNode* node;
+
+			explicit SharedValue(SharedNode* node) noexcept : node(node) {}
+			SharedValue(const SharedValue& other) noexcept;
+			SharedValue(SharedValue&& other) noexcept : node(std::exchange(other.node, nullptr)) {}
+			SharedValue& operator=(const SharedValue& other) noexcept;
+			SharedValue& operator=(SharedValue&& other) noexcept;
+			~SharedValue();
+		};
+
+		static constexpr size_t SharedIndex = 13;
+
+		// The tag holding the value: the node's for shared tags, this one otherwise.
+		const Tag& target() const noexcept;
+		// Like target(), but first clones the node if anyone else refers to it.
+		Tag& detach();
+
+		void stringify(std::string& out, const StringifyOptions& options, size_t depth) const;
+		static void stringifyName(std::string& out, std::string_view name);
+		static void stringifyString(std::string& out, std::string_view value);
+		template<typename T>
+		static void stringifyNumber(std::string& out, T value, std::string_view suffix = {});
+		template<typename T>
+		static void stringifyArray(std::string& out, std::string_view prefix, const T& values, std::string_view suffix, const StringifyOptions& options);
+		static void stringifyNewline(std::string& out, const StringifyOptions& options, size_t depth);
+
+		// Recursive descent over SNBT text. Only the first failure is recorded.
+		struct SnbtReader {
+			static constexpr size_t MaxDepth = 512;
 
-		void stringify(std::stringstream& stream) const;
-		void serialize(std::vector<uint8_t>& data, SerializationFlag flags, bool hideName) const;
-		static Tag deserialize(const uint8_t*& data, const void* end, SerializationFlag flags, bool isNameHidden, bool isRoot);
+			const char* begin;
+			const char* it;
+			const char* end;
+			std::pmr::memory_resource* resource;
+			const char* errorAt = nullptr;
+			std::string_view message;
+			std::pmr::string name{ resource };
+
+			bool fail(const char* at, std::string_view why) noexcept;
+			void skipWhitespace() noexcept;
+			bool consume(char c) noexcept;
+			std::string_view readWord() noexcept;
+			bool readName(std::pmr::string& name);
+			bool readQuoted(std::pmr::string& out);
+			bool readValue(Tag& tag, size_t depth);
+			bool readScalar(Tag& tag, const char* start, std::string_view word);
+			bool readList(Tag& tag, size_t depth);
+			bool readCompound(Tag& tag, size_t depth);
+			template<typename T>
+			bool readArray(Tag& tag, char suffix);
+			template<typename T>
+			static bool parseInteger(std::string_view word, T& value) noexcept;
+			static bool isInteger(std::string_view word) noexcept;
+			template<typename T>
+			static bool parseFloating(std::string_view word, T& value) noexcept;
+		};
+
+		// Writes over whatever `data` already holds, growing it only when that runs out, so a
+		// recycled buffer is not cleared and refilled on every call.
+		struct DataOutput {
+			Data& data;
+			size_t size = 0;
+
+			void write(const void* src, size_t count);
+
+			template<typename T>
+			void writeArray(const T* src, size_t count, SerializationFlag flags);
+
+			uint8_t* reserve(size_t count);
+		};
+
+		struct BufferOutput {
+			uint8_t* it;
+
+			void write(const void* src, size_t size) noexcept;
+
+			template<typename T>
+			void writeArray(const T* src, size_t count, SerializationFlag flags) noexcept;
+		};
+
+		bool isRootNameHidden(SerializationFlag flags) const noexcept;
+		size_t serializedSize(SerializationFlag flags, bool hideName) const;
+		size_t serializedPayloadSize(SerializationFlag flags) const;
+
+		template<typename Output>
+		void serialize(Output& out, SerializationFlag flags, bool hideName) const;
+
+		template<typename Output>
+		void serializeHeader(Output& out, SerializationFlag flags, bool hideName) const;
+
+		template<typename Output>
+		void serializePayload(Output& out, SerializationFlag flags) const;
+
+		// Writes the framing of a list or compound, calling writeChild(child) for the payload of
+		// each child in between; SerializationCache uses it to splice in cached subtrees.
+		template<typename Output, typename WriteChild>
+		void serializeContainer(Output& out, SerializationFlag flags, WriteChild&& writeChild) const;
+		struct BufferInput {
+			const uint8_t* it;
+			const void* end;
+
+			bool read(void* dst, size_t size) noexcept;
+			size_t remaining() const noexcept;
+
+			template<typename T>
+			bool readArray(T* dst, size_t count, SerializationFlag flags) noexcept;
+		};
+
+		static constexpr size_t ArrayChunkSize = 64 * 1024;
+
+		// What a document being decoded may still use of its DeserializeLimits.
+		struct Budget {
+			size_t bytes;
+			size_t depth;
+			size_t arrayLength;
+			size_t tags;
+
+			explicit Budget(const DeserializeLimits& limits) noexcept;
+
+			bool addTag(size_t nameSize) noexcept;
+			bool addArray(size_t count, size_t elementSize) noexcept;
+			bool addBytes(size_t count) noexcept;
+		};
+
+		template<typename Input>
+		static Tag deserialize(Input& in, SerializationFlag flags, bool isNameHidden, bool isRoot, Budget& budget, std::pmr::memory_resource* resource);
+
+		template<typename Input>
+		static void deserializePayload(Tag& tag, Type type, Input& in, SerializationFlag flags, Budget& budget, std::pmr::memory_resource* resource);
+		// The recursive walkers below give up at the default DeserializeLimits::maxDepth, where
+		// `depth` counts the lists and compounds around the payload.
+		static constexpr size_t MaxDepth = DeserializeLimits{}.maxDepth;
+
+		static void skipPayload(Type type, const uint8_t*& data, const void* end, SerializationFlag flags, bool& error, size_t depth = 0);
+		static size_t fixedPayloadSize(Type type, SerializationFlag flags) noexcept;
+
+		// VarInt arrays are decoded into `scratch` to be handed out as an ArrayView. One buffer
+		// serves a whole visit, so it only grows to the largest array rather than allocating for each.
+		template<typename Visitor>
+		static VisitResult visitPayload(Type type, std::string_view name, const uint8_t*& data, const void* end, SerializationFlag flags, Visitor& visitor, bool& error, std::vector<uint8_t>& scratch, size_t depth = 0);
+		template<typename T, typename Visitor>
+		static VisitResult visitVarIntArray(std::string_view name, const uint8_t*& data, const void* end, size_t size, Visitor& visitor, bool& error, std::vector<uint8_t>& scratch);
 		
-		static void writeData(std::vector<uint8_t>& data, const void* src, size_t size);
-		static void readData(const uint8_t*& data, const void* end, void* dst, size_t size, bool& error);
+		template<typename Output>
+		static void writeData(Output& out, const void* src, size_t size);
+		template<typename Input>
+		static void readData(Input& in, void* dst, size_t size, bool& error);
+		static void skipData(const uint8_t*& data, const void* end, size_t size, bool& error);
 		
-		template<typename T>
-		static void writeNumericalData(std::vector<uint8_t>& data, T src, SerializationFlag flags);
+		template<typename T, typename Output>
+		static void writeNumericalData(Output& out, T src, SerializationFlag flags);
 		
 		template<typename T>
 		static T readNumericalData(const uint8_t*& data, const void* end, SerializationFlag flags, bool& error);
 
+		template<typename T, typename Input>
+		static T readNumericalData(Input& in, SerializationFlag flags, bool& error);
+
+		template<typename T>
+		static T decodeNumericalData(const uint8_t* data, SerializationFlag flags) noexcept;
+
+		template<typename T, typename Output>
+		static void writeArrayData(Output& out, const T* src, size_t count, SerializationFlag flags);
+
+		template<typename T, typename Input>
+		static void readArrayData(Input& in, std::pmr::vector<T>& dst, size_t count, SerializationFlag flags, bool& error);
+
+		template<typename T>
+		static void copyNumericalData(void* dst, const void* src, size_t count, SerializationFlag flags) noexcept;
+
+		template<size_t Size>
+		static void byteSwapData(uint8_t* dst, const uint8_t* src, size_t count) noexcept;
+
+		static bool needsByteSwap(SerializationFlag flags) noexcept;
+		static bool isVarInt(SerializationFlag flags) noexcept;
+
+		// Ints, Longs and lengths go over the wire as VarInts under SerializationFlag::VarInt.
+		template<typename T>
+		static constexpr bool IsVarIntType = std::is_same_v<T, int32_t> || std::is_same_v<T, int64_t> || std::is_same_v<T, uint16_t>;
+		template<typename T>
+		static constexpr size_t MaxVarIntSize = (sizeof(T) * 8 + 6) / 7;
+		static constexpr size_t VarIntBatchSize = 256;
+
+		template<typename T>
+		static size_t numericalSize(T value, SerializationFlag flags) noexcept;
+		template<typename T>
+		static size_t arrayDataSize(const T* src, size_t count, SerializationFlag flags) noexcept;
+
+		template<typename T>
+		static uint64_t toVarInt(T value) noexcept;
+		template<typename T>
+		static T fromVarInt(uint64_t value, bool& error) noexcept;
+		static size_t varIntSize(uint64_t value) noexcept;
+		// Writes the VarInt and returns its size. Values of up to 8 bytes are stored as one whole
+		// word, so `dst` needs room for at least 8 bytes whatever the size.
+		static size_t encodeVarInt(uint8_t* dst, uint64_t value) noexcept;
+		static bool decodeVarInt(const uint8_t*& data, const void* end, size_t maxSize, uint64_t& value) noexcept;
+		static void skipVarInts(const uint8_t*& data, const void* end, size_t count, bool& error) noexcept;
+
 	private:
 		std::variant<
 			int,
@@ -108,18 +615,34 @@ namespace nbt {
 			int64_t,
 			float,
 			double,
-			std::vector<int8_t>,
-			std::string,
-			std::vector<Tag>,
-			std::vector<Tag>,
-			std::vector<int32_t>,
-			std::vector<int64_t>
+			std::pmr::vector<int8_t>,
+			std::pmr::string,
+			std::pmr::vector<Tag>,
+			CompoundValue,
+			std::pmr::vector<int32_t>,
+			std::pmr::vector<int64_t>,
+			SharedValue
 		> m_value;
 
-		bool m_hasName = false;
-		std::string m_name;
+		// The NameTable entry of the name, null for tags without one such as list elements. The
+		// lowest bit marks a tag that failed to deserialize and the next one a compound member
+		// handed out by editChild, whose name assignment keeps. So the name and both flags add a
+		// single pointer to the 48-byte variant and sizeof(Tag) is 56 on 64-bit libstdc++.
+		static constexpr uintptr_t ErrorBit = 1;
+		static constexpr uintptr_t MemberBit = 2;
+		static_assert(alignof(NameTable::Entry) > (ErrorBit | MemberBit));
 
-		bool m_error = false;
+		NameTable::Entry* nameEntry() const noexcept;
+		std::string_view nameView() const noexcept;
+		void setNameEntry(NameTable::Entry* entry) noexcept;
+		void setError() noexcept;
+
+		uintptr_t m_name = 0;
+	};
+
+	struct Tag::SharedNode {
+		std::atomic<uint32_t> references = 1;
+		Tag tag;
 	};
 
 	inline SerializationFlag operator|(SerializationFlag a, SerializationFlag b) {
@@ -138,447 +661,5625 @@ namespace nbt {
 		return SerializationFlag(~uint8_t(a));
 	}
 
-	inline Tag::Type nbt::Tag::type() const noexcept {
-		return Type(m_value.index());
-	}
+	// Read-only view over an IntArray or LongArray payload inside a serialized buffer.
+	// Elements are decoded from the wire representation on access.
+	template<typename T>
+	class ArrayView {
+	public:
+		class Iterator {
+		public:
+			using iterator_category = std::forward_iterator_tag;
+			using value_type = T;
+			using difference_type = std::ptrdiff_t;
+			using pointer = void;
+			using reference = T;
 
-	inline bool Tag::isValid() const noexcept {
-		return !m_error;
-	}
+			Iterator() = default;
+			Iterator(const uint8_t* it, SerializationFlag flags) : m_it(it), m_flags(flags) {}
 
-	inline int8_t Tag::byteValue() const {
-		return std::get<size_t(Type::Byte)>(m_value);
-	}
+			T operator*() const noexcept;
+			Iterator& operator++() noexcept;
+			Iterator operator++(int) noexcept;
+			bool operator==(const Iterator& other) const noexcept;
 
-	inline int16_t Tag::shortValue() const {
-		return std::get<size_t(Type::Short)>(m_value);
-	}
+		private:
+			const uint8_t* m_it = nullptr;
+			SerializationFlag m_flags = SerializationFlag::None;
+		};
 
-	inline int32_t Tag::intValue() const {
-		return std::get<size_t(Type::Int)>(m_value);
-	}
+	public:
+		ArrayView() = default;
+		ArrayView(const uint8_t* data, size_t size, SerializationFlag flags) : m_data(data), m_size(size), m_flags(flags) {}
 
-	inline int64_t Tag::longValue() const {
-		return std::get<size_t(Type::Long)>(m_value);
-	}
+		size_t size() const noexcept;
+		bool empty() const noexcept;
+		T operator[](size_t index) const noexcept;
 
-	inline float Tag::floatValue() const {
-		return std::get<size_t(Type::Float)>(m_value);
-	}
+		void copyTo(T* dst) const noexcept;
+		std::pmr::vector<T> toVector(std::pmr::memory_resource* resource = std::pmr::get_default_resource()) const;
 
-	inline double Tag::doubleValue() const {
-		return std::get<size_t(Type::Double)>(m_value);
-	}
+		Iterator begin() const noexcept;
+		Iterator end() const noexcept;
 
-	inline const std::vector<int8_t>& Tag::byteArrayValue() const {
-		return std::get<size_t(Type::ByteArray)>(m_value);
-	}
+	private:
+		friend class BitPacking;
 
-	inline const std::string& Tag::stringValue() const {
-		return std::get<size_t(Type::String)>(m_value);
-	}
+		const uint8_t* m_data = nullptr;
+		size_t m_size = 0;
+		SerializationFlag m_flags = SerializationFlag::None;
+	};
 
-	inline const std::vector<Tag>& Tag::listValue() const {
-		return std::get<size_t(Type::List)>(m_value);
-	}
+	// Read-only, non-owning view of a serialized tag. Nothing is decoded or allocated
+	// until a value is accessed, so the underlying buffer has to outlive the view.
+	class TagView {
+	public:
+		using Type = Tag::Type;
 
-	inline const std::vector<Tag>& Tag::compoundValue() const {
-		return std::get<size_t(Type::Compound)>(m_value);
-	}
+		class Iterator;
+		class Children;
 
-	inline const std::vector<int32_t>& Tag::intArrayValue() const {
-		return std::get<size_t(Type::IntArray)>(m_value);
-	}
+	public:
+		TagView() = default;
+		TagView(const void* data, const void* end, SerializationFlag flags = SerializationFlag::None);
 
-	inline const std::vector<int64_t>& Tag::longArrayValue() const {
-		return std::get<size_t(Type::LongArray)>(m_value);
-	}
+		Type type() const noexcept;
+		// Whether the header and payload are complete, checked once when the view is made.
+		bool isValid() const noexcept;
 
-	inline void Tag::addChild(Tag tag) {
-		std::vector<Tag>* vec;
-		if (type() == Type::Compound) {
-			vec = &std::get<size_t(Type::Compound)>(m_value);
-		} else {
-			vec = &std::get<size_t(Type::List)>(m_value);
-		}
+		int8_t byteValue() const;
+		int16_t shortValue() const;
+		int32_t intValue() const;
+		int64_t longValue() const;
+		float floatValue() const;
+		double doubleValue() const;
+		std::span<const int8_t> byteArrayValue() const;
+		std::string_view stringValue() const;
+		Children listValue() const;
+		Children compoundValue() const;
+		// Empty for buffers written with SerializationFlag::VarInt, whose elements cannot be
+		// indexed in place; use toTag or Tag::visit there.
+		ArrayView<int32_t> intArrayValue() const;
+		ArrayView<int64_t> longArrayValue() const;
 
-		vec->emplace_back(std::move(tag));
-	}
+		size_t listSize() const;
+		Type listType() const;
 
-	inline const std::string& Tag::name() const noexcept {
-		return m_name;
-	}
+		std::string_view name() const noexcept;
+		bool hasName() const noexcept;
 
-	inline bool Tag::hasName() const noexcept {
-		return m_hasName;
-	}
+		const uint8_t* payloadEnd() const noexcept;
+		Tag toTag(std::pmr::memory_resource* resource = std::pmr::get_default_resource()) const;
 
-	inline void Tag::setName(const std::string* name) {
-		if (name == nullptr) {
-			m_hasName = false;
-			m_name = "";
-		} else {
-			setName(*name);
-		}
-	}
+	private:
+		TagView(Type type, const uint8_t* payload, const void* end, SerializationFlag flags) :
+			m_payload(payload), m_end(static_cast<const uint8_t*>(end)), m_type(type), m_flags(flags), m_error(false) {}
 
-	inline void Tag::setName(std::string name) noexcept {
-		m_hasName = true;
-		m_name = std::move(name);
-	}
+		friend class Query;
+		friend class TagIndex;
 
-	inline std::string Tag::stringify() const {
-		std::stringstream stream;
-		stringify(stream);
-		return stream.str();
-	}
+		static TagView readHeader(const uint8_t* it, const void* end, SerializationFlag flags, bool isRoot);
+		void checkType(Type type) const;
+		Children children() const noexcept;
 
-	inline Data Tag::serialize(SerializationFlag flags) const {
-		Data data;
-		serialize(data, flags, type() == Type::Compound && bool(flags & SerializationFlag::JavaNetwork));
-		return data;
-	}
+		const uint8_t* m_payload = nullptr;
+		const uint8_t* m_end = nullptr;
+		std::string_view m_name;
+		Type m_type = Type::End;
+		SerializationFlag m_flags = SerializationFlag::None;
+		bool m_hasName = false;
+		bool m_error = true;
+	};
 
-	inline Tag Tag::deserialize(const void* data, const void* end, SerializationFlag flags) {
-		const uint8_t* byteData = static_cast<const uint8_t*>(data);
-		return deserialize(byteData, end, flags, false, true);
-	}
+	// Default callbacks for Tag::visit. Derive from this and redeclare the events you care about;
+	// dispatch is resolved at compile time, so nothing here is virtual. Every tag type has an
+	// event of its own, so redeclaring one never hides or takes over another.
+	struct Visitor {
+		VisitResult beginCompound(std::string_view) { return VisitResult::Continue; }
+		VisitResult beginList(std::string_view, Tag::Type, size_t) { return VisitResult::Continue; }
+		VisitResult end() { return VisitResult::Continue; }
 
-	inline void Tag::stringify(std::stringstream& stream) const {
-		if (hasName())
-			stream << name() << ": ";
+		VisitResult byteValue(std::string_view, int8_t) { return VisitResult::Continue; }
+		VisitResult shortValue(std::string_view, int16_t) { return VisitResult::Continue; }
+		VisitResult intValue(std::string_view, int32_t) { return VisitResult::Continue; }
+		VisitResult longValue(std::string_view, int64_t) { return VisitResult::Continue; }
+		VisitResult floatValue(std::string_view, float) { return VisitResult::Continue; }
+		VisitResult doubleValue(std::string_view, double) { return VisitResult::Continue; }
+		VisitResult string(std::string_view, std::string_view) { return VisitResult::Continue; }
+		VisitResult byteArray(std::string_view, std::span<const int8_t>) { return VisitResult::Continue; }
+		VisitResult intArray(std::string_view, ArrayView<int32_t>) { return VisitResult::Continue; }
+		VisitResult longArray(std::string_view, ArrayView<int64_t>) { return VisitResult::Continue; }
+	};
 
-		switch (type()) {
-		case Type::End: stream << "%TAG_END%"; break;
-		case Type::Byte: stream << int(byteValue()) << "b"; break;
-		case Type::Short: stream << shortValue() << "s"; break;
-		case Type::Int: stream << intValue(); break;
-		case Type::Long: stream << longValue() << "l"; break;
-		case Type::Float: stream << floatValue() << "f"; break;
-		case Type::Double: stream << doubleValue(); break;
-		case Type::ByteArray:
-			{
-				stream << "[B;";
-				const auto& arr = byteArrayValue();
-				for (size_t i = 0; i < arr.size(); ++i)
-					stream << int(arr[i]) << ((i == arr.size() - 1) ? "b" : "b, ");
-				stream << "]";
-			}
-			break;
+	enum class Compression : uint8_t {
+		None, Gzip, Zlib
+	};
 
-		case Type::String:
-			{
-				stream << "\"";
-				for (auto c : stringValue()) {
-					switch (c) {
-					case '\'': stream << "\'"; break;
-					case '\"': stream << "\\\""; break;
-					case '\?"': stream << "\\?"; break;
-					case '\\': stream << "\\"; break;
-					case '\a': stream << "\\a"; break;
-					case '\b': stream << "\\b"; break;
-					case '\f': stream << "\\f"; break;
-					case '\n': stream << "\\n"; break;
-					case '\r': stream << "\\r"; break;
-					case '\t': stream << "\\t"; break;
-					case '\v': stream << "\\v"; break;
-					default: stream << c; break;
-					}
-				}
-				stream << "\"";
-			}
-			break;
+	// Guesses the compression of a document from its first bytes.
+	Compression detectCompression(const void* data, size_t size) noexcept;
 
-		case Type::List:
-			{
-				stream << "[";
-				const auto& arr = listValue();
-				for (size_t i = 0; i < arr.size(); ++i) {
-					arr[i].stringify(stream);
-					stream << ((i == arr.size() - 1) ? "" : ", ");
-				}
-				stream << "]";
-			}
-			break;
+	// Buffered input that pulls bytes from a source a window at a time, so deserializing
+	// never needs the whole encoding in memory.
+	class StreamInput {
+	public:
+		// Fills up to `size` bytes and returns how many were produced; 0 marks the end of the input.
+		using Source = std::function<size_t(void* dst, size_t size)>;
 
-		case Type::Compound:
-			{
-				stream << "{";
-				const auto& arr = compoundValue();
-				for (size_t i = 0; i < arr.size(); ++i) {
-					arr[i].stringify(stream);
-					stream << ((i == arr.size() - 1) ? "" : ", ");
-				}
-				stream << "}";
-			}
-			break;
+		static constexpr size_t DefaultBufferSize = 64 * 1024;
 
-		case Type::IntArray:
-			{
-				stream << "[I;";
-				const auto& arr = intArrayValue();
-				for (size_t i = 0; i < arr.size(); ++i)
-					stream << arr[i] << ((i == arr.size() - 1) ? "" : ", ");
-				stream << "]";
-			}
-			break;
+		StreamInput(Source source, size_t bufferSize = DefaultBufferSize);
+		StreamInput(const StreamInput&) = delete;
+		StreamInput& operator=(const StreamInput&) = delete;
 
-		case Type::LongArray:
-			{
-				stream << "[L;";
-				const auto& arr = longArrayValue();
-				for (size_t i = 0; i < arr.size(); ++i)
-					stream << arr[i] << ((i == arr.size() - 1) ? "l" : "l, ");
-				stream << "]";
-			}
-			break;
-		}
-	}
+		static StreamInput fromFileDescriptor(int fd, size_t bufferSize = DefaultBufferSize);
+		static StreamInput fromStream(std::istream& stream, size_t bufferSize = DefaultBufferSize);
 
-	inline void Tag::serialize(std::vector<uint8_t>& data, SerializationFlag flags, bool hideName) const {
-		data.push_back(uint8_t(type()));
+		static Source memorySource(const void* data, size_t size);
+		static Source fileDescriptorSource(int fd);
+		static Source streamSource(std::istream& stream);
 
-		if (!hideName) {
-			writeNumericalData(data, uint16_t(m_name.size()), flags);
-			writeData(data, m_name.data(), m_name.size());
-		}
+		bool read(void* dst, size_t size);
+		size_t remaining() const noexcept;
 
-		switch (type()) {
-		case Type::End: data.push_back(0); break;
-		case Type::Byte: data.push_back(std::bit_cast<uint8_t>(byteValue())); break;
-		case Type::Short: writeNumericalData(data, shortValue(), flags); break;
-		case Type::Int: writeNumericalData(data, intValue(), flags); break;
-		case Type::Long: writeNumericalData(data, longValue(), flags); break;
-		case Type::Float: writeNumericalData(data, floatValue(), flags); break;
-		case Type::Double: writeNumericalData(data, doubleValue(), flags); break;
-		case Type::ByteArray: 
-			{
-				const auto& arr = byteArrayValue();
-				writeNumericalData(data, int32_t(arr.size()), flags);
-				writeData(data, arr.data(), arr.size());
-			}
-			break;
+		template<typename T>
+		bool readArray(T* dst, size_t count, SerializationFlag flags);
 
-		case Type::String:
-			{
-				const auto& str = stringValue();
-				writeNumericalData(data, uint16_t(str.size()), flags);
-				writeData(data, str.data(), str.size());
-			}
-			break;
+	private:
+		Source m_source;
+		std::vector<uint8_t> m_buffer;
+		size_t m_position = 0;
+		size_t m_size = 0;
+	};
 
-		case Type::List:
-			{
-				const auto& list = listValue();
-				if (list.empty()) {
-					uint8_t emptyList[]{ 0,0,0,0,0 };
-					writeData(data, emptyList, 5);
-				} else {
-					data.push_back(uint8_t(list.front().type()));
-					writeNumericalData(data, int32_t(list.size()), flags);
-					for (const auto& tag : list)
-						tag.serialize(data, flags, true);
-				}
-			}
-			break;
+	// Buffered output that hands bytes to a sink in chunks of at most `bufferSize` bytes,
+	// so serializing never holds more than one buffer of the encoding in memory.
+	class StreamOutput {
+	public:
+		// Consumes `size` bytes and returns false on failure. It is called once with an empty
+		// range when the output is closed, so sinks that need a trailer can write it then.
+		using Sink = std::function<bool(const void* data, size_t size)>;
 
-		case Type::Compound:
-			{
-				for(const auto& tag : compoundValue())
-					tag.serialize(data, flags, false);
-				data.push_back(0);
-			}
-			break;
+		static constexpr size_t DefaultBufferSize = 64 * 1024;
 
-		case Type::IntArray:
-			{
-				const auto& arr = intArrayValue();
-				writeNumericalData(data, int32_t(arr.size()), flags);
-				for (int32_t i : arr)
-					writeNumericalData(data, i, flags);
-			}
-			break;
+		StreamOutput(Sink sink, size_t bufferSize = DefaultBufferSize);
+		StreamOutput(const StreamOutput&) = delete;
+		StreamOutput& operator=(const StreamOutput&) = delete;
+		~StreamOutput();
 
-		case Type::LongArray:
-			{
-				const auto& arr = longArrayValue();
-				writeNumericalData(data, int32_t(arr.size()), flags);
-				for (int64_t i : arr)
-					writeNumericalData(data, i, flags);
-			}
-			break;
-		}
-	}
+		static StreamOutput fromFileDescriptor(int fd, size_t bufferSize = DefaultBufferSize);
+		static StreamOutput fromStream(std::ostream& stream, size_t bufferSize = DefaultBufferSize);
 
-	inline Tag Tag::deserialize(const uint8_t*& it, const void* end, SerializationFlag flags, bool isNameHidden, bool isRoot) {
-		if (it + 1 > end) {
+		static Sink fileDescriptorSink(int fd);
+		static Sink streamSink(std::ostream& stream);
+
+		void write(const void* src, size_t size);
+		bool flush();
+		bool close();
+		bool isValid() const noexcept;
+
+		template<typename T>
+		void writeArray(const T* src, size_t count, SerializationFlag flags);
+
+	private:
+		Sink m_sink;
+		std::vector<uint8_t> m_buffer;
+		size_t m_size = 0;
+		bool m_isClosed = false;
+		bool m_error = false;
+	};
+
+	// The encoding of the tree last serialized through it, with the byte range of every shared
+	// node, for Tag::serialize(SerializationCache&). The cache holds a copy of that tree, so any
+	// edit since made to the original has cloned the path to the edited tag: a node that is
+	// still the same object is unchanged and its bytes can be copied over as they are. Only
+	// trees made with Tag::share() benefit; others are encoded in full. Use one cache per tree.
+	class SerializationCache {
+	public:
+		void clear();
+
+	private:
+		friend class Tag;
+
+		struct Entry {
+			const void* node;
+			size_t offset;
+			size_t size;
+			// Index one past the entries of the node's subtree.
+			uint32_t end;
+		};
+
+		void writePayload(const Tag& tag, Tag::DataOutput& out);
+		const Entry* find(const void* node) const noexcept;
+		void buildTable();
+		static size_t hashNode(const void* node) noexcept;
+
+		Tag m_tree = Tag::End();
+		SerializationFlag m_flags = SerializationFlag::None;
+		Data m_data;
+		std::vector<Entry> m_entries;
+		// Open-addressed table of entry indices plus one, keyed by node.
+		std::vector<uint32_t> m_table;
+
+		// Scratch for the encoding in progress, swapped in once it is done.
+		Data m_next;
+		std::vector<Entry> m_nextEntries;
+	};
+
+#ifdef NBT_WITH_ZLIB
+	// Wraps a source of gzip, zlib or uncompressed bytes (detected from the header) and
+	// produces the decompressed document as it is read.
+	StreamInput::Source inflateSource(StreamInput::Source source);
+
+	// Wraps a sink so everything written to it is compressed on the way through.
+	StreamOutput::Sink deflateSink(StreamOutput::Sink sink, Compression compression, int level = Z_DEFAULT_COMPRESSION);
+#endif
+
+	// Fixed set of worker threads. `threadCount` includes the thread calling parallelFor, which
+	// works through the range alongside the workers. Every thread starts on an equal slice of
+	// the range and steals half of another thread's remainder once its own runs dry, so uneven
+	// task costs still balance out. Tasks must not throw.
+	class ThreadPool {
+	public:
+		explicit ThreadPool(size_t threadCount = (std::max)(std::thread::hardware_concurrency(), 1u));
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+		~ThreadPool();
+
+		size_t size() const noexcept;
+
+		// Calls task(i) for every i in [0, count) and returns once all calls have finished.
+		void parallelFor(size_t count, const std::function<void(size_t index)>& task);
+
+	private:
+		struct alignas(64) Range {
+			std::mutex mutex;
+			size_t begin = 0;
+			size_t end = 0;
+		};
+
+		void run(size_t self);
+		void work(size_t self, const std::function<void(size_t)>& task);
+		bool steal(size_t self);
+
+		std::vector<std::thread> m_threads;
+		std::unique_ptr<Range[]> m_ranges;
+		std::mutex m_callMutex;
+		std::mutex m_mutex;
+		std::condition_variable m_wake;
+		std::condition_variable m_idle;
+		const std::function<void(size_t)>* m_task = nullptr;
+		size_t m_active = 0;
+		uint64_t m_generation = 0;
+		bool m_isStopping = false;
+	};
+
+	// Anvil region (.mca) file: a 32x32 grid of individually compressed chunks stored in 4 KiB
+	// sectors behind a location and timestamp table. The file is memory-mapped for reading
+	// (read into memory on Windows), and rewritten chunks that outgrow their sectors are moved
+	// to the first free run of sectors.
+	class RegionFile {
+	public:
+		static constexpr int Width = 32;
+		static constexpr size_t ChunkCount = Width * Width;
+		static constexpr size_t SectorSize = 4096;
+#ifdef NBT_WITH_ZLIB
+		static constexpr Compression DefaultCompression = Compression::Zlib;
+#else
+		static constexpr Compression DefaultCompression = Compression::None;
+#endif
+
+		RegionFile() = default;
+		RegionFile(const RegionFile&) = delete;
+		RegionFile& operator=(const RegionFile&) = delete;
+		~RegionFile();
+
+		bool open(const std::string& path, bool isWritable = false);
+		void close();
+		bool isOpen() const noexcept;
+
+		// Chunk coordinates are taken modulo the region width, so world chunk coordinates work too.
+		bool hasChunk(int x, int z) const noexcept;
+		uint32_t timestamp(int x, int z) const noexcept;
+		Compression chunkCompression(int x, int z) const noexcept;
+		std::span<const uint8_t> chunkData(int x, int z) const noexcept;
+
+		Tag readChunk(int x, int z, std::pmr::memory_resource* resource = std::pmr::get_default_resource()) const;
+
+		// Decodes every chunk across the pool. Element x + z * Width holds chunk (x, z); absent
+		// or undecodable chunks come back as invalid tags.
+		std::vector<Tag> readChunks(ThreadPool& pool) const;
+
+		bool writeChunk(int x, int z, const Tag& tag, Compression compression = DefaultCompression);
+
+	private:
+		static size_t chunkIndex(int x, int z) noexcept;
+		uint32_t location(size_t index) const noexcept;
+		bool chunkPayload(size_t index, std::span<const uint8_t>& payload, uint8_t& type) const noexcept;
+		Tag readChunk(size_t index, std::pmr::memory_resource* resource) const;
+		bool writeAt(uint64_t offset, const void* data, size_t size);
+		bool map();
+		void unmap();
+
+		int m_fd = -1;
+		bool m_isWritable = false;
+		const uint8_t* m_data = nullptr;
+		size_t m_size = 0;
+#if defined(_WIN32)
+		std::vector<uint8_t> m_contents;
+#endif
+	};
+
+	// Emits a document piece by piece without building a Tag tree. Names passed for list
+	// elements are ignored, and a list has to be given its element type and count up front
+	// because both precede the elements on the wire.
+	class TagWriter {
+	public:
+		using Type = Tag::Type;
+
+		TagWriter(StreamOutput& out, SerializationFlag flags = SerializationFlag::None) : m_out(out), m_flags(flags) {}
+
+		void beginCompound(std::string_view name);
+		void endCompound();
+		void beginList(std::string_view name, Type elementType, size_t count);
+		void endList();
+
+		void writeByte(std::string_view name, int8_t value);
+		void writeShort(std::string_view name, int16_t value);
+		void writeInt(std::string_view name, int32_t value);
+		void writeLong(std::string_view name, int64_t value);
+		void writeFloat(std::string_view name, float value);
+		void writeDouble(std::string_view name, double value);
+		void writeByteArray(std::string_view name, std::span<const int8_t> value);
+		void writeString(std::string_view name, std::string_view value);
+		void writeIntArray(std::string_view name, std::span<const int32_t> value);
+		void writeLongArray(std::string_view name, std::span<const int64_t> value);
+		void writeTag(const Tag& tag);
+
+		bool isValid() const noexcept;
+
+	private:
+		struct Frame {
+			Type elementType;
+			size_t remaining;
+			bool isList;
+		};
+
+		bool writeHeader(Type type, std::string_view name);
+
+		template<typename T>
+		void writeScalar(Type type, std::string_view name, T value);
+
+		StreamOutput& m_out;
+		SerializationFlag m_flags;
+		std::vector<Frame> m_frames;
+		bool m_isRootWritten = false;
+		bool m_error = false;
+	};
+
+	// Parses a document from bytes handed over as they arrive, for instance straight off a
+	// socket. All state lives in the parser, with an explicit stack of open lists and
+	// compounds, so each byte is looked at once however the input is split up.
+	class TagParser {
+	public:
+		using Type = Tag::Type;
+
+		TagParser(SerializationFlag flags = SerializationFlag::None, std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+		TagParser(SerializationFlag flags, const DeserializeLimits& limits, std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+
+		// Parses what it can of `data` and returns how many bytes it used. Parsing stops at the
+		// end of the document, leaving any bytes after it to the caller.
+		size_t feed(std::span<const uint8_t> data);
+
+		bool isComplete() const noexcept;
+		bool isValid() const noexcept;
+
+		// Hands out the parsed document and readies the parser for the next one. The tag is
+		// invalid unless the document was complete.
+		Tag take();
+		void reset();
+
+	private:
+		enum class Step : uint8_t {
+			Type, NameSize, Name, Payload, ListType, ListSize, Elements, Done, Error
+		};
+
+		struct Frame {
+			Tag tag;
+			std::pmr::vector<Tag> children;
+			Type type;
+			Type elementType;
+			size_t remaining;
+		};
+
+		bool advance(const uint8_t*& it, const uint8_t* end);
+		bool readPayload(const uint8_t*& it, const uint8_t* end);
+		bool readElements(const uint8_t*& it, const uint8_t* end);
+
+		template<typename T>
+		bool readNumber(const uint8_t*& it, const uint8_t* end, T& value);
+		template<typename T>
+		bool isWhole(const uint8_t* it, const uint8_t* end) const noexcept;
+		template<typename T>
+		bool readArray(const uint8_t*& it, const uint8_t* end);
+
+		void beginPayload(Type type);
+		void complete();
+		void closeFrame();
+		bool fail();
+
+		SerializationFlag m_flags;
+		DeserializeLimits m_limits;
+		Tag::Budget m_budget;
+		std::pmr::memory_resource* m_resource;
+		Step m_step = Step::Type;
+		Type m_type = Type::End;
+		Type m_elementType = Type::End;
+		size_t m_remaining = 0;
+		std::string m_name;
+		uint8_t m_pending[Tag::MaxVarIntSize<int64_t>];
+		size_t m_pendingSize = 0;
+		Tag m_tag;
+		std::vector<Frame> m_frames;
+	};
+
+	class TagView::Iterator {
+	public:
+		using iterator_category = std::forward_iterator_tag;
+		using value_type = TagView;
+		using difference_type = std::ptrdiff_t;
+		using pointer = const TagView*;
+		using reference = const TagView&;
+
+		Iterator() = default;
+
+		reference operator*() const noexcept;
+		pointer operator->() const noexcept;
+		Iterator& operator++() noexcept;
+		Iterator operator++(int) noexcept;
+		bool operator==(const Iterator& other) const noexcept;
+
+	private:
+		friend class TagView;
+
+		void advance(const uint8_t* it) noexcept;
+
+		TagView m_current;
+		// End of m_current's payload, found once when it is read and validated.
+		const uint8_t* m_next = nullptr;
+		Type m_listType = Type::End;
+		int32_t m_remaining = 0;
+		bool m_isList = false;
+		bool m_isEnd = true;
+	};
+
+	class TagView::Children {
+	public:
+		Iterator begin() const noexcept { return m_begin; }
+		Iterator end() const noexcept { return Iterator(); }
+
+	private:
+		friend class TagView;
+		Iterator m_begin;
+	};
+
+	// Compiled path into a document, such as `Level.Sections[*].BlockStates`. Steps are separated
+	// by dots and start inside the root compound: a name selects that compound member, `*` every
+	// member, and `[n]` or `[*]` one or every list element. Names containing `.`, `[`, `*` or `"`
+	// can be written in double quotes with backslash escapes.
+	//
+	// Matching walks the encoding directly and skips everything off the path by its length
+	// prefixes, so only the matches themselves are ever materialized.
+	class Query {
+	public:
+		// Throws std::invalid_argument when the path is malformed.
+		explicit Query(std::string_view path);
+
+		// Calls callback(const TagView&) for every match in document order without allocating.
+		// Returns false if the document turned out to be malformed along the way.
+		template<typename Callback>
+		bool forEach(const void* data, const void* end, Callback&& callback, SerializationFlag flags = SerializationFlag::None) const;
+
+		std::vector<TagView> select(const void* data, const void* end, SerializationFlag flags = SerializationFlag::None) const;
+		std::vector<Tag> extract(const void* data, const void* end, SerializationFlag flags = SerializationFlag::None, std::pmr::memory_resource* resource = std::pmr::get_default_resource()) const;
+
+	private:
+		enum class StepKind : uint8_t {
+			Member, AnyMember, Element, AnyElement
+		};
+
+		struct Step {
+			StepKind kind = StepKind::Member;
+			std::string name = {};
+			size_t index = 0;
+		};
+
+		template<typename Callback>
+		bool match(const TagView& view, size_t step, Callback& callback) const;
+
+		std::vector<Step> m_steps;
+	};
+
+	// Structural index ("tape") over an encoded document, built in one pass. Every tag gets an
+	// entry with its type, where its header, payload and subtree end lie in the buffer, and where
+	// its subtree ends on the tape. Afterwards positional child access and sibling skips are O(1)
+	// and member lookup is a binary search, with nothing decoded again. The buffer has to outlive
+	// the index.
+	class TagIndex {
+	public:
+		// Position of a tag on the tape. The root is at 0 and a subtree's tags follow its root.
+		using Node = uint32_t;
+		static constexpr Node npos = UINT32_MAX;
+
+		TagIndex() = default;
+		TagIndex(const void* data, const void* end, SerializationFlag flags = SerializationFlag::None);
+
+		// False when the document is malformed or larger than 4 GiB; the index is then empty.
+		bool isValid() const noexcept;
+		size_t size() const noexcept;
+
+		Node root() const noexcept;
+		Tag::Type type(Node node) const;
+		std::string_view name(Node node) const;
+		bool hasName(Node node) const;
+
+		Node parent(Node node) const;
+		Node nextSibling(Node node) const;
+		// First tape position after the subtree of `node`.
+		Node skip(Node node) const;
+
+		// Members of a compound or elements of a list, in document order.
+		size_t childCount(Node node) const;
+		Node child(Node node, size_t position) const;
+		Node find(Node compound, std::string_view name) const;
+
+		TagView view(Node node) const;
+		Tag toTag(Node node, std::pmr::memory_resource* resource = std::pmr::get_default_resource()) const;
+
+		// The subtree exactly as encoded: type, name and payload, or only the payload for list
+		// elements. Forwarding these bytes needs no deserialize/serialize round trip.
+		std::span<const uint8_t> bytes(Node node) const;
+		std::span<const uint8_t> payload(Node node) const;
+
+	private:
+		struct Entry {
+			uint32_t header;
+			uint32_t payload;
+			uint32_t end;
+			Node next;
+			Node parent;
+			uint32_t children;
+			uint32_t childCount;
+			Tag::Type type;
+		};
+
+		void indexPayload(Tag::Type type, Node parent, const uint8_t* header, const uint8_t*& it, bool& error, size_t depth = 0);
+		uint32_t offset(const uint8_t* it) const noexcept;
+
+		const uint8_t* m_data = nullptr;
+		size_t m_size = 0;
+		SerializationFlag m_flags = SerializationFlag::None;
+		std::vector<Entry> m_entries;
+		// Child nodes of every container in document order; compounds are followed by the same
+		// nodes again sorted by name.
+		std::vector<Node> m_children;
+	};
+
+	// Binds a struct to a compound so it can be decoded from and encoded to NBT directly, with
+	// no Tag in between. Specialize Schema for the struct with a constexpr tuple of fields:
+	//
+	//     template<> struct nbt::Schema<Item> {
+	//         static constexpr auto fields = std::tuple(nbt::field("id", &Item::id), nbt::field("Count", &Item::count));
+	//     };
+	//
+	// Members map to tags by type: bool and int8_t to Byte, int16_t, int32_t and int64_t to
+	// Short, Int and Long, float and double, strings to String, vectors and std::arrays of
+	// int8_t, int32_t and int64_t to the array tags, other vectors and std::arrays to List, and
+	// structs with a Schema to Compound. std::optional members may be missing; every other
+	// field is required. Members not named in the schema are skipped.
+	template<typename T>
+	struct Schema;
+
+	template<typename T, typename M>
+	struct Field {
+		std::string_view name;
+		M T::* member;
+	};
+
+	template<typename T, typename M>
+	constexpr Field<T, M> field(std::string_view name, M T::* member) noexcept {
+		return { name, member };
+	}
+
+	// Reads the compound at `data` into `value`. Returns false if the document is malformed, a
+	// field has the wrong type or a required field is missing; `value` is then partly written.
+	template<typename T>
+	bool decode(const void* data, const void* end, T& value, SerializationFlag flags = SerializationFlag::None);
+
+	// Writes `value` as an unnamed root compound.
+	template<typename T>
+	Data encode(const T& value, SerializationFlag flags = SerializationFlag::None);
+
+	// Appends the encoding of `value` to `data`.
+	template<typename T>
+	void encode(Data& data, const T& value, SerializationFlag flags = SerializationFlag::None);
+
+	class SchemaCodec {
+	private:
+		template<typename T>
+		friend bool decode(const void* data, const void* end, T& value, SerializationFlag flags);
+		template<typename T>
+		friend void encode(Data& data, const T& value, SerializationFlag flags);
+
+		template<typename T>
+		struct Traits;
+
+		template<typename T>
+		static constexpr Tag::Type tagType() noexcept;
+
+		template<typename T>
+		static bool decodeDocument(const void* data, const void* end, T& value, SerializationFlag flags);
+		template<typename T>
+		static void encodeDocument(Data& data, const T& value, SerializationFlag flags);
+
+		template<typename T>
+		static bool readPayload(const uint8_t*& it, const void* end, T& value, SerializationFlag flags);
+		template<typename T>
+		static bool readCompound(const uint8_t*& it, const void* end, T& value, SerializationFlag flags);
+		template<typename T, size_t I>
+		static bool readField(Tag::Type type, const uint8_t*& it, const void* end, T& value, SerializationFlag flags);
+
+		template<typename T>
+		static void writePayload(Tag::DataOutput& out, const T& value, SerializationFlag flags);
+		template<typename T>
+		static void writeCompound(Tag::DataOutput& out, const T& value, SerializationFlag flags);
+		template<typename M>
+		static void writeField(Tag::DataOutput& out, std::string_view name, const M& member, SerializationFlag flags);
+	};
+
+	// How indices are packed into the longs of a LongArray, lowest bits first, as chunk
+	// sections store block states and biomes and heightmaps their heights. Since 1.16 an index
+	// never straddles two longs and the top bits of each long may go unused (Padded); before
+	// that indices ran on from one long into the next (Spanning).
+	enum class PackedLayout : uint8_t {
+		Padded, Spanning
+	};
+
+	// Number of longs holding `count` indices of `bits` bits, or 0 if `bits` is not 1 to 16.
+	size_t packedLength(size_t count, unsigned bits, PackedLayout layout) noexcept;
+
+	// Unpacks the first dst.size() indices of `bits` bits (1 to 16), such as the 4096 block
+	// states of a section. Returns false if `bits` is out of range or `src` is too short. The
+	// ArrayView version reads straight from the serialized bytes, swapping their byte order
+	// on the way.
+	bool unpackBits(std::span<const int64_t> src, unsigned bits, PackedLayout layout, std::span<uint16_t> dst) noexcept;
+	bool unpackBits(ArrayView<int64_t> src, unsigned bits, PackedLayout layout, std::span<uint16_t> dst) noexcept;
+
+	// Packs `src` into the first packedLength(src.size(), bits, layout) longs of `dst`, with
+	// unused bits cleared. Returns false if `bits` is out of range, `dst` is too short or an
+	// index does not fit in `bits`. The vector version sizes `dst` to fit, so it can pack into
+	// Tag::editLongArray directly.
+	bool packBits(std::span<const uint16_t> src, unsigned bits, PackedLayout layout, std::span<int64_t> dst) noexcept;
+	bool packBits(std::span<const uint16_t> src, unsigned bits, PackedLayout layout, std::pmr::vector<int64_t>& dst);
+
+	class BitPacking {
+	private:
+		friend bool unpackBits(std::span<const int64_t> src, unsigned bits, PackedLayout layout, std::span<uint16_t> dst) noexcept;
+		friend bool unpackBits(ArrayView<int64_t> src, unsigned bits, PackedLayout layout, std::span<uint16_t> dst) noexcept;
+		friend bool packBits(std::span<const uint16_t> src, unsigned bits, PackedLayout layout, std::span<int64_t> dst) noexcept;
+
+		// Longest period, reached by 3 bit Padded indices at 21 per long.
+		static constexpr size_t MaxPeriod = 168;
+		// Bytes of longs converted to little-endian order at a time, a run that stays in L1.
+		static constexpr size_t BlockSize = 1024;
+
+		// Where each index of a period lies: the shortest run of indices, covering whole longs,
+		// after which the byte offsets and shifts repeat. An index is read as the 32 bit
+		// little-endian word at its byte offset, shifted down and masked.
+		struct Pattern {
+			alignas(32) uint32_t offsets[MaxPeriod];
+			alignas(32) uint32_t shifts[MaxPeriod];
+			size_t entries;
+			size_t bytes;
+			uint32_t mask;
+
+			Pattern(unsigned bits, PackedLayout layout) noexcept;
+		};
+
+		static bool unpack(const uint8_t* src, size_t length, bool isBigEndian, unsigned bits, PackedLayout layout, std::span<uint16_t> dst) noexcept;
+		static bool unpack(ArrayView<int64_t> src, unsigned bits, PackedLayout layout, std::span<uint16_t> dst) noexcept;
+		static bool pack(std::span<const uint16_t> src, unsigned bits, PackedLayout layout, std::span<int64_t> dst) noexcept;
+		static void unpackPeriod(const uint8_t* src, const Pattern& pattern, uint16_t* dst, size_t count) noexcept;
+	};
+
+#ifdef NBT_WITH_STATS
+	// Counters kept by Tag::deserialize, Tag::serialize and Tag::stringify in builds that define
+	// NBT_WITH_STATS; without it this class does not exist and nothing is recorded. Each thread
+	// counts into slots of its own with plain stores, so recording takes no locks and no atomic
+	// read-modify-writes, and snapshot() adds up the slots of every thread, including threads
+	// that have since exited.
+	class Stats {
+	public:
+		enum class Operation : uint8_t {
+			Deserialize, Serialize, Stringify
+		};
+
+		static constexpr size_t TypeCount = size_t(Tag::Type::LongArray) + 1;
+		static constexpr size_t OperationCount = size_t(Operation::Stringify) + 1;
+
+		struct TypeCounters {
+			uint64_t count = 0;
+			uint64_t bytes = 0;
+		};
+
+		struct OperationCounters {
+			uint64_t calls = 0;
+			uint64_t bytes = 0;
+			std::chrono::nanoseconds time{};
+		};
+
+		struct Snapshot {
+			// Decoded tags by Tag::Type. The bytes of a tag are its header and payload without
+			// the tags nested in it, so over all types they add up to the input decoded; End
+			// counts the markers closing compounds.
+			std::array<TypeCounters, TypeCount> types{};
+			// Buffers held by the decoded tags (strings too long for the small-string buffer,
+			// arrays, lists, compounds and their name indices) and their capacity in bytes.
+			uint64_t allocations = 0;
+			uint64_t allocatedBytes = 0;
+			// Deepest nesting of lists and compounds decoded.
+			size_t maxDepth = 0;
+			// Calls, bytes read or produced and time spent, by Operation.
+			std::array<OperationCounters, OperationCount> operations{};
+
+			const TypeCounters& operator[](Tag::Type type) const { return types[size_t(type)]; }
+			const OperationCounters& operator[](Operation operation) const { return operations[size_t(operation)]; }
+		};
+
+		// A finished call, handed to the trace callback on the thread that made it.
+		struct Span {
+			Operation operation;
+			size_t bytes;
+			bool isValid;
+			std::chrono::steady_clock::time_point start;
+			std::chrono::nanoseconds duration;
+		};
+
+		using TraceCallback = void (*)(const Span& span);
+
+		// Counters since the process started or reset() was last called.
+		static Snapshot snapshot();
+		static void reset();
+
+		// Calls `callback` after every operation, or stops tracing if it is null.
+		static void setTraceCallback(TraceCallback callback) noexcept;
+
+	private:
+		friend class Tag;
+
+		// Written only by the thread owning it; the relaxed load and store compile to plain
+		// moves, and make the value safe to read from snapshot().
+		struct Counter {
+			std::atomic<uint64_t> value = 0;
+
+			void add(uint64_t count) noexcept { value.store(value.load(std::memory_order_relaxed) + count, std::memory_order_relaxed); }
+			uint64_t get() const noexcept { return value.load(std::memory_order_relaxed); }
+		};
+
+		struct Counters {
+			Counter typeCounts[TypeCount];
+			Counter typeBytes[TypeCount];
+			Counter allocations;
+			Counter allocatedBytes;
+			Counter calls[OperationCount];
+			Counter bytes[OperationCount];
+			Counter nanoseconds[OperationCount];
+
+			// Seen only by the owning thread: nesting of the decode in progress, the deepest
+			// nesting since the last operation finished and the running total of bytes decoded.
+			size_t depth = 0;
+			size_t peak = 0;
+			uint64_t decoded = 0;
+		};
+
+		struct Registry {
+			std::mutex mutex;
+			std::vector<Counters*> threads;
+			Snapshot retired;
+			Snapshot baseline;
+			std::atomic<size_t> maxDepth = 0;
+			std::atomic<TraceCallback> trace = nullptr;
+		};
+
+		// Times a public call and records it when finished.
+		class Scope {
+		public:
+			explicit Scope(Operation operation);
+			Scope(const Scope&) = delete;
+			Scope& operator=(const Scope&) = delete;
+
+			// Deserialize counts the bytes decoded since the scope began.
+			void finish(bool isValid);
+			void finish(size_t bytes, bool isValid);
+
+		private:
+			Counters& m_counters;
+			Operation m_operation;
+			uint64_t m_decoded;
+			std::chrono::steady_clock::time_point m_start;
+		};
+
+		static Registry& registry();
+		static Counters& local();
+		static void add(Snapshot& total, const Counters& counters);
+
+		static void addHeader(Tag::Type type, size_t nameSize, bool isNameHidden, SerializationFlag flags);
+		static void addPayload(const Tag& tag, Tag::Type type, SerializationFlag flags);
+		static void addAllocation(size_t bytes);
+		static void enter();
+		static void leave();
+	};
+#endif
+
+	inline Tag::Type nbt::Tag::type() const noexcept {
+		return Type(target().m_value.index());
+	}
+
+	inline bool Tag::isValid() const noexcept {
+		return !(m_name & ErrorBit);
+	}
+
+	inline int8_t Tag::byteValue() const {
+		return std::get<size_t(Type::Byte)>(target().m_value);
+	}
+
+	inline int16_t Tag::shortValue() const {
+		return std::get<size_t(Type::Short)>(target().m_value);
+	}
+
+	inline int32_t Tag::intValue() const {
+		return std::get<size_t(Type::Int)>(target().m_value);
+	}
+
+	inline int64_t Tag::longValue() const {
+		return std::get<size_t(Type::Long)>(target().m_value);
+	}
+
+	inline float Tag::floatValue() const {
+		return std::get<size_t(Type::Float)>(target().m_value);
+	}
+
+	inline double Tag::doubleValue() const {
+		return std::get<size_t(Type::Double)>(target().m_value);
+	}
+
+	inline const std::pmr::vector<int8_t>& Tag::byteArrayValue() const {
+		return std::get<size_t(Type::ByteArray)>(target().m_value);
+	}
+
+	inline const std::pmr::string& Tag::stringValue() const {
+		return std::get<size_t(Type::String)>(target().m_value);
+	}
+
+	inline const std::pmr::vector<Tag>& Tag::listValue() const {
+		return std::get<size_t(Type::List)>(target().m_value);
+	}
+
+	inline const std::pmr::vector<Tag>& Tag::compoundValue() const {
+		return std::get<size_t(Type::Compound)>(target().m_value).children;
+	}
+
+	inline const std::pmr::vector<int32_t>& Tag::intArrayValue() const {
+		return std::get<size_t(Type::IntArray)>(target().m_value);
+	}
+
+	inline const std::pmr::vector<int64_t>& Tag::longArrayValue() const {
+		return std::get<size_t(Type::LongArray)>(target().m_value);
+	}
+
+	inline void Tag::addChild(Tag tag) {
+		if (isShared()) {
+			tag.share();
+			detach().addChild(std::move(tag));
+			return;
+		}
+
+		if (type() != Type::Compound) {
+			std::get<size_t(Type::List)>(m_value).emplace_back(std::move(tag));
+			return;
+		}
+
+		auto& compound = std::get<size_t(Type::Compound)>(m_value);
+		compound.children.emplace_back(std::move(tag));
+		if (compound.index == nullptr || compound.index[0] < compound.children.size() * 2)
+			buildIndex();
+		else
+			indexChild(uint32_t(compound.children.size() - 1));
+	}
+
+	inline const Tag* Tag::find(std::string_view name) const {
+		const auto& compound = std::get<size_t(Type::Compound)>(target().m_value);
+
+		if (compound.index == nullptr) {
+			for (const auto& child : compound.children) {
+				if (child.name() == name)
+					return &child;
+			}
+			return nullptr;
+		}
+
+		const uint32_t* slots = compound.index + 1;
+		size_t mask = compound.index[0] - 1;
+		for (size_t slot = NameTable::hashName(name) & mask; slots[slot] != 0; slot = (slot + 1) & mask) {
+			const Tag& child = compound.children[slots[slot] - 1];
+			if (child.name() == name)
+				return &child;
+		}
+		return nullptr;
+	}
+
+	inline const Tag& Tag::operator[](std::string_view name) const {
+		const Tag* child = find(name);
+		if (child == nullptr)
+			throw std::out_of_range("nbt::Tag has no member named \"" + std::string(name) + "\"");
+		return *child;
+	}
+
+	inline void Tag::share() {
+		if (isShared())
+			return;
+
+		switch (type()) {
+		case Type::List:
+			for (Tag& child : std::get<size_t(Type::List)>(m_value))
+				child.share();
+			break;
+		case Type::Compound:
+			for (Tag& child : std::get<size_t(Type::Compound)>(m_value).children)
+				child.share();
+			break;
+		case Type::ByteArray:
+		case Type::IntArray:
+		case Type::LongArray:
+			break;
+		default:
+			// Scalars and strings are cheap to copy.
+			return;
+		}
+
+		SharedNode* node = new SharedNode();
+		node->tag.m_value = std::move(m_value);
+		m_value.emplace<SharedIndex>(node);
+	}
+
+	inline bool Tag::isShared() const noexcept {
+		return m_value.index() == SharedIndex;
+	}
+
+	inline Tag* Tag::editChild(std::string_view name) {
+		// find() on the detached tag returns a member this tag now owns alone.
+		Tag* child = const_cast<Tag*>(detach().find(name));
+		if (child != nullptr)
+			child->m_name |= MemberBit;
+		return child;
+	}
+
+	inline Tag& Tag::editChild(size_t position) {
+		Tag& target = detach();
+		if (target.type() != Type::Compound)
+			return std::get<size_t(Type::List)>(target.m_value).at(position);
+
+		Tag& child = std::get<size_t(Type::Compound)>(target.m_value).children.at(position);
+		child.m_name |= MemberBit;
+		return child;
+	}
+
+	inline bool Tag::removeChild(std::string_view name) {
+		Tag& target = detach();
+		const Tag* child = target.find(name);
+		if (child == nullptr)
+			return false;
+
+		target.removeChild(size_t(child - target.compoundValue().data()));
+		return true;
+	}
+
+	inline void Tag::removeChild(size_t position) {
+		Tag& target = detach();
+		if (target.type() != Type::Compound) {
+			auto& list = std::get<size_t(Type::List)>(target.m_value);
+			list.erase(list.begin() + std::ptrdiff_t(position));
+			return;
+		}
+
+		// The members after it move down by assignment, which must not keep their old names.
+		auto& children = std::get<size_t(Type::Compound)>(target.m_value).children;
+		for (size_t i = position; i < children.size(); ++i)
+			children[i].m_name &= ~MemberBit;
+		children.erase(children.begin() + std::ptrdiff_t(position));
+		target.buildIndex();
+	}
+
+	inline std::pmr::string& Tag::editString() {
+		return std::get<size_t(Type::String)>(detach().m_value);
+	}
+
+	inline std::pmr::vector<int8_t>& Tag::editByteArray() {
+		return std::get<size_t(Type::ByteArray)>(detach().m_value);
+	}
+
+	inline std::pmr::vector<int32_t>& Tag::editIntArray() {
+		return std::get<size_t(Type::IntArray)>(detach().m_value);
+	}
+
+	inline std::pmr::vector<int64_t>& Tag::editLongArray() {
+		return std::get<size_t(Type::LongArray)>(detach().m_value);
+	}
+
+	inline void Tag::setValue(Tag value) {
+		bool shared = isShared();
+		m_value = std::move(value.m_value);
+		if (shared)
+			share();
+	}
+
+	inline const Tag& Tag::target() const noexcept {
+		const SharedValue* shared = std::get_if<SharedIndex>(&m_value);
+		return shared == nullptr ? *this : shared->node->tag;
+	}
+
+	inline Tag& Tag::detach() {
+		SharedValue* shared = std::get_if<SharedIndex>(&m_value);
+		if (shared == nullptr)
+			return *this;
+
+		// A count of one means no snapshot can reach the node any more, so it is ours to edit.
+		if (shared->node->references.load(std::memory_order_acquire) != 1) {
+			SharedNode* node = new SharedNode();
+			node->tag.m_value = shared->node->tag.m_value;
+			*shared = SharedValue(node);
+		}
+		return shared->node->tag;
+	}
+
+	inline Tag::SharedValue::SharedValue(const SharedValue& other) noexcept : node(other.node) {
+		node->references.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	inline Tag::SharedValue& Tag::SharedValue::operator=(const SharedValue& other) noexcept {
+		SharedValue copy(other);
+		return *this = std::move(copy);
+	}
+
+	inline Tag::SharedValue& Tag::SharedValue::operator=(SharedValue&& other) noexcept {
+		if (this != &other) {
+			SharedValue released(std::move(*this));
+			node = std::exchange(other.node, nullptr);
+		}
+		return *this;
+	}
+
+	inline Tag::SharedValue::~SharedValue() {
+		if (node != nullptr && node->references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			delete node;
+	}
+
+	inline void Tag::buildIndex() {
+		auto& compound = std::get<size_t(Type::Compound)>(m_value);
+		compound.freeIndex();
+		if (compound.children.size() < IndexThreshold)
+			return;
+
+		compound.allocateIndex(std::bit_ceil(compound.children.size() * 4));
+		for (uint32_t i = 0; i < compound.children.size(); ++i)
+			indexChild(i);
+	}
+
+	inline void Tag::indexChild(uint32_t position) {
+		auto& compound = std::get<size_t(Type::Compound)>(m_value);
+		const NameTable::Entry* name = compound.children[position].nameEntry();
+
+		// Names are interned, so equal names share an entry and the table has their hashes.
+		uint32_t* slots = compound.index + 1;
+		size_t mask = compound.index[0] - 1;
+		size_t slot = NameTable::hash(name) & mask;
+		for (; slots[slot] != 0; slot = (slot + 1) & mask) {
+			if (compound.children[slots[slot] - 1].nameEntry() == name)
+				return;
+		}
+		slots[slot] = position + 1;
+	}
+
+	inline const std::pmr::string& Tag::name() const noexcept {
+		return NameTable::get(nameEntry());
+	}
+
+	inline bool Tag::hasName() const noexcept {
+		return nameEntry() != nullptr;
+	}
+
+	inline void Tag::setName(const std::string* name) {
+		if (name != nullptr) {
+			setName(std::string_view(*name));
+			return;
+		}
+		if (m_name & MemberBit)
+			throw std::logic_error("nbt::Tag: members reached through editChild cannot be renamed");
+		setNameEntry(nullptr);
+	}
+
+	inline void Tag::setName(std::string_view name) {
+		// The member's compound indexes it by name and cannot be reached from here to update.
+		if ((m_name & MemberBit) && name != nameView())
+			throw std::logic_error("nbt::Tag: members reached through editChild cannot be renamed");
+		setNameEntry(NameTable::acquire(name));
+	}
+
+	inline NameTable::Entry* Tag::nameEntry() const noexcept {
+		return reinterpret_cast<NameTable::Entry*>(m_name & ~(ErrorBit | MemberBit));
+	}
+
+	inline std::string_view Tag::nameView() const noexcept {
+		// name() without the guarded static empty string, for the serialization paths.
+		const NameTable::Entry* entry = nameEntry();
+		return entry == nullptr ? std::string_view() : std::string_view(entry->value);
+	}
+
+	inline void Tag::setNameEntry(NameTable::Entry* entry) noexcept {
+		// Takes over the reference held by `entry`.
+		NameTable::release(nameEntry());
+		m_name = reinterpret_cast<uintptr_t>(entry) | (m_name & (ErrorBit | MemberBit));
+	}
+
+	inline void Tag::setError() noexcept {
+		m_name |= ErrorBit;
+	}
+
+	inline Tag::Tag(const Tag& other) : m_value(other.m_value), m_name(other.m_name & ~MemberBit) {
+		NameTable::retain(nameEntry());
+	}
+
+	// A member moved out of keeps its name too, so its compound can still find it.
+	inline Tag::Tag(Tag&& other) noexcept : m_value(std::move(other.m_value)), m_name(other.m_name & ~MemberBit) {
+		if (other.m_name & MemberBit)
+			NameTable::retain(nameEntry());
+		else
+			other.m_name = 0;
+	}
+
+	// `other` may live inside this tree, as in `root = root.compoundValue()[0]`, so it is copied
+	// out before the old value goes; if the copy throws, this tag is left as it was.
+	inline Tag& Tag::operator=(const Tag& other) {
+		Tag copy(other);
+		return *this = std::move(copy);
+	}
+
+	// Likewise `other` is taken over before the old value is destroyed. The value then moves in
+	// by construction, which cannot throw, where assigning a pmr container copies it whenever
+	// the two resources differ.
+	inline Tag& Tag::operator=(Tag&& other) noexcept {
+		Tag taken(std::move(other));
+		uintptr_t member = m_name & MemberBit;
+		if (member) {
+			NameTable::retain(nameEntry());
+			taken.setNameEntry(nameEntry());
+		}
+		std::destroy_at(this);
+		std::construct_at(this, std::move(taken));
+		m_name |= member;
+		return *this;
+	}
+
+	inline Tag::~Tag() {
+		NameTable::release(nameEntry());
+	}
+
+	inline Tag::CompoundValue::CompoundValue(const CompoundValue& other) : children(other.children) {
+		copyIndex(other.index);
+	}
+
+	inline Tag::CompoundValue::CompoundValue(CompoundValue&& other) noexcept : children(std::move(other.children)), index(std::exchange(other.index, nullptr)) {}
+
+	inline Tag::CompoundValue& Tag::CompoundValue::operator=(const CompoundValue& other) {
+		if (this != &other) {
+			unpinMembers();
+			children = other.children;
+			freeIndex();
+			copyIndex(other.index);
+		}
+		return *this;
+	}
+
+	inline Tag::CompoundValue& Tag::CompoundValue::operator=(CompoundValue&& other) {
+		if (this == &other)
+			return *this;
+
+		// Move assignment keeps this side's resource, so the members were only really moved if
+		// both sides share it; otherwise the index is copied like the members were.
+		unpinMembers();
+		children = std::move(other.children);
+		freeIndex();
+		if (children.get_allocator() == other.children.get_allocator())
+			index = std::exchange(other.index, nullptr);
+		else
+			copyIndex(other.index);
+		return *this;
+	}
+
+	inline Tag::CompoundValue::~CompoundValue() {
+		freeIndex();
+	}
+
+	inline void Tag::CompoundValue::unpinMembers() noexcept {
+		// Assigning over members handed out by editChild would otherwise keep their names.
+		for (Tag& child : children)
+			child.m_name &= ~MemberBit;
+	}
+
+	inline void Tag::CompoundValue::allocateIndex(size_t slots) {
+		index = static_cast<uint32_t*>(children.get_allocator().resource()->allocate((slots + 1) * sizeof(uint32_t), alignof(uint32_t)));
+		index[0] = uint32_t(slots);
+		std::fill_n(index + 1, slots, 0);
+	}
+
+	inline void Tag::CompoundValue::copyIndex(const uint32_t* other) {
+		if (other == nullptr)
+			return;
+		allocateIndex(other[0]);
+		std::copy_n(other + 1, other[0], index + 1);
+	}
+
+	inline void Tag::CompoundValue::freeIndex() noexcept {
+		if (index != nullptr)
+			children.get_allocator().resource()->deallocate(index, (index[0] + 1) * sizeof(uint32_t), alignof(uint32_t));
+		index = nullptr;
+	}
+
+	inline size_t NameTable::size() {
+		NameTable& table = instance();
+		std::lock_guard lock(table.m_mutex);
+		return table.m_size;
+	}
+
+	inline size_t NameTable::bytes() {
+		NameTable& table = instance();
+		std::lock_guard lock(table.m_mutex);
+		size_t inlineCapacity = std::pmr::string().capacity();
+		size_t bytes = table.m_buckets.capacity() * sizeof(Entry*);
+		for (const Entry* head : table.m_buckets) {
+			for (const Entry* entry = head; entry != nullptr; entry = entry->next)
+				bytes += sizeof(Entry) + (entry->value.capacity() > inlineCapacity ? entry->value.capacity() + 1 : 0);
+		}
+		return bytes;
+	}
+
+	inline NameTable::Entry* NameTable::acquire(std::string_view name) {
+		// Every cached entry holds a reference of its own, so a hit can be used without the lock.
+		struct Cache {
+			Entry* entries[CacheSize] = {};
+
+			~Cache() {
+				for (Entry* entry : entries)
+					release(entry);
+			}
+		};
+		static thread_local Cache cache;
+
+		uint32_t hash = hashName(name);
+		Entry*& cached = cache.entries[hash % CacheSize];
+		if (cached != nullptr && cached->hash == hash && cached->value == name) {
+			cached->references.fetch_add(1, std::memory_order_relaxed);
+			return cached;
+		}
+
+		NameTable& table = instance();
+		Entry* entry;
+		{
+			std::lock_guard lock(table.m_mutex);
+			entry = table.find(name, hash);
+			entry->references.fetch_add(2, std::memory_order_relaxed);
+		}
+
+		release(std::exchange(cached, entry));
+		return entry;
+	}
+
+	inline void NameTable::retain(Entry* entry) noexcept {
+		if (entry != nullptr)
+			entry->references.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	inline void NameTable::release(Entry* entry) noexcept {
+		if (entry == nullptr)
+			return;
+
+		// Only the last reference is dropped under the lock, so an entry can never be revived by
+		// acquire while it is being removed.
+		uint32_t references = entry->references.load(std::memory_order_relaxed);
+		while (references > 1) {
+			if (entry->references.compare_exchange_weak(references, references - 1, std::memory_order_acq_rel))
+				return;
+		}
+
+		NameTable& table = instance();
+		std::lock_guard lock(table.m_mutex);
+		if (entry->references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			table.remove(entry);
+	}
+
+	inline const std::pmr::string& NameTable::get(const Entry* entry) noexcept {
+		static const std::pmr::string empty;
+		return entry == nullptr ? empty : entry->value;
+	}
+
+	inline uint32_t NameTable::hash(const Entry* entry) noexcept {
+		return entry == nullptr ? hashName({}) : entry->hash;
+	}
+
+	inline uint32_t NameTable::hashName(std::string_view name) noexcept {
+		uint32_t hash = 2166136261u;
+		for (char c : name)
+			hash = (hash ^ uint8_t(c)) * 16777619u;
+		return hash;
+	}
+
+	inline NameTable& NameTable::instance() {
+		// Never destroyed, so tags with static storage duration can still release their names.
+		static NameTable* table = new NameTable();
+		return *table;
+	}
+
+	inline NameTable::Entry* NameTable::find(std::string_view name, uint32_t hash) {
+		size_t bucket = hash & (m_buckets.size() - 1);
+		for (Entry* entry = m_buckets[bucket]; entry != nullptr; entry = entry->next) {
+			if (entry->hash == hash && entry->value == name)
+				return entry;
+		}
+
+		Entry* added = new Entry();
+		added->hash = hash;
+		added->value = name;
+		added->next = m_buckets[bucket];
+		m_buckets[bucket] = added;
+
+		if (++m_size > m_buckets.size()) {
+			std::vector<Entry*> buckets(m_buckets.size() * 2, nullptr);
+			for (Entry* head : m_buckets) {
+				for (Entry* it = head; it != nullptr;) {
+					Entry* next = it->next;
+					it->next = buckets[it->hash & (buckets.size() - 1)];
+					buckets[it->hash & (buckets.size() - 1)] = it;
+					it = next;
+				}
+			}
+			m_buckets = std::move(buckets);
+		}
+		return added;
+	}
+
+	inline void NameTable::remove(Entry* entry) {
+		Entry** link = &m_buckets[entry->hash & (m_buckets.size() - 1)];
+		while (*link != entry)
+			link = &(*link)->next;
+		*link = entry->next;
+
+		delete entry;
+		--m_size;
+	}
+
+	inline std::string Tag::stringify(const StringifyOptions& options) const {
+		std::string out;
+		stringify(out, options);
+		return out;
+	}
+
+	inline void Tag::stringify(std::string& out, const StringifyOptions& options) const {
+#ifdef NBT_WITH_STATS
+		size_t offset = out.size();
+		Stats::Scope scope(Stats::Operation::Stringify);
+#endif
+		stringify(out, options, 0);
+#ifdef NBT_WITH_STATS
+		scope.finish(out.size() - offset, true);
+#endif
+	}
+
+	inline Data Tag::serialize(SerializationFlag flags) const {
+		Data data;
+		serialize(data, flags);
+		return data;
+	}
+
+	inline size_t Tag::serializedSize(SerializationFlag flags) const {
+		return serializedSize(flags, isRootNameHidden(flags));
+	}
+
+	inline void Tag::serialize(Data& data, SerializationFlag flags) const {
+		size_t offset = data.size();
+		data.resize(offset + serializedSize(flags));
+
+#ifdef NBT_WITH_STATS
+		Stats::Scope scope(Stats::Operation::Serialize);
+#endif
+		BufferOutput out{ data.data() + offset };
+		serialize(out, flags, isRootNameHidden(flags));
+#ifdef NBT_WITH_STATS
+		scope.finish(data.size() - offset, true);
+#endif
+	}
+
+	inline size_t Tag::serialize(std::span<uint8_t> buffer, SerializationFlag flags) const {
+		size_t size = serializedSize(flags);
+		if (size > buffer.size())
+			return 0;
+
+#ifdef NBT_WITH_STATS
+		Stats::Scope scope(Stats::Operation::Serialize);
+#endif
+		BufferOutput out{ buffer.data() };
+		serialize(out, flags, isRootNameHidden(flags));
+#ifdef NBT_WITH_STATS
+		scope.finish(size, true);
+#endif
+		return size;
+	}
+
+	inline Tag Tag::deserialize(const void* data, const void* end, SerializationFlag flags, std::pmr::memory_resource* resource) {
+		return deserialize(data, end, flags, DeserializeLimits{}, resource);
+	}
+
+	inline Tag Tag::deserialize(const void* data, const void* end, SerializationFlag flags, const DeserializeLimits& limits, std::pmr::memory_resource* resource) {
+#ifdef NBT_WITH_STATS
+		Stats::Scope scope(Stats::Operation::Deserialize);
+#endif
+		BufferInput in{ static_cast<const uint8_t*>(data), end };
+		Budget budget(limits);
+		Tag tag = deserialize(in, flags, false, true, budget, resource);
+#ifdef NBT_WITH_STATS
+		scope.finish(tag.isValid());
+#endif
+		return tag;
+	}
+
+	template<typename Visitor>
+	inline bool Tag::visit(const void* data, const void* end, Visitor& visitor, SerializationFlag flags) {
+		const uint8_t* it = static_cast<const uint8_t*>(data);
+		bool error = false;
+
+		Type type = Type(readNumericalData<uint8_t>(it, end, flags, error));
+		std::string_view name;
+		if (!(type == Type::Compound && bool(flags & SerializationFlag::JavaNetwork)) && type != Type::End) {
+			uint16_t nameSize = readNumericalData<uint16_t>(it, end, flags, error);
+			name = std::string_view(reinterpret_cast<const char*>(it), error ? 0 : nameSize);
+			skipData(it, end, nameSize, error);
+		}
+
+		std::vector<uint8_t> scratch;
+		if (!error)
+			visitPayload(type, name, it, end, flags, visitor, error, scratch);
+		return !error;
+	}
+
+	inline Tag Tag::parse(std::string_view text, std::pmr::memory_resource* resource) {
+		ParseError error;
+		return parse(text, error, resource);
+	}
+
+	inline Tag Tag::parse(std::string_view text, ParseError& error, std::pmr::memory_resource* resource) {
+		SnbtReader reader{ text.data(), text.data(), text.data() + text.size(), resource, nullptr, {} };
+		Tag tag;
+
+		// The root may be named; if what looks like a name is not followed by ':' it is the value.
+		reader.skipWhitespace();
+		const char* start = reader.it;
+		std::pmr::string name(resource);
+		if (reader.readName(name) && reader.consume(':')) {
+			tag.setNameEntry(NameTable::acquire(name));
+		} else {
+			reader.it = start;
+			reader.errorAt = nullptr;
+		}
+
+		if (reader.readValue(tag, 0)) {
+			reader.skipWhitespace();
+			if (reader.it != reader.end)
+				reader.fail(reader.it, "unexpected characters after the value");
+		}
+
+		error = ParseError();
+		if (reader.errorAt == nullptr)
+			return tag;
+
+		error.offset = size_t(reader.errorAt - reader.begin);
+		error.line = 1 + size_t(std::count(reader.begin, reader.errorAt, '\n'));
+		error.column = 1 + size_t(reader.errorAt - std::find(std::make_reverse_iterator(reader.errorAt), std::make_reverse_iterator(reader.begin), '\n').base());
+		error.message = reader.message;
+
+		Tag errorTag;
+		errorTag.setError();
+		return errorTag;
+	}
+
+	inline bool Tag::SnbtReader::fail(const char* at, std::string_view why) noexcept {
+		if (errorAt == nullptr) {
+			errorAt = at;
+			message = why;
+		}
+		return false;
+	}
+
+	inline void Tag::SnbtReader::skipWhitespace() noexcept {
+		while (it != end && (*it == ' ' || *it == '\t' || *it == '\n' || *it == '\r'))
+			++it;
+	}
+
+	inline bool Tag::SnbtReader::consume(char c) noexcept {
+		skipWhitespace();
+		if (it == end || *it != c)
+			return false;
+		++it;
+		return true;
+	}
+
+	inline std::string_view Tag::SnbtReader::readWord() noexcept {
+		const char* start = it;
+		while (it != end && ((*it >= 'a' && *it <= 'z') || (*it >= 'A' && *it <= 'Z') || (*it >= '0' && *it <= '9') || *it == '_' || *it == '-' || *it == '.' || *it == '+'))
+			++it;
+		return std::string_view(start, size_t(it - start));
+	}
+
+	inline bool Tag::SnbtReader::readName(std::pmr::string& name) {
+		skipWhitespace();
+		name.clear();
+		if (it != end && (*it == '"' || *it == '\''))
+			return readQuoted(name);
+
+		std::string_view word = readWord();
+		if (word.empty())
+			return fail(it, "expected a name");
+		name = word;
+		return true;
+	}
+
+	inline bool Tag::SnbtReader::readQuoted(std::pmr::string& out) {
+		const char* start = it;
+		char quote = *it++;
+
+		while (true) {
+			const char* run = it;
+			while (it != end && *it != quote && *it != '\\')
+				++it;
+			out.append(run, it);
+
+			if (it == end)
+				return fail(start, "unterminated string");
+			if (*it++ == quote)
+				return true;
+
+			if (it == end)
+				return fail(start, "unterminated string");
+			const char* escape = it - 1;
+			switch (*it++) {
+			case '\\': out += '\\'; break;
+			case '"': out += '"'; break;
+			case '\'': out += '\''; break;
+			case 'b': out += '\b'; break;
+			case 'f': out += '\f'; break;
+			case 'n': out += '\n'; break;
+			case 'r': out += '\r'; break;
+			case 't': out += '\t'; break;
+			case 'u':
+				{
+					uint32_t code = 0;
+					if (end - it < 4 || std::from_chars(it, it + 4, code, 16).ptr != it + 4)
+						return fail(escape, "invalid \\u escape");
+					it += 4;
+
+					// Encode the code point as UTF-8.
+					if (code < 0x80) {
+						out += char(code);
+					} else if (code < 0x800) {
+						out += char(0xc0 | code >> 6);
+						out += char(0x80 | (code & 0x3f));
+					} else {
+						out += char(0xe0 | code >> 12);
+						out += char(0x80 | (code >> 6 & 0x3f));
+						out += char(0x80 | (code & 0x3f));
+					}
+				}
+				break;
+
+			default:
+				return fail(escape, "invalid escape sequence");
+			}
+		}
+	}
+
+	inline bool Tag::SnbtReader::readValue(Tag& tag, size_t depth) {
+		skipWhitespace();
+		if (it == end)
+			return fail(it, "expected a value");
+		if (depth > MaxDepth)
+			return fail(it, "nesting is too deep");
+
+		switch (*it) {
+		case '{':
+			return readCompound(tag, depth);
+
+		case '[':
+			if (end - it >= 3 && it[2] == ';') {
+				switch (it[1]) {
+				case 'B': return readArray<int8_t>(tag, 'b');
+				case 'I': return readArray<int32_t>(tag, '\0');
+				case 'L': return readArray<int64_t>(tag, 'l');
+				default: return fail(it + 1, "unknown array type");
+				}
+			}
+			return readList(tag, depth);
+
+		case '"':
+		case '\'':
+			{
+				std::pmr::string str(resource);
+				if (!readQuoted(str))
+					return false;
+				tag.m_value.emplace<size_t(Type::String)>(std::move(str));
+				return true;
+			}
+
+		default:
+			{
+				const char* start = it;
+				std::string_view word = readWord();
+				if (word.empty())
+					return fail(it, "expected a value");
+				return readScalar(tag, start, word);
+			}
+		}
+	}
+
+	inline bool Tag::SnbtReader::readScalar(Tag& tag, const char* start, std::string_view word) {
+		if (word == "true" || word == "false") {
+			tag.m_value.emplace<size_t(Type::Byte)>(int8_t(word == "true"));
+			return true;
+		}
+
+		// How stringify writes NaN.
+		if (word == "NaNf" || word == "NaNF") {
+			tag.m_value.emplace<size_t(Type::Float)>(std::numeric_limits<float>::quiet_NaN());
+			return true;
+		}
+		if (word == "NaNd" || word == "NaND") {
+			tag.m_value.emplace<size_t(Type::Double)>(std::numeric_limits<double>::quiet_NaN());
+			return true;
+		}
+
+		// Anything that does not start like a number is an unquoted string.
+		char first = word[0];
+		if ((first >= '0' && first <= '9') || ((first == '-' || first == '+' || first == '.') && word.size() > 1)) {
+			char suffix = char(word.back() | 0x20);
+			std::string_view number = word;
+			if (suffix == 'b' || suffix == 's' || suffix == 'l' || suffix == 'f' || suffix == 'd')
+				number.remove_suffix(1);
+			else
+				suffix = '\0';
+
+			bool isOutOfRange = false;
+			int64_t integer;
+			if (suffix != 'f' && suffix != 'd' && parseInteger(number, integer)) {
+				switch (suffix) {
+				case 'b': isOutOfRange = integer < INT8_MIN || integer > INT8_MAX; tag.m_value.emplace<size_t(Type::Byte)>(int8_t(integer)); break;
+				case 's': isOutOfRange = integer < INT16_MIN || integer > INT16_MAX; tag.m_value.emplace<size_t(Type::Short)>(int16_t(integer)); break;
+				case 'l': tag.m_value.emplace<size_t(Type::Long)>(integer); break;
+				default: isOutOfRange = integer < INT32_MIN || integer > INT32_MAX; tag.m_value.emplace<size_t(Type::Int)>(int32_t(integer)); break;
+				}
+				return isOutOfRange ? fail(start, "number out of range") : true;
+			}
+
+			// Digits too long even for a long are out of range, not an unquoted string.
+			if ((suffix == 'b' || suffix == 's' || suffix == 'l') && isInteger(number))
+				return fail(start, "number out of range");
+
+			if (suffix == 'f' || suffix == 'd' || suffix == '\0') {
+				double value;
+				float single;
+				if (suffix == 'f' && parseFloating(number, single)) {
+					tag.m_value.emplace<size_t(Type::Float)>(single);
+					return true;
+				}
+				if (suffix != 'f' && parseFloating(number, value)) {
+					tag.m_value.emplace<size_t(Type::Double)>(value);
+					return true;
+				}
+			}
+		}
+
+		tag.m_value.emplace<size_t(Type::String)>(std::pmr::string(word, resource));
+		return true;
+	}
+
+	inline bool Tag::SnbtReader::readList(Tag& tag, size_t depth) {
+		++it;
+		std::pmr::vector<Tag> children(resource);
+
+		if (!consume(']')) {
+			do {
+				skipWhitespace();
+				const char* start = it;
+				Tag child;
+				if (!readValue(child, depth + 1))
+					return false;
+				if (!children.empty() && child.type() != children.front().type())
+					return fail(start, "list elements must all have the same type");
+				children.emplace_back(std::move(child));
+			} while (consume(','));
+
+			if (!consume(']'))
+				return fail(it, "expected ',' or ']'");
+		}
+
+		tag.m_value.emplace<size_t(Type::List)>(std::move(children));
+		return true;
+	}
+
+	inline bool Tag::SnbtReader::readCompound(Tag& tag, size_t depth) {
+		++it;
+		std::pmr::vector<Tag> children(resource);
+
+		if (!consume('}')) {
+			do {
+				Tag child;
+				if (!readName(name))
+					return false;
+				child.setNameEntry(NameTable::acquire(name));
+				if (!consume(':'))
+					return fail(it, "expected ':'");
+				if (!readValue(child, depth + 1))
+					return false;
+				children.emplace_back(std::move(child));
+			} while (consume(','));
+
+			if (!consume('}'))
+				return fail(it, "expected ',' or '}'");
+		}
+
+		tag.m_value.emplace<size_t(Type::Compound)>(std::move(children));
+		tag.buildIndex();
+		return true;
+	}
+
+	template<typename T>
+	inline bool Tag::SnbtReader::readArray(Tag& tag, char suffix) {
+		it += 3;
+		std::pmr::vector<T> values(resource);
+
+		if (!consume(']')) {
+			do {
+				skipWhitespace();
+				const char* start = it;
+				std::string_view word = readWord();
+				if (suffix != '\0' && !word.empty() && char(word.back() | 0x20) == suffix)
+					word.remove_suffix(1);
+
+				int64_t value;
+				if (!parseInteger(word, value))
+					return fail(start, "expected an integer");
+				if (value < int64_t(std::numeric_limits<T>::min()) || value > int64_t(std::numeric_limits<T>::max()))
+					return fail(start, "number out of range");
+				values.push_back(T(value));
+			} while (consume(','));
+
+			if (!consume(']'))
+				return fail(it, "expected ',' or ']'");
+		}
+
+		tag.m_value.emplace<std::pmr::vector<T>>(std::move(values));
+		return true;
+	}
+
+	template<typename T>
+	inline bool Tag::SnbtReader::parseInteger(std::string_view word, T& value) noexcept {
+		if (word.size() > 1 && word[0] == '+')
+			word.remove_prefix(1);
+		auto result = std::from_chars(word.data(), word.data() + word.size(), value);
+		return !word.empty() && result.ec == std::errc() && result.ptr == word.data() + word.size();
+	}
+
+	// Reads a float or double as Java does, so digits beyond the range of T give an infinity or
+	// zero rather than an error. Only decimal digits are accepted, not "inf" or "nan".
+	template<typename T>
+	inline bool Tag::SnbtReader::parseFloating(std::string_view word, T& value) noexcept {
+		if (word.size() > 1 && word[0] == '+')
+			word.remove_prefix(1);
+		size_t first = word.empty() || word[0] != '-' ? 0 : 1;
+		if (first == word.size() || !((word[first] >= '0' && word[first] <= '9') || word[first] == '.'))
+			return false;
+
+		auto result = std::from_chars(word.data(), word.data() + word.size(), value);
+		if (result.ptr != word.data() + word.size())
+			return false;
+		if (result.ec != std::errc::result_out_of_range)
+			return result.ec == std::errc();
+
+		// from_chars leaves `value` alone when out of range. Overflow and underflow differ in
+		// the order of magnitude of the first significant digit: the explicit exponent plus
+		// the digits before the point, or minus the zeros after it.
+		std::string_view mantissa = word.substr(first, word.find_first_of("eE") - first);
+		int64_t exponent = 0;
+		if (mantissa.size() + first < word.size()) {
+			std::string_view digits = word.substr(first + mantissa.size() + 1);
+			if (!digits.empty() && digits[0] == '+')
+				digits.remove_prefix(1);
+			if (std::from_chars(digits.data(), digits.data() + digits.size(), exponent).ec != std::errc())
+				exponent = !digits.empty() && digits[0] == '-' ? INT64_MIN / 2 : INT64_MAX / 2;
+		}
+
+		size_t point = std::min(mantissa.find('.'), mantissa.size());
+		size_t significant = mantissa.find_first_not_of("0.");
+		int64_t order = significant == std::string_view::npos ? 0
+			: significant < point ? int64_t(point - significant)
+			: -int64_t(significant - point - 1);
+		value = exponent + order > 0 ? std::numeric_limits<T>::infinity() : T(0);
+		if (first != 0)
+			value = -value;
+		return true;
+	}
+
+	// Whether `word` is an optional sign and digits, whatever their magnitude.
+	inline bool Tag::SnbtReader::isInteger(std::string_view word) noexcept {
+		if (!word.empty() && (word[0] == '+' || word[0] == '-'))
+			word.remove_prefix(1);
+		return !word.empty() && std::all_of(word.begin(), word.end(), [](char c) { return c >= '0' && c <= '9'; });
+	}
+
+	inline void Tag::stringify(std::string& out, const StringifyOptions& options, size_t depth) const {
+		if (hasName()) {
+			stringifyName(out, name());
+			out += ": ";
+		}
+
+		switch (type()) {
+		case Type::End: out += "%TAG_END%"; break;
+		case Type::Byte: stringifyNumber(out, byteValue(), "b"); break;
+		case Type::Short: stringifyNumber(out, shortValue(), "s"); break;
+		case Type::Int: stringifyNumber(out, intValue()); break;
+		case Type::Long: stringifyNumber(out, longValue(), "l"); break;
+		case Type::Float: stringifyNumber(out, floatValue(), "f"); break;
+		case Type::Double: stringifyNumber(out, doubleValue(), "d"); break;
+		case Type::ByteArray: stringifyArray(out, "[B;", byteArrayValue(), "b", options); break;
+		case Type::String: stringifyString(out, stringValue()); break;
+		case Type::IntArray: stringifyArray(out, "[I;", intArrayValue(), "", options); break;
+		case Type::LongArray: stringifyArray(out, "[L;", longArrayValue(), "l", options); break;
+
+		case Type::List:
+		case Type::Compound:
+			{
+				const auto& children = type() == Type::List ? listValue() : compoundValue();
+				char open = type() == Type::List ? '[' : '{';
+				char close = type() == Type::List ? ']' : '}';
+
+				out += open;
+				if (depth >= options.maxDepth && !children.empty()) {
+					out += "...";
+					out += close;
+					break;
+				}
+
+				size_t count = std::min(children.size(), options.maxElements);
+				for (size_t i = 0; i < count; ++i) {
+					if (i != 0)
+						out += options.pretty ? "," : ", ";
+					if (options.pretty)
+						stringifyNewline(out, options, depth + 1);
+					children[i].stringify(out, options, depth + 1);
+				}
+
+				if (count < children.size()) {
+					out += options.pretty ? "," : ", ";
+					if (options.pretty)
+						stringifyNewline(out, options, depth + 1);
+					out += "... (";
+					stringifyNumber(out, children.size() - count, " more)");
+				}
+
+				if (options.pretty && !children.empty())
+					stringifyNewline(out, options, depth);
+				out += close;
+			}
+			break;
+		}
+	}
+
+	inline void Tag::stringifyName(std::string& out, std::string_view name) {
+		bool isPlain = !name.empty() && std::all_of(name.begin(), name.end(), [](char c) {
+			return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '-' || c == '.' || c == '+';
+		});
+
+		if (isPlain)
+			out += name;
+		else
+			stringifyString(out, name);
+	}
+
+	inline void Tag::stringifyString(std::string& out, std::string_view value) {
+		out += '"';
+
+		// Copy everything between characters that need escaping in one go.
+		size_t run = 0;
+		for (size_t i = 0; i < value.size(); ++i) {
+			char c = value[i];
+			if (c != '"' && c != '\\' && uint8_t(c) >= 0x20)
+				continue;
+
+			out.append(value.data() + run, i - run);
+			run = i + 1;
+			switch (c) {
+			case '"': out += "\\\""; break;
+			case '\\': out += "\\\\"; break;
+			case '\b': out += "\\b"; break;
+			case '\f': out += "\\f"; break;
+			case '\n': out += "\\n"; break;
+			case '\r': out += "\\r"; break;
+			case '\t': out += "\\t"; break;
+			default:
+				{
+					static constexpr char digits[] = "0123456789abcdef";
+					char escape[] = { '\\', 'u', '0', '0', digits[uint8_t(c) >> 4], digits[uint8_t(c) & 0xf] };
+					out.append(escape, sizeof(escape));
+				}
+				break;
+			}
+		}
+
+		out.append(value.data() + run, value.size() - run);
+		out += '"';
+	}
+
+	template<typename T>
+	inline void Tag::stringifyNumber(std::string& out, T value, std::string_view suffix) {
+		// SNBT has no literal for these: infinities are written as a number too large for any
+		// float, which parses back as one, and NaN as a word only Tag::parse reads as a number.
+		if constexpr (std::is_floating_point_v<T>) {
+			if (!std::isfinite(value)) {
+				out += std::isnan(value) ? "NaN" : value < 0 ? "-1e999" : "1e999";
+				out += suffix;
+				return;
+			}
+		}
+
+		char buffer[32];
+		auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+		out.append(buffer, result.ptr);
+		out += suffix;
+	}
+
+	template<typename T>
+	inline void Tag::stringifyArray(std::string& out, std::string_view prefix, const T& values, std::string_view suffix, const StringifyOptions& options) {
+		out += prefix;
+
+		size_t count = std::min(values.size(), options.maxElements);
+		for (size_t i = 0; i < count; ++i) {
+			if (i != 0)
+				out += ", ";
+			stringifyNumber(out, values[i], suffix);
+		}
+
+		if (count < values.size()) {
+			out += ", ... (";
+			stringifyNumber(out, values.size() - count, " more)");
+		}
+		out += ']';
+	}
+
+	inline void Tag::stringifyNewline(std::string& out, const StringifyOptions& options, size_t depth) {
+		out += '\n';
+		out.append(depth * options.indent, ' ');
+	}
+
+	inline bool Tag::isRootNameHidden(SerializationFlag flags) const noexcept {
+		return type() == Type::Compound && bool(flags & SerializationFlag::JavaNetwork);
+	}
+
+	inline size_t Tag::serializedSize(SerializationFlag flags, bool hideName) const {
+		size_t size = sizeof(uint8_t);
+		if (!hideName && type() != Type::End)
+		{
+			std::string_view name = nameView();
+			size += numericalSize(uint16_t(name.size()), flags) + name.size();
+		}
+		return size + serializedPayloadSize(flags);
+	}
+
+	inline size_t Tag::serializedPayloadSize(SerializationFlag flags) const {
+		switch (type()) {
+		case Type::End: return 0;
+		case Type::Byte: return sizeof(int8_t);
+		case Type::Short: return sizeof(int16_t);
+		case Type::Int: return numericalSize(intValue(), flags);
+		case Type::Long: return numericalSize(longValue(), flags);
+		case Type::Float: return sizeof(float);
+		case Type::Double: return sizeof(double);
+		case Type::ByteArray: return numericalSize(int32_t(byteArrayValue().size()), flags) + byteArrayValue().size();
+		case Type::String: return numericalSize(uint16_t(stringValue().size()), flags) + stringValue().size();
+
+		case Type::IntArray:
+			{
+				const auto& arr = intArrayValue();
+				return numericalSize(int32_t(arr.size()), flags) + arrayDataSize(arr.data(), arr.size(), flags);
+			}
+
+		case Type::LongArray:
+			{
+				const auto& arr = longArrayValue();
+				return numericalSize(int32_t(arr.size()), flags) + arrayDataSize(arr.data(), arr.size(), flags);
+			}
+
+		case Type::List:
+			{
+				size_t size = sizeof(uint8_t) + numericalSize(int32_t(listValue().size()), flags);
+				for (const auto& tag : listValue())
+					size += tag.serializedPayloadSize(flags);
+				return size;
+			}
+
+		case Type::Compound:
+			{
+				size_t size = sizeof(uint8_t);
+				for (const auto& tag : compoundValue())
+					size += tag.serializedSize(flags, false);
+				return size;
+			}
+		}
+		return 0;
+	}
+
+	template<typename Output>
+	inline void Tag::serialize(Output& out, SerializationFlag flags, bool hideName) const {
+		serializeHeader(out, flags, hideName);
+		serializePayload(out, flags);
+	}
+
+	template<typename Output>
+	inline void Tag::serializeHeader(Output& out, SerializationFlag flags, bool hideName) const {
+		writeNumericalData(out, uint8_t(type()), flags);
+
+		if (!hideName && type() != Type::End) {
+			std::string_view name = nameView();
+			writeNumericalData(out, uint16_t(name.size()), flags);
+			writeData(out, name.data(), name.size());
+		}
+	}
+
+	template<typename Output>
+	inline void Tag::serializePayload(Output& out, SerializationFlag flags) const {
+		switch (type()) {
+		case Type::End: break;
+		case Type::Byte: writeNumericalData(out, byteValue(), flags); break;
+		case Type::Short: writeNumericalData(out, shortValue(), flags); break;
+		case Type::Int: writeNumericalData(out, intValue(), flags); break;
+		case Type::Long: writeNumericalData(out, longValue(), flags); break;
+		case Type::Float: writeNumericalData(out, floatValue(), flags); break;
+		case Type::Double: writeNumericalData(out, doubleValue(), flags); break;
+		case Type::ByteArray: 
+			{
+				const auto& arr = byteArrayValue();
+				writeNumericalData(out, int32_t(arr.size()), flags);
+				writeData(out, arr.data(), arr.size());
+			}
+			break;
+
+		case Type::String:
+			{
+				const auto& str = stringValue();
+				writeNumericalData(out, uint16_t(str.size()), flags);
+				writeData(out, str.data(), str.size());
+			}
+			break;
+
+		case Type::List:
+		case Type::Compound:
+			serializeContainer(out, flags, [&](const Tag& child) { child.serializePayload(out, flags); });
+			break;
+
+		case Type::IntArray:
+			{
+				const auto& arr = intArrayValue();
+				writeNumericalData(out, int32_t(arr.size()), flags);
+				writeArrayData(out, arr.data(), arr.size(), flags);
+			}
+			break;
+
+		case Type::LongArray:
+			{
+				const auto& arr = longArrayValue();
+				writeNumericalData(out, int32_t(arr.size()), flags);
+				writeArrayData(out, arr.data(), arr.size(), flags);
+			}
+			break;
+		}
+	}
+
+	template<typename Output, typename WriteChild>
+	inline void Tag::serializeContainer(Output& out, SerializationFlag flags, WriteChild&& writeChild) const {
+		if (type() == Type::List) {
+			const auto& list = listValue();
+			if (list.empty()) {
+				// A zero length is a single zero byte as a VarInt.
+				uint8_t emptyList[]{ 0,0,0,0,0 };
+				writeData(out, emptyList, isVarInt(flags) ? 2 : 5);
+			} else {
+				writeNumericalData(out, uint8_t(list.front().type()), flags);
+				writeNumericalData(out, int32_t(list.size()), flags);
+				for (const auto& child : list)
+					writeChild(child);
+			}
+		} else {
+			for (const auto& child : compoundValue()) {
+				child.serializeHeader(out, flags, false);
+				writeChild(child);
+			}
+			writeNumericalData(out, uint8_t(Type::End), flags);
+		}
+	}
+
+	template<typename Input>
+	inline Tag Tag::deserialize(Input& in, SerializationFlag flags, bool isNameHidden, bool isRoot, Budget& budget, std::pmr::memory_resource* resource) {
+		bool error = false;
+		Type type = Type(readNumericalData<uint8_t>(in, flags, error));
+		if (error) {
 			Tag errorTag;
-			errorTag.m_error = true;
+			errorTag.setError();
 			return errorTag;
 		}
-		
-		Type type = Type(*it);
-		++it;
 
-		if ((type == Type::Compound && bool(flags & SerializationFlag::JavaNetwork) && isRoot) || type == Type::End)
-			isNameHidden = true;
+		if ((type == Type::Compound && bool(flags & SerializationFlag::JavaNetwork) && isRoot) || type == Type::End)
+			isNameHidden = true;
+
+		Tag tag;
+		if (!isNameHidden) {
+			// Names go straight from a stack buffer into the intern table.
+			char buffer[256];
+			std::string large;
+			size_t size = readNumericalData<uint16_t>(in, flags, error);
+			char* name = buffer;
+			if (size > sizeof(buffer)) {
+				large.resize(size);
+				name = large.data();
+			}
+
+			readData(in, name, size, error);
+			if (!error)
+				tag.setNameEntry(NameTable::acquire(std::string_view(name, size)));
+		}
+
+		if (type != Type::End && !budget.addTag(tag.nameView().size()))
+			error = true;
+
+		if (error)
+			tag.setError();
+		else
+			deserializePayload(tag, type, in, flags, budget, resource);
+#ifdef NBT_WITH_STATS
+		if (tag.isValid())
+			Stats::addHeader(type, tag.nameView().size(), isNameHidden, flags);
+#endif
+
+		return tag;
+	}
+
+	template<typename Input>
+	inline void Tag::deserializePayload(Tag& tag, Type type, Input& in, SerializationFlag flags, Budget& budget, std::pmr::memory_resource* resource) {
+		bool error = false;
+		switch (type) {
+		case Type::End: tag.m_value.emplace<size_t(Type::End)>(0); break;
+		case Type::Byte: tag.m_value.emplace<size_t(Type::Byte)>(readNumericalData<int8_t>(in, flags, error)); break;
+		case Type::Short: tag.m_value.emplace<size_t(Type::Short)>(readNumericalData<int16_t>(in, flags, error)); break;
+		case Type::Int: tag.m_value.emplace<size_t(Type::Int)>(readNumericalData<int32_t>(in, flags, error)); break;
+		case Type::Long: tag.m_value.emplace<size_t(Type::Long)>(readNumericalData<int64_t>(in, flags, error)); break;
+		case Type::Float: tag.m_value.emplace<size_t(Type::Float)>(readNumericalData<float>(in, flags, error)); break;
+		case Type::Double: tag.m_value.emplace<size_t(Type::Double)>(readNumericalData<double>(in, flags, error)); break;
+		case Type::ByteArray:
+			{
+				std::pmr::vector<int8_t> byteArray(resource);
+				size_t size = size_t(std::max(readNumericalData<int32_t>(in, flags, error), 0));
+				if (!budget.addArray(size, sizeof(int8_t)))
+					error = true;
+				readArrayData(in, byteArray, size, flags, error);
+				tag.m_value.emplace<size_t(Type::ByteArray)>(std::move(byteArray));
+			}
+			break;
+
+		case Type::String:
+			{
+				std::pmr::string str(resource);
+				size_t size = readNumericalData<uint16_t>(in, flags, error);
+				if (error || size > in.remaining() || !budget.addArray(size, sizeof(char))) {
+					error = true;
+				} else {
+					str.resize(size);
+					readData(in, str.data(), str.size(), error);
+				}
+				tag.m_value.emplace<size_t(Type::String)>(std::move(str));
+			}
+			break;
+
+		case Type::List:
+			{
+				Type listType = Type(readNumericalData<uint8_t>(in, flags, error));
+
+				std::pmr::vector<Tag> tags(resource);
+				size_t size = size_t(std::max(readNumericalData<int32_t>(in, flags, error), 0));
+
+				// Elements of End take no input, so a list of them could claim any length for
+				// free; like TagIndex, treat it as empty.
+				if (listType == Type::End)
+					size = 0;
+				if (budget.depth == 0 || !budget.addArray(size, 0))
+					error = true;
+				if (!error)
+					tags.reserve(std::min({ size, in.remaining(), ArrayChunkSize, budget.bytes / sizeof(Tag) }));
+
+				--budget.depth;
+#ifdef NBT_WITH_STATS
+				Stats::enter();
+#endif
+				for (size_t i = 0; i < size && !error; ++i) {
+					Tag child;
+					if (!budget.addTag(0))
+						error = true;
+					else
+						deserializePayload(child, listType, in, flags, budget, resource);
+					if (!child.isValid() || child.type() != listType)
+						error = true;
+					tags.emplace_back(std::move(child));
+				}
+#ifdef NBT_WITH_STATS
+				Stats::leave();
+#endif
+				++budget.depth;
+
+				tag.m_value.emplace<size_t(Type::List)>(std::move(tags));
+			}
+			break;
+
+		case Type::Compound:
+			{
+				std::pmr::vector<Tag> tags(resource);
+				if (budget.depth == 0)
+					error = true;
+
+				--budget.depth;
+#ifdef NBT_WITH_STATS
+				Stats::enter();
+#endif
+				while (!error) {
+					Tag child = deserialize(in, flags, false, false, budget, resource);
+					if (!child.isValid())
+						error = true;
+					if (child.type() == Type::End)
+						break;
+					tags.emplace_back(std::move(child));
+				}
+#ifdef NBT_WITH_STATS
+				Stats::leave();
+#endif
+				++budget.depth;
+
+				tag.m_value.emplace<size_t(Type::Compound)>(std::move(tags));
+				tag.buildIndex();
+			}
+			break;
+
+		case Type::IntArray:
+			{
+				std::pmr::vector<int32_t> arr(resource);
+				size_t size = size_t(std::max(readNumericalData<int32_t>(in, flags, error), 0));
+				if (!budget.addArray(size, sizeof(int32_t)))
+					error = true;
+				readArrayData(in, arr, size, flags, error);
+				tag.m_value.emplace<size_t(Type::IntArray)>(std::move(arr));
+			}
+			break;
+
+		case Type::LongArray:
+			{
+				std::pmr::vector<int64_t> arr(resource);
+				size_t size = size_t(std::max(readNumericalData<int32_t>(in, flags, error), 0));
+				if (!budget.addArray(size, sizeof(int64_t)))
+					error = true;
+				readArrayData(in, arr, size, flags, error);
+				tag.m_value.emplace<size_t(Type::LongArray)>(std::move(arr));
+			}
+			break;
+
+		default:
+			error = true;
+			break;
+		}
+
+		if (error)
+			tag.setError();
+#ifdef NBT_WITH_STATS
+		else
+			Stats::addPayload(tag, type, flags);
+#endif
+	}
+
+	inline Tag::Budget::Budget(const DeserializeLimits& limits) noexcept :
+		bytes(limits.maxBytes), depth(limits.maxDepth), arrayLength(limits.maxArrayLength), tags(limits.maxTags) {}
+
+	inline bool Tag::Budget::addTag(size_t nameSize) noexcept {
+		if (tags == 0 || !addBytes(sizeof(Tag) + nameSize))
+			return false;
+		--tags;
+		return true;
+	}
+
+	// Charged with the declared length before anything is allocated for it.
+	inline bool Tag::Budget::addArray(size_t count, size_t elementSize) noexcept {
+		if (count > arrayLength || (elementSize != 0 && count > bytes / elementSize))
+			return false;
+		bytes -= count * elementSize;
+		return true;
+	}
+
+	inline bool Tag::Budget::addBytes(size_t count) noexcept {
+		if (count > bytes)
+			return false;
+		bytes -= count;
+		return true;
+	}
+
+	inline void Tag::skipPayload(Type type, const uint8_t*& it, const void* end, SerializationFlag flags, bool& error, size_t depth) {
+		if ((type == Type::List || type == Type::Compound) && depth >= MaxDepth)
+			error = true;
+		if (error)
+			return;
+
+		switch (type) {
+		case Type::End: break;
+		case Type::Byte: skipData(it, end, sizeof(int8_t), error); break;
+		case Type::Short: skipData(it, end, sizeof(int16_t), error); break;
+		case Type::Int: readNumericalData<int32_t>(it, end, flags, error); break;
+		case Type::Long: readNumericalData<int64_t>(it, end, flags, error); break;
+		case Type::Float: skipData(it, end, sizeof(float), error); break;
+		case Type::Double: skipData(it, end, sizeof(double), error); break;
+		case Type::ByteArray: skipData(it, end, size_t(std::max(readNumericalData<int32_t>(it, end, flags, error), 0)), error); break;
+		case Type::String: skipData(it, end, readNumericalData<uint16_t>(it, end, flags, error), error); break;
+
+		case Type::IntArray:
+		case Type::LongArray:
+			{
+				size_t size = size_t(std::max(readNumericalData<int32_t>(it, end, flags, error), 0));
+				if (isVarInt(flags))
+					skipVarInts(it, end, size, error);
+				else
+					skipData(it, end, size * (type == Type::IntArray ? sizeof(int32_t) : sizeof(int64_t)), error);
+			}
+			break;
+
+		case Type::List:
+			{
+				Type listType = Type(readNumericalData<uint8_t>(it, end, flags, error));
+				size_t size = size_t(std::max(readNumericalData<int32_t>(it, end, flags, error), 0));
+
+				if (size_t elementSize = fixedPayloadSize(listType, flags); elementSize != 0) {
+					skipData(it, end, size * elementSize, error);
+					break;
+				}
+
+				if (listType == Type::End)
+					break;
+				for (size_t i = 0; i < size && !error; ++i)
+					skipPayload(listType, it, end, flags, error, depth + 1);
+			}
+			break;
+
+		case Type::Compound:
+			{
+				while (!error) {
+					Type childType = Type(readNumericalData<uint8_t>(it, end, flags, error));
+					if (error || childType == Type::End)
+						break;
+					skipData(it, end, readNumericalData<uint16_t>(it, end, flags, error), error);
+					skipPayload(childType, it, end, flags, error, depth + 1);
+				}
+			}
+			break;
+
+		default:
+			error = true;
+			break;
+		}
+	}
+
+	inline size_t Tag::fixedPayloadSize(Type type, SerializationFlag flags) noexcept {
+		switch (type) {
+		case Type::Byte: return sizeof(int8_t);
+		case Type::Short: return sizeof(int16_t);
+		case Type::Int: return isVarInt(flags) ? 0 : sizeof(int32_t);
+		case Type::Long: return isVarInt(flags) ? 0 : sizeof(int64_t);
+		case Type::Float: return sizeof(float);
+		case Type::Double: return sizeof(double);
+		default: return 0;
+		}
+	}
+
+	template<typename Visitor>
+	inline VisitResult Tag::visitPayload(Type type, std::string_view name, const uint8_t*& it, const void* end, SerializationFlag flags, Visitor& visitor, bool& error, std::vector<uint8_t>& scratch, size_t depth) {
+		if ((type == Type::List || type == Type::Compound) && depth >= MaxDepth) {
+			error = true;
+			return VisitResult::Abort;
+		}
+
+		switch (type) {
+		case Type::End: return VisitResult::Continue;
+		case Type::Byte: { int8_t value = readNumericalData<int8_t>(it, end, flags, error); return error ? VisitResult::Abort : visitor.byteValue(name, value); }
+		case Type::Short: { int16_t value = readNumericalData<int16_t>(it, end, flags, error); return error ? VisitResult::Abort : visitor.shortValue(name, value); }
+		case Type::Int: { int32_t value = readNumericalData<int32_t>(it, end, flags, error); return error ? VisitResult::Abort : visitor.intValue(name, value); }
+		case Type::Long: { int64_t value = readNumericalData<int64_t>(it, end, flags, error); return error ? VisitResult::Abort : visitor.longValue(name, value); }
+		case Type::Float: { float value = readNumericalData<float>(it, end, flags, error); return error ? VisitResult::Abort : visitor.floatValue(name, value); }
+		case Type::Double: { double value = readNumericalData<double>(it, end, flags, error); return error ? VisitResult::Abort : visitor.doubleValue(name, value); }
+		case Type::ByteArray:
+			{
+				size_t size = size_t(std::max(readNumericalData<int32_t>(it, end, flags, error), 0));
+				const uint8_t* arr = it;
+				skipData(it, end, size, error);
+				return error ? VisitResult::Abort : visitor.byteArray(name, std::span<const int8_t>(reinterpret_cast<const int8_t*>(arr), size));
+			}
+
+		case Type::String:
+			{
+				size_t size = readNumericalData<uint16_t>(it, end, flags, error);
+				const uint8_t* str = it;
+				skipData(it, end, size, error);
+				return error ? VisitResult::Abort : visitor.string(name, std::string_view(reinterpret_cast<const char*>(str), size));
+			}
+
+		case Type::IntArray:
+			{
+				size_t size = size_t(std::max(readNumericalData<int32_t>(it, end, flags, error), 0));
+				if (isVarInt(flags))
+					return visitVarIntArray<int32_t>(name, it, end, size, visitor, error, scratch);
+
+				const uint8_t* arr = it;
+				skipData(it, end, size * sizeof(int32_t), error);
+				return error ? VisitResult::Abort : visitor.intArray(name, ArrayView<int32_t>(arr, size, flags));
+			}
+
+		case Type::LongArray:
+			{
+				size_t size = size_t(std::max(readNumericalData<int32_t>(it, end, flags, error), 0));
+				if (isVarInt(flags))
+					return visitVarIntArray<int64_t>(name, it, end, size, visitor, error, scratch);
+
+				const uint8_t* arr = it;
+				skipData(it, end, size * sizeof(int64_t), error);
+				return error ? VisitResult::Abort : visitor.longArray(name, ArrayView<int64_t>(arr, size, flags));
+			}
+
+		case Type::List:
+			{
+				Type listType = Type(readNumericalData<uint8_t>(it, end, flags, error));
+				size_t size = size_t(std::max(readNumericalData<int32_t>(it, end, flags, error), 0));
+				if (error)
+					return VisitResult::Abort;
+				if (listType == Type::End)
+					size = 0;
+
+				VisitResult result = visitor.beginList(name, listType, size);
+				if (result == VisitResult::Abort)
+					return result;
+
+				bool isSkipped = result == VisitResult::Skip;
+				for (size_t i = 0; i < size && !error; ++i) {
+					if (result == VisitResult::Skip) {
+						skipPayload(listType, it, end, flags, error, depth + 1);
+					} else {
+						result = visitPayload(listType, std::string_view(), it, end, flags, visitor, error, scratch, depth + 1);
+						if (result == VisitResult::Abort)
+							return result;
+					}
+				}
+
+				if (error)
+					return VisitResult::Abort;
+				return isSkipped ? VisitResult::Continue : visitor.end();
+			}
+
+		case Type::Compound:
+			{
+				VisitResult result = visitor.beginCompound(name);
+				if (result == VisitResult::Abort)
+					return result;
+
+				if (result == VisitResult::Skip) {
+					skipPayload(Type::Compound, it, end, flags, error, depth);
+					return error ? VisitResult::Abort : VisitResult::Continue;
+				}
+
+				while (true) {
+					Type childType = Type(readNumericalData<uint8_t>(it, end, flags, error));
+					if (error)
+						return VisitResult::Abort;
+					if (childType == Type::End)
+						break;
+
+					uint16_t nameSize = readNumericalData<uint16_t>(it, end, flags, error);
+					std::string_view childName(reinterpret_cast<const char*>(it), error ? 0 : nameSize);
+					skipData(it, end, nameSize, error);
+					if (error)
+						return VisitResult::Abort;
+
+					result = visitPayload(childType, childName, it, end, flags, visitor, error, scratch, depth + 1);
+					if (result == VisitResult::Abort)
+						return result;
+
+					if (result == VisitResult::Skip) {
+						skipPayload(Type::Compound, it, end, flags, error, depth);
+						break;
+					}
+				}
+
+				return error ? VisitResult::Abort : visitor.end();
+			}
+
+		default:
+			error = true;
+			return VisitResult::Abort;
+		}
+	}
+
+	// VarInt arrays cannot be indexed in place, so they are decoded into a scratch buffer and
+	// handed to the visitor as a view over native values, valid only during the callback.
+	template<typename T, typename Visitor>
+	inline VisitResult Tag::visitVarIntArray(std::string_view name, const uint8_t*& it, const void* end, size_t size, Visitor& visitor, bool& error, std::vector<uint8_t>& scratch) {
+		constexpr SerializationFlag native = std::endian::native == std::endian::little ? SerializationFlag::LittleEndian : SerializationFlag::None;
+		if (error || size > size_t(static_cast<const uint8_t*>(end) - it)) {
+			error = true;
+			return VisitResult::Abort;
+		}
+
+		// Every VarInt takes at least a byte, so the check above also bounds the buffer by the input.
+		if (scratch.size() < size * sizeof(T))
+			scratch.resize(size * sizeof(T));
+		for (size_t i = 0; i < size && !error; ++i) {
+			T value = readNumericalData<T>(it, end, SerializationFlag::VarInt, error);
+			memcpy(scratch.data() + i * sizeof(T), &value, sizeof(T));
+		}
+		if (error)
+			return VisitResult::Abort;
+
+		ArrayView<T> view(scratch.data(), size, native);
+		if constexpr (std::is_same_v<T, int32_t>)
+			return visitor.intArray(name, view);
+		else
+			return visitor.longArray(name, view);
+	}
+
+	inline void Tag::DataOutput::write(const void* src, size_t count) {
+		if (count != 0)
+			memcpy(reserve(count), src, count);
+	}
+
+	template<typename T>
+	inline void Tag::DataOutput::writeArray(const T* src, size_t count, SerializationFlag flags) {
+		copyNumericalData<T>(reserve(count * sizeof(T)), src, count, flags);
+	}
+
+	inline uint8_t* Tag::DataOutput::reserve(size_t count) {
+		if (data.size() - size < count)
+			data.resize(std::max(data.size() * 2, size + count));
+
+		uint8_t* it = data.data() + size;
+		size += count;
+		return it;
+	}
+
+	inline void Tag::BufferOutput::write(const void* src, size_t size) noexcept {
+		if (size != 0)
+			memcpy(it, src, size);
+		it += size;
+	}
+
+	template<typename T>
+	inline void Tag::BufferOutput::writeArray(const T* src, size_t count, SerializationFlag flags) noexcept {
+		copyNumericalData<T>(it, src, count, flags);
+		it += count * sizeof(T);
+	}
+
+	template<typename Output>
+	inline void Tag::writeData(Output& out, const void* src, size_t size) {
+		out.write(src, size);
+	}
+
+	inline bool Tag::BufferInput::read(void* dst, size_t size) noexcept {
+		if (size > remaining())
+			return false;
+
+		if (size != 0)
+			memcpy(dst, it, size);
+		it += size;
+		return true;
+	}
+
+	inline size_t Tag::BufferInput::remaining() const noexcept {
+		return size_t(static_cast<const uint8_t*>(end) - it);
+	}
+
+	template<typename T>
+	inline bool Tag::BufferInput::readArray(T* dst, size_t count, SerializationFlag flags) noexcept {
+		if (count > remaining() / sizeof(T))
+			return false;
+
+		copyNumericalData<T>(dst, it, count, flags);
+		it += count * sizeof(T);
+		return true;
+	}
+
+	template<typename Input>
+	inline void Tag::readData(Input& in, void* dst, size_t size, bool& error) {
+		if (error || !in.read(dst, size))
+			error = true;
+	}
+
+	inline void Tag::skipData(const uint8_t*& it, const void* end, size_t size, bool& error) {
+		if (error || size > size_t(static_cast<const uint8_t*>(end) - it)) {
+			error = true;
+			return;
+		}
+		it += size;
+	}
+
+	template<typename T, typename Output>
+	inline void Tag::writeNumericalData(Output& out, T src, SerializationFlag flags) {
+		if constexpr (IsVarIntType<T>) {
+			if (isVarInt(flags)) {
+				uint8_t bytes[MaxVarIntSize<int64_t>];
+				out.write(bytes, encodeVarInt(bytes, toVarInt(src)));
+				return;
+			}
+		}
+
+		uint8_t bytes[sizeof(T)];
+		memcpy(bytes, &src, sizeof(T));
+
+		if (needsByteSwap(flags))
+			std::reverse(bytes, bytes + sizeof(T));
+		out.write(bytes, sizeof(T));
+	}
+
+	template<typename T>
+	inline T Tag::readNumericalData(const uint8_t*& it, const void* end, SerializationFlag flags, bool& error) {
+		if constexpr (IsVarIntType<T>) {
+			if (isVarInt(flags)) {
+				uint64_t value = 0;
+				if (error || !decodeVarInt(it, end, MaxVarIntSize<T>, value)) {
+					error = true;
+					return T(0);
+				}
+				return fromVarInt<T>(value, error);
+			}
+		}
+
+		const uint8_t* src = it;
+		skipData(it, end, sizeof(T), error);
+
+		if (!error) {
+			return decodeNumericalData<T>(src, flags);
+		} else {
+			return T(0);
+		}
+	}
+
+	template<typename T, typename Input>
+	inline T Tag::readNumericalData(Input& in, SerializationFlag flags, bool& error) {
+		if constexpr (IsVarIntType<T>) {
+			if (isVarInt(flags)) {
+				if constexpr (std::is_same_v<Input, BufferInput>) {
+					return readNumericalData<T>(in.it, in.end, flags, error);
+				} else {
+					uint64_t value = 0;
+					for (size_t i = 0; i < MaxVarIntSize<T> && !error; ++i) {
+						uint8_t byte = 0;
+						readData(in, &byte, 1, error);
+						value |= uint64_t(byte & 0x7f) << (7 * i);
+						if ((byte & 0x80) == 0)
+							return error ? T(0) : fromVarInt<T>(value, error);
+					}
+					error = true;
+					return T(0);
+				}
+			}
+		}
+
+		uint8_t bytes[sizeof(T)];
+		readData(in, bytes, sizeof(T), error);
+		return error ? T(0) : decodeNumericalData<T>(bytes, flags);
+	}
+
+	template<typename T>
+	inline T Tag::decodeNumericalData(const uint8_t* src, SerializationFlag flags) noexcept {
+		union {
+			T t;
+			uint8_t bytes[sizeof(T)];
+		} data;
+
+		memcpy(data.bytes, src, sizeof(T));
+
+		if (needsByteSwap(flags))
+			std::reverse(data.bytes, data.bytes + sizeof(T));
+		return data.t;
+	}
+
+	template<typename T, typename Output>
+	inline void Tag::writeArrayData(Output& out, const T* src, size_t count, SerializationFlag flags) {
+		if constexpr (IsVarIntType<T>) {
+			if (isVarInt(flags)) {
+				// Encode into a stack buffer so the output sees one write per batch, not per element.
+				// encodeVarInt stores a whole word even for short values, hence the slack.
+				uint8_t buffer[VarIntBatchSize * MaxVarIntSize<T> + sizeof(uint64_t)];
+				for (size_t i = 0; i < count;) {
+					size_t size = 0;
+					for (size_t last = std::min(count, i + VarIntBatchSize); i < last; ++i)
+						size += encodeVarInt(buffer + size, toVarInt(src[i]));
+					out.write(buffer, size);
+				}
+				return;
+			}
+		}
+
+		out.writeArray(src, count, flags);
+	}
+
+	template<typename T, typename Input>
+	inline void Tag::readArrayData(Input& in, std::pmr::vector<T>& dst, size_t count, SerializationFlag flags, bool& error) {
+		// A VarInt takes at least one byte, which still bounds the length before allocating.
+		bool isVarIntArray = IsVarIntType<T> && isVarInt(flags);
+		if (error || count > in.remaining() / (isVarIntArray ? 1 : sizeof(T))) {
+			error = true;
+			return;
+		}
+
+		// When the input cannot tell how much is left, grow the array as the data actually
+		// arrives rather than trusting the declared length with one big allocation.
+		size_t chunk = in.remaining() == SIZE_MAX ? ArrayChunkSize / sizeof(T) : count;
+		while (dst.size() < count && !error) {
+			size_t offset = dst.size();
+			size_t size = std::min(count - offset, chunk);
+			dst.resize(offset + size);
+			if (isVarIntArray) {
+				for (size_t i = offset; i < offset + size && !error; ++i)
+					dst[i] = readNumericalData<T>(in, flags, error);
+			} else if (!in.readArray(dst.data() + offset, size, flags)) {
+				error = true;
+			}
+		}
+	}
+
+	template<typename T>
+	inline void Tag::copyNumericalData(void* dst, const void* src, size_t count, SerializationFlag flags) noexcept {
+		if (count == 0)
+			return;
+
+		if (sizeof(T) == 1 || !needsByteSwap(flags)) {
+			memcpy(dst, src, count * sizeof(T));
+		} else {
+			byteSwapData<sizeof(T)>(static_cast<uint8_t*>(dst), static_cast<const uint8_t*>(src), count);
+		}
+	}
+
+	// Reverses the bytes of `count` consecutive values of `Size` bytes each. The vector path is
+	// picked at compile time from the target flags; the scalar loop handles the tail.
+	template<size_t Size>
+	inline void Tag::byteSwapData(uint8_t* dst, const uint8_t* src, size_t count) noexcept {
+		size_t bytes = count * Size;
+		size_t i = 0;
+
+#if defined(__AVX2__) || defined(__SSSE3__)
+		alignas(32) static constexpr auto mask = []() {
+			std::array<uint8_t, 32> mask{};
+			for (size_t j = 0; j < mask.size(); ++j)
+				mask[j] = uint8_t((j % 16) / Size * Size + (Size - 1 - j % Size));
+			return mask;
+		}();
+
+#if defined(__AVX2__)
+		const __m256i mask256 = _mm256_load_si256(reinterpret_cast<const __m256i*>(mask.data()));
+		for (; i + 32 <= bytes; i += 32) {
+			__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_shuffle_epi8(v, mask256));
+		}
+#endif
+		const __m128i mask128 = _mm_load_si128(reinterpret_cast<const __m128i*>(mask.data()));
+		for (; i + 16 <= bytes; i += 16) {
+			__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_shuffle_epi8(v, mask128));
+		}
+#elif defined(__SSE2__) || defined(_M_X64)
+		for (; i + 16 <= bytes; i += 16) {
+			__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+			v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+			if constexpr (Size == 4) {
+				v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1)), _MM_SHUFFLE(2, 3, 0, 1));
+			} else if constexpr (Size == 8) {
+				v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, _MM_SHUFFLE(0, 1, 2, 3)), _MM_SHUFFLE(0, 1, 2, 3));
+			}
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), v);
+		}
+#elif defined(__ARM_NEON)
+		for (; i + 16 <= bytes; i += 16) {
+			uint8x16_t v = vld1q_u8(src + i);
+			if constexpr (Size == 2) {
+				v = vrev16q_u8(v);
+			} else if constexpr (Size == 4) {
+				v = vrev32q_u8(v);
+			} else {
+				v = vrev64q_u8(v);
+			}
+			vst1q_u8(dst + i, v);
+		}
+#endif
+
+		using Word = std::conditional_t<Size == 2, uint16_t, std::conditional_t<Size == 4, uint32_t, uint64_t>>;
+		for (; i < bytes; i += Size) {
+			Word value;
+			memcpy(&value, src + i, Size);
+#if defined(__GNUC__) || defined(__clang__)
+			if constexpr (Size == 2) {
+				value = __builtin_bswap16(value);
+			} else if constexpr (Size == 4) {
+				value = __builtin_bswap32(value);
+			} else {
+				value = __builtin_bswap64(value);
+			}
+#else
+			Word swapped = 0;
+			for (size_t j = 0; j < Size; ++j)
+				swapped |= Word((value >> (j * 8)) & 0xff) << ((Size - 1 - j) * 8);
+			value = swapped;
+#endif
+			memcpy(dst + i, &value, Size);
+		}
+	}
+
+	inline bool Tag::needsByteSwap(SerializationFlag flags) noexcept {
+		return (std::endian::native == std::endian::little) != bool(flags & SerializationFlag::LittleEndian);
+	}
+
+	inline bool Tag::isVarInt(SerializationFlag flags) noexcept {
+		return bool(flags & SerializationFlag::VarInt);
+	}
+
+	template<typename T>
+	inline size_t Tag::numericalSize(T value, SerializationFlag flags) noexcept {
+		if constexpr (IsVarIntType<T>) {
+			if (isVarInt(flags))
+				return varIntSize(toVarInt(value));
+		}
+		return sizeof(T);
+	}
+
+	template<typename T>
+	inline size_t Tag::arrayDataSize(const T* src, size_t count, SerializationFlag flags) noexcept {
+		if constexpr (IsVarIntType<T>) {
+			if (isVarInt(flags)) {
+				size_t size = 0;
+				for (size_t i = 0; i < count; ++i)
+					size += varIntSize(toVarInt(src[i]));
+				return size;
+			}
+		}
+		return count * sizeof(T);
+	}
+
+	// Signed values are zigzag encoded so small negative numbers stay short: 0, -1, 1, -2
+	// become 0, 1, 2, 3.
+	template<typename T>
+	inline uint64_t Tag::toVarInt(T value) noexcept {
+		if constexpr (std::is_signed_v<T>) {
+			using Unsigned = std::make_unsigned_t<T>;
+			return uint64_t(Unsigned(Unsigned(value) << 1) ^ Unsigned(value >> (sizeof(T) * 8 - 1)));
+		} else {
+			return uint64_t(value);
+		}
+	}
+
+	template<typename T>
+	inline T Tag::fromVarInt(uint64_t value, bool& error) noexcept {
+		using Unsigned = std::make_unsigned_t<T>;
+		if constexpr (sizeof(T) < sizeof(uint64_t)) {
+			if (value > std::numeric_limits<Unsigned>::max()) {
+				error = true;
+				return T(0);
+			}
+		}
+
+		if constexpr (std::is_signed_v<T>) {
+			return T(Unsigned(value >> 1) ^ (Unsigned(0) - Unsigned(value & 1)));
+		} else {
+			return T(value);
+		}
+	}
+
+	inline size_t Tag::varIntSize(uint64_t value) noexcept {
+		return size_t(std::bit_width(value | 1) + 6) / 7;
+	}
+
+	// Writes the seven bit groups of `value`, low group first, with the high bit of each byte
+	// flagging that another follows. `dst` needs room for the longest VarLong (10 bytes).
+	inline size_t Tag::encodeVarInt(uint8_t* dst, uint64_t value) noexcept {
+		size_t size = varIntSize(value);
+		if (size > sizeof(uint64_t)) {
+			for (size_t i = 0; i + 1 < size; ++i, value >>= 7)
+				dst[i] = uint8_t(value | 0x80);
+			dst[size - 1] = uint8_t(value);
+			return size;
+		}
+
+		// Up to 56 bits fit one word: spread the groups to one per byte and set the
+		// continuation bits of all bytes but the last, then store all eight at once.
+#if defined(__BMI2__)
+		uint64_t word = _pdep_u64(value, 0x7f7f7f7f7f7f7f7full);
+#else
+		uint64_t word = 0;
+		for (size_t i = 0; i < sizeof(uint64_t); ++i)
+			word |= (value << i) & (uint64_t(0x7f) << (8 * i));
+#endif
+		word |= 0x8080808080808080ull & ((uint64_t(1) << (8 * size - 8)) - 1);
+
+		memcpy(dst, &word, sizeof(word));
+		if constexpr (std::endian::native == std::endian::big)
+			std::reverse(dst, dst + sizeof(word));
+		return size;
+	}
+
+	// Reads one VarInt of at most `maxSize` bytes. With eight bytes in reach the terminating
+	// byte is found with a single bit scan over the whole word instead of a loop per byte.
+	inline bool Tag::decodeVarInt(const uint8_t*& it, const void* end, size_t maxSize, uint64_t& value) noexcept {
+		size_t available = size_t(static_cast<const uint8_t*>(end) - it);
+		if (available >= sizeof(uint64_t)) {
+			uint64_t word;
+			memcpy(&word, it, sizeof(word));
+			if constexpr (std::endian::native == std::endian::big) {
+				uint8_t* bytes = reinterpret_cast<uint8_t*>(&word);
+				std::reverse(bytes, bytes + sizeof(word));
+			}
+
+			if (uint64_t stops = ~word & 0x8080808080808080ull; stops != 0) {
+				size_t size = size_t(std::countr_zero(stops)) / 8 + 1;
+				if (size > maxSize)
+					return false;
+
+				uint64_t bits = word & (stops ^ (stops - 1));
+#if defined(__BMI2__)
+				value = _pext_u64(bits, 0x7f7f7f7f7f7f7f7full);
+#else
+				value = 0;
+				for (size_t i = 0; i < sizeof(uint64_t); ++i)
+					value |= (bits >> i) & (uint64_t(0x7f) << (7 * i));
+#endif
+				it += size;
+				return true;
+			}
+		}
+
+		// Near the end of the buffer, and for VarLongs longer than eight bytes.
+		value = 0;
+		for (size_t i = 0; i < std::min(maxSize, available); ++i) {
+			value |= uint64_t(it[i] & 0x7f) << (7 * i);
+			if ((it[i] & 0x80) == 0) {
+				it += i + 1;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Steps over `count` VarInts without decoding them. Each ends in the one byte with its high
+	// bit clear, so a word at a time the terminators are counted with a popcount.
+	inline void Tag::skipVarInts(const uint8_t*& it, const void* end, size_t count, bool& error) noexcept {
+		const uint8_t* last = static_cast<const uint8_t*>(end);
+		if (error || count > size_t(last - it)) {
+			error = true;
+			return;
+		}
+
+		while (count != 0) {
+			if (size_t(last - it) >= sizeof(uint64_t)) {
+				uint64_t word;
+				memcpy(&word, it, sizeof(word));
+				uint64_t stops = ~word & 0x8080808080808080ull;
+				if (size_t found = size_t(std::popcount(stops)); found < count) {
+					it += sizeof(word);
+					count -= found;
+					continue;
+				}
+
+				if constexpr (std::endian::native == std::endian::big) {
+					for (; count != 0; ++it)
+						count -= (*it & 0x80) == 0;
+				} else {
+					for (; count > 1; --count)
+						stops &= stops - 1;
+					it += size_t(std::countr_zero(stops)) / 8 + 1;
+				}
+				return;
+			}
+
+			if (it == last) {
+				error = true;
+				return;
+			}
+			count -= (*it++ & 0x80) == 0;
+		}
+	}
+
+	template<typename T>
+	inline T ArrayView<T>::Iterator::operator*() const noexcept {
+		return Tag::decodeNumericalData<T>(m_it, m_flags);
+	}
+
+	template<typename T>
+	inline typename ArrayView<T>::Iterator& ArrayView<T>::Iterator::operator++() noexcept {
+		m_it += sizeof(T);
+		return *this;
+	}
+
+	template<typename T>
+	inline typename ArrayView<T>::Iterator ArrayView<T>::Iterator::operator++(int) noexcept {
+		Iterator copy = *this;
+		++*this;
+		return copy;
+	}
+
+	template<typename T>
+	inline bool ArrayView<T>::Iterator::operator==(const Iterator& other) const noexcept {
+		return m_it == other.m_it;
+	}
+
+	template<typename T>
+	inline size_t ArrayView<T>::size() const noexcept {
+		return m_size;
+	}
+
+	template<typename T>
+	inline bool ArrayView<T>::empty() const noexcept {
+		return m_size == 0;
+	}
+
+	template<typename T>
+	inline T ArrayView<T>::operator[](size_t index) const noexcept {
+		return Tag::decodeNumericalData<T>(m_data + index * sizeof(T), m_flags);
+	}
+
+	template<typename T>
+	inline void ArrayView<T>::copyTo(T* dst) const noexcept {
+		Tag::copyNumericalData<T>(dst, m_data, m_size, m_flags);
+	}
+
+	template<typename T>
+	inline std::pmr::vector<T> ArrayView<T>::toVector(std::pmr::memory_resource* resource) const {
+		std::pmr::vector<T> result(m_size, resource);
+		copyTo(result.data());
+		return result;
+	}
+
+	template<typename T>
+	inline typename ArrayView<T>::Iterator ArrayView<T>::begin() const noexcept {
+		return Iterator(m_data, m_flags);
+	}
+
+	template<typename T>
+	inline typename ArrayView<T>::Iterator ArrayView<T>::end() const noexcept {
+		return Iterator(m_data + m_size * sizeof(T), m_flags);
+	}
+
+	inline TagView::Iterator::reference TagView::Iterator::operator*() const noexcept {
+		return m_current;
+	}
+
+	inline TagView::Iterator::pointer TagView::Iterator::operator->() const noexcept {
+		return &m_current;
+	}
+
+	inline TagView::Iterator& TagView::Iterator::operator++() noexcept {
+		advance(m_next);
+		return *this;
+	}
+
+	inline TagView::Iterator TagView::Iterator::operator++(int) noexcept {
+		Iterator copy = *this;
+		++*this;
+		return copy;
+	}
+
+	inline bool TagView::Iterator::operator==(const Iterator& other) const noexcept {
+		if (m_isEnd || other.m_isEnd)
+			return m_isEnd == other.m_isEnd;
+		return m_current.m_payload == other.m_current.m_payload;
+	}
+
+	inline void TagView::Iterator::advance(const uint8_t* it) noexcept {
+		const uint8_t* end = m_current.m_end;
+		if (it == nullptr) {
+			m_isEnd = true;
+			return;
+		}
+
+		if (m_isList) {
+			m_isEnd = m_remaining-- <= 0;
+			if (!m_isEnd)
+				m_current = TagView(m_listType, it, end, m_current.m_flags);
+		} else {
+			m_current = readHeader(it, end, m_current.m_flags, false);
+			m_isEnd = m_current.m_error || m_current.type() == Type::End;
+		}
+
+		// Children whose payload runs past the end end the walk, so every view handed out is valid.
+		if (!m_isEnd) {
+			m_next = m_current.payloadEnd();
+			m_isEnd = m_next == nullptr;
+		}
+	}
+
+	inline TagView::TagView(const void* data, const void* end, SerializationFlag flags) {
+		*this = readHeader(static_cast<const uint8_t*>(data), end, flags, true);
+		if (payloadEnd() == nullptr)
+			m_error = true;
+	}
+
+	inline TagView TagView::readHeader(const uint8_t* it, const void* end, SerializationFlag flags, bool isRoot) {
+		TagView view;
+		view.m_end = static_cast<const uint8_t*>(end);
+		view.m_flags = flags;
+		view.m_error = false;
+
+		Type type = Type(Tag::readNumericalData<uint8_t>(it, end, flags, view.m_error));
+		if (view.m_error)
+			return view;
+
+		view.m_type = type;
+		if (!((type == Type::Compound && bool(flags & SerializationFlag::JavaNetwork) && isRoot) || type == Type::End)) {
+			uint16_t nameSize = Tag::readNumericalData<uint16_t>(it, end, flags, view.m_error);
+			const uint8_t* name = it;
+			Tag::skipData(it, end, nameSize, view.m_error);
+			view.m_name = std::string_view(reinterpret_cast<const char*>(name), view.m_error ? 0 : nameSize);
+			view.m_hasName = true;
+		}
+
+		view.m_payload = it;
+		return view;
+	}
+
+	inline void TagView::checkType(Type type) const {
+		if (m_type != type || m_error)
+			throw std::bad_variant_access();
+	}
+
+	inline TagView::Type TagView::type() const noexcept {
+		return m_type;
+	}
+
+	inline bool TagView::isValid() const noexcept {
+		return !m_error;
+	}
+
+	inline int8_t TagView::byteValue() const {
+		checkType(Type::Byte);
+		const uint8_t* it = m_payload;
+		bool error = false;
+		return Tag::readNumericalData<int8_t>(it, m_end, m_flags, error);
+	}
+
+	inline int16_t TagView::shortValue() const {
+		checkType(Type::Short);
+		const uint8_t* it = m_payload;
+		bool error = false;
+		return Tag::readNumericalData<int16_t>(it, m_end, m_flags, error);
+	}
+
+	inline int32_t TagView::intValue() const {
+		checkType(Type::Int);
+		const uint8_t* it = m_payload;
+		bool error = false;
+		return Tag::readNumericalData<int32_t>(it, m_end, m_flags, error);
+	}
+
+	inline int64_t TagView::longValue() const {
+		checkType(Type::Long);
+		const uint8_t* it = m_payload;
+		bool error = false;
+		return Tag::readNumericalData<int64_t>(it, m_end, m_flags, error);
+	}
+
+	inline float TagView::floatValue() const {
+		checkType(Type::Float);
+		const uint8_t* it = m_payload;
+		bool error = false;
+		return Tag::readNumericalData<float>(it, m_end, m_flags, error);
+	}
+
+	inline double TagView::doubleValue() const {
+		checkType(Type::Double);
+		const uint8_t* it = m_payload;
+		bool error = false;
+		return Tag::readNumericalData<double>(it, m_end, m_flags, error);
+	}
+
+	inline std::span<const int8_t> TagView::byteArrayValue() const {
+		checkType(Type::ByteArray);
+		const uint8_t* it = m_payload;
+		bool error = false;
+		size_t size = size_t(std::max(Tag::readNumericalData<int32_t>(it, m_end, m_flags, error), 0));
+		if (error || size > size_t(m_end - it))
+			return {};
+		return std::span<const int8_t>(reinterpret_cast<const int8_t*>(it), size);
+	}
+
+	inline std::string_view TagView::stringValue() const {
+		checkType(Type::String);
+		const uint8_t* it = m_payload;
+		bool error = false;
+		size_t size = Tag::readNumericalData<uint16_t>(it, m_end, m_flags, error);
+		if (error || size > size_t(m_end - it))
+			return {};
+		return std::string_view(reinterpret_cast<const char*>(it), size);
+	}
+
+	inline TagView::Children TagView::listValue() const {
+		checkType(Type::List);
+		return children();
+	}
+
+	inline TagView::Children TagView::compoundValue() const {
+		checkType(Type::Compound);
+		return children();
+	}
+
+	inline ArrayView<int32_t> TagView::intArrayValue() const {
+		checkType(Type::IntArray);
+		const uint8_t* it = m_payload;
+		bool error = false;
+		size_t size = size_t(std::max(Tag::readNumericalData<int32_t>(it, m_end, m_flags, error), 0));
+		if (error || Tag::isVarInt(m_flags) || size > size_t(m_end - it) / sizeof(int32_t))
+			return {};
+		return ArrayView<int32_t>(it, size, m_flags);
+	}
+
+	inline ArrayView<int64_t> TagView::longArrayValue() const {
+		checkType(Type::LongArray);
+		const uint8_t* it = m_payload;
+		bool error = false;
+		size_t size = size_t(std::max(Tag::readNumericalData<int32_t>(it, m_end, m_flags, error), 0));
+		if (error || Tag::isVarInt(m_flags) || size > size_t(m_end - it) / sizeof(int64_t))
+			return {};
+		return ArrayView<int64_t>(it, size, m_flags);
+	}
+
+	inline size_t TagView::listSize() const {
+		checkType(Type::List);
+		// Elements of End take no input, so such a list is empty whatever length it claims.
+		if (listType() == Type::End)
+			return 0;
+		const uint8_t* it = m_payload + 1;
+		bool error = false;
+		return size_t(std::max(Tag::readNumericalData<int32_t>(it, m_end, m_flags, error), 0));
+	}
+
+	inline TagView::Type TagView::listType() const {
+		checkType(Type::List);
+		return m_payload == m_end ? Type::End : Type(*m_payload);
+	}
+
+	inline TagView::Children TagView::children() const noexcept {
+		Children children;
+		Iterator& it = children.m_begin;
+		it.m_current.m_end = m_end;
+		it.m_current.m_flags = m_flags;
+
+		const uint8_t* data = m_payload;
+		bool error = false;
+		if (m_type == Type::List) {
+			it.m_isList = true;
+			it.m_listType = Type(Tag::readNumericalData<uint8_t>(data, m_end, m_flags, error));
+			it.m_remaining = Tag::readNumericalData<int32_t>(data, m_end, m_flags, error);
+			if (it.m_listType == Type::End)
+				it.m_remaining = 0;
+		}
+
+		it.advance(error ? nullptr : data);
+		return children;
+	}
+
+	inline std::string_view TagView::name() const noexcept {
+		return m_name;
+	}
+
+	inline bool TagView::hasName() const noexcept {
+		return m_hasName;
+	}
+
+	inline const uint8_t* TagView::payloadEnd() const noexcept {
+		if (m_error)
+			return nullptr;
+
+		const uint8_t* it = m_payload;
+		bool error = false;
+		Tag::skipPayload(m_type, it, m_end, m_flags, error);
+		return error ? nullptr : it;
+	}
+
+	inline Tag TagView::toTag(std::pmr::memory_resource* resource) const {
+		Tag tag;
+		if (m_hasName)
+			tag.setNameEntry(NameTable::acquire(m_name));
+
+		if (m_error) {
+			tag.setError();
+		} else {
+			Tag::BufferInput in{ m_payload, m_end };
+			Tag::Budget budget{ DeserializeLimits{} };
+			Tag::deserializePayload(tag, m_type, in, m_flags, budget, resource);
+		}
+		return tag;
+	}
+
+	inline Query::Query(std::string_view path) {
+		auto fail = [&](const char* what) {
+			throw std::invalid_argument("nbt::Query: " + std::string(what) + " in \"" + std::string(path) + "\"");
+		};
+
+		size_t i = 0;
+		bool expectMember = true;
+		while (i < path.size()) {
+			if (path[i] == '[') {
+				size_t close = path.find(']', i);
+				if (close == std::string_view::npos)
+					fail("unterminated '['");
+
+				std::string_view index = path.substr(i + 1, close - i - 1);
+				if (index == "*") {
+					m_steps.push_back({ StepKind::AnyElement });
+				} else {
+					Step step{ StepKind::Element };
+					if (index.empty() || index.find_first_not_of("0123456789") != std::string_view::npos)
+						fail("invalid list index");
+					if (std::from_chars(index.data(), index.data() + index.size(), step.index).ec != std::errc())
+						fail("list index out of range");
+					m_steps.push_back(std::move(step));
+				}
+
+				i = close + 1;
+				expectMember = false;
+				continue;
+			}
+
+			if (!expectMember) {
+				if (path[i] != '.')
+					fail("expected '.' or '['");
+				++i;
+			}
+			expectMember = false;
+
+			Step step{ StepKind::Member };
+			if (i < path.size() && path[i] == '"') {
+				for (++i; i < path.size() && path[i] != '"'; ++i) {
+					if (path[i] == '\\' && ++i == path.size())
+						break;
+					step.name += path[i];
+				}
+				if (i++ >= path.size())
+					fail("unterminated quoted name");
+			} else {
+				size_t nameEnd = std::min(path.find_first_of(".[", i), path.size());
+				step.name = path.substr(i, nameEnd - i);
+				if (step.name.empty())
+					fail("empty member name");
+				if (step.name == "*")
+					step.kind = StepKind::AnyMember;
+				i = nameEnd;
+			}
+			m_steps.push_back(std::move(step));
+		}
+	}
+
+	template<typename Callback>
+	inline bool Query::forEach(const void* data, const void* end, Callback&& callback, SerializationFlag flags) const {
+		// Only the header: the public constructor would validate the whole document up front.
+		TagView root = TagView::readHeader(static_cast<const uint8_t*>(data), end, flags, true);
+		if (root.m_error)
+			return false;
+		return match(root, 0, callback);
+	}
+
+	inline std::vector<TagView> Query::select(const void* data, const void* end, SerializationFlag flags) const {
+		std::vector<TagView> matches;
+		forEach(data, end, [&](const TagView& view) { matches.push_back(view); }, flags);
+		return matches;
+	}
+
+	inline std::vector<Tag> Query::extract(const void* data, const void* end, SerializationFlag flags, std::pmr::memory_resource* resource) const {
+		std::vector<Tag> matches;
+		forEach(data, end, [&](const TagView& view) { matches.push_back(view.toTag(resource)); }, flags);
+		return matches;
+	}
+
+	template<typename Callback>
+	inline bool Query::match(const TagView& view, size_t step, Callback& callback) const {
+		if (step == m_steps.size()) {
+			// Views are read lazily on the way down, so check the match before handing it out.
+			if (view.payloadEnd() == nullptr)
+				return false;
+			callback(view);
+			return true;
+		}
+
+		const Step& current = m_steps[step];
+		const uint8_t* it = view.m_payload;
+		const uint8_t* end = view.m_end;
+		SerializationFlag flags = view.m_flags;
+
+		if (current.kind == StepKind::Member || current.kind == StepKind::AnyMember) {
+			if (view.type() != Tag::Type::Compound)
+				return true;
+
+			while (true) {
+				TagView child = TagView::readHeader(it, end, flags, false);
+				if (child.m_error)
+					return false;
+				if (child.type() == Tag::Type::End)
+					return true;
+
+				if (current.kind == StepKind::AnyMember || child.name() == current.name) {
+					if (!match(child, step + 1, callback))
+						return false;
+					// Member names are unique, so the rest of the compound can be left unread.
+					if (current.kind == StepKind::Member)
+						return true;
+				}
+
+				it = child.payloadEnd();
+				if (it == nullptr)
+					return false;
+			}
+		}
+
+		if (view.type() != Tag::Type::List)
+			return true;
+
+		bool error = false;
+		Tag::Type elementType = Tag::Type(Tag::readNumericalData<uint8_t>(it, end, flags, error));
+		size_t size = size_t(std::max(Tag::readNumericalData<int32_t>(it, end, flags, error), 0));
+		if (error)
+			return false;
+
+		// Elements of End take no input, so however many a list claims it has none to match.
+		if (elementType == Tag::Type::End)
+			size = 0;
+
+		size_t first = 0;
+		if (current.kind == StepKind::Element) {
+			if (current.index >= size)
+				return true;
+
+			if (size_t elementSize = Tag::fixedPayloadSize(elementType, flags); elementSize != 0)
+				Tag::skipData(it, end, current.index * elementSize, error);
+			else
+				for (size_t i = 0; i < current.index && !error; ++i)
+					Tag::skipPayload(elementType, it, end, flags, error);
+
+			if (error)
+				return false;
+			first = current.index;
+			size = current.index + 1;
+		}
+
+		for (size_t i = first; i < size; ++i) {
+			TagView element(elementType, it, end, flags);
+			if (!match(element, step + 1, callback))
+				return false;
+			if (i + 1 < size && (it = element.payloadEnd()) == nullptr)
+				return false;
+		}
+		return true;
+	}
+
+	inline TagIndex::TagIndex(const void* data, const void* end, SerializationFlag flags) :
+		m_data(static_cast<const uint8_t*>(data)), m_size(size_t(static_cast<const uint8_t*>(end) - static_cast<const uint8_t*>(data))), m_flags(flags) {
+		bool error = m_size > UINT32_MAX;
+		const uint8_t* it = m_data;
+		Tag::Type type = Tag::Type(Tag::readNumericalData<uint8_t>(it, end, flags, error));
+		if (!error && type != Tag::Type::End && !(type == Tag::Type::Compound && bool(flags & SerializationFlag::JavaNetwork)))
+			Tag::skipData(it, end, Tag::readNumericalData<uint16_t>(it, end, flags, error), error);
+
+		if (!error)
+			indexPayload(type, npos, m_data, it, error);
+
+		if (error) {
+			m_entries.clear();
+			m_children.clear();
+		}
+	}
+
+	inline void TagIndex::indexPayload(Tag::Type type, Node parent, const uint8_t* header, const uint8_t*& it, bool& error, size_t depth) {
+		const uint8_t* end = m_data + m_size;
+		if ((type == Tag::Type::List || type == Tag::Type::Compound) && depth >= Tag::MaxDepth) {
+			error = true;
+			return;
+		}
+
+		Node node = Node(m_entries.size());
+		m_entries.push_back({ offset(header), offset(it), 0, 0, parent, 0, 0, type });
+
+		if (type == Tag::Type::List) {
+			Tag::Type elementType = Tag::Type(Tag::readNumericalData<uint8_t>(it, end, m_flags, error));
+			size_t size = size_t(std::max(Tag::readNumericalData<int32_t>(it, end, m_flags, error), 0));
+
+			// Lists of End carry no payload, so there is nothing to index however long they claim to be.
+			if (elementType == Tag::Type::End)
+				size = 0;
+			for (size_t i = 0; i < size && !error; ++i)
+				indexPayload(elementType, node, it, it, error, depth + 1);
+		} else if (type == Tag::Type::Compound) {
+			while (!error) {
+				const uint8_t* child = it;
+				Tag::Type childType = Tag::Type(Tag::readNumericalData<uint8_t>(it, end, m_flags, error));
+				if (error || childType == Tag::Type::End)
+					break;
+
+				Tag::skipData(it, end, Tag::readNumericalData<uint16_t>(it, end, m_flags, error), error);
+				if (!error)
+					indexPayload(childType, node, child, it, error, depth + 1);
+			}
+		} else {
+			Tag::skipPayload(type, it, end, m_flags, error);
+		}
+
+		if (error)
+			return;
+
+		Entry& entry = m_entries[node];
+		entry.end = offset(it);
+		entry.next = Node(m_entries.size());
+		if (type != Tag::Type::List && type != Tag::Type::Compound)
+			return;
+
+		entry.children = uint32_t(m_children.size());
+		for (Node child = node + 1; child < entry.next; child = m_entries[child].next)
+			m_children.push_back(child);
+		entry.childCount = uint32_t(m_children.size() - entry.children);
+
+		if (type == Tag::Type::Compound) {
+			m_children.resize(m_children.size() + entry.childCount);
+			std::copy_n(m_children.begin() + entry.children, entry.childCount, m_children.end() - entry.childCount);
+			std::stable_sort(m_children.end() - entry.childCount, m_children.end(), [this](Node a, Node b) {
+				return name(a) < name(b);
+			});
+		}
+	}
+
+	inline uint32_t TagIndex::offset(const uint8_t* it) const noexcept {
+		return uint32_t(it - m_data);
+	}
+
+	inline bool TagIndex::isValid() const noexcept {
+		return !m_entries.empty();
+	}
+
+	inline size_t TagIndex::size() const noexcept {
+		return m_entries.size();
+	}
+
+	inline TagIndex::Node TagIndex::root() const noexcept {
+		return m_entries.empty() ? npos : 0;
+	}
+
+	inline Tag::Type TagIndex::type(Node node) const {
+		return m_entries.at(node).type;
+	}
+
+	inline std::string_view TagIndex::name(Node node) const {
+		const Entry& entry = m_entries.at(node);
+		if (!hasName(node))
+			return {};
+
+		// The name runs up to the payload, after the type byte and a length of two bytes or,
+		// with SerializationFlag::VarInt, one to three.
+		const uint8_t* it = m_data + entry.header + 1 + sizeof(uint16_t);
+		if (Tag::isVarInt(m_flags)) {
+			bool error = false;
+			it = m_data + entry.header + 1;
+			Tag::readNumericalData<uint16_t>(it, m_data + entry.payload, m_flags, error);
+		}
+		return std::string_view(reinterpret_cast<const char*>(it), size_t(m_data + entry.payload - it));
+	}
+
+	inline bool TagIndex::hasName(Node node) const {
+		const Entry& entry = m_entries.at(node);
+		return entry.payload - entry.header >= (Tag::isVarInt(m_flags) ? 2 : 3);
+	}
+
+	inline TagIndex::Node TagIndex::parent(Node node) const {
+		return m_entries.at(node).parent;
+	}
+
+	inline TagIndex::Node TagIndex::nextSibling(Node node) const {
+		const Entry& entry = m_entries.at(node);
+		if (entry.parent == npos || entry.next == m_entries[entry.parent].next)
+			return npos;
+		return entry.next;
+	}
+
+	inline TagIndex::Node TagIndex::skip(Node node) const {
+		return m_entries.at(node).next;
+	}
+
+	inline size_t TagIndex::childCount(Node node) const {
+		return m_entries.at(node).childCount;
+	}
+
+	inline TagIndex::Node TagIndex::child(Node node, size_t position) const {
+		const Entry& entry = m_entries.at(node);
+		return position < entry.childCount ? m_children[entry.children + position] : npos;
+	}
+
+	inline TagIndex::Node TagIndex::find(Node compound, std::string_view name) const {
+		const Entry& entry = m_entries.at(compound);
+		if (entry.type != Tag::Type::Compound)
+			return npos;
+
+		auto begin = m_children.begin() + entry.children + entry.childCount;
+		auto end = begin + entry.childCount;
+		auto it = std::lower_bound(begin, end, name, [this](Node node, std::string_view name) {
+			return this->name(node) < name;
+		});
+		return it != end && this->name(*it) == name ? *it : npos;
+	}
+
+	inline TagView TagIndex::view(Node node) const {
+		const Entry& entry = m_entries.at(node);
+		if (entry.header == entry.payload)
+			return TagView(entry.type, m_data + entry.payload, m_data + m_size, m_flags);
+		return TagView::readHeader(m_data + entry.header, m_data + m_size, m_flags, node == 0);
+	}
+
+	inline Tag TagIndex::toTag(Node node, std::pmr::memory_resource* resource) const {
+		return view(node).toTag(resource);
+	}
+
+	inline std::span<const uint8_t> TagIndex::bytes(Node node) const {
+		const Entry& entry = m_entries.at(node);
+		return std::span<const uint8_t>(m_data + entry.header, entry.end - entry.header);
+	}
+
+	inline std::span<const uint8_t> TagIndex::payload(Node node) const {
+		const Entry& entry = m_entries.at(node);
+		return std::span<const uint8_t>(m_data + entry.payload, entry.end - entry.payload);
+	}
+
+	inline bool Tag::serialize(StreamOutput& out, SerializationFlag flags) const {
+#ifdef NBT_WITH_STATS
+		// The stream does not count what passes through it, so size the output up front,
+		// outside the timed span.
+		size_t size = serializedSize(flags);
+		Stats::Scope scope(Stats::Operation::Serialize);
+#endif
+		serialize(out, flags, isRootNameHidden(flags));
+#ifdef NBT_WITH_STATS
+		scope.finish(size, out.isValid());
+#endif
+		return out.isValid();
+	}
+
+	inline Tag Tag::deserialize(StreamInput& in, SerializationFlag flags, std::pmr::memory_resource* resource) {
+		return deserialize(in, flags, DeserializeLimits{}, resource);
+	}
+
+	inline Tag Tag::deserialize(StreamInput& in, SerializationFlag flags, const DeserializeLimits& limits, std::pmr::memory_resource* resource) {
+#ifdef NBT_WITH_STATS
+		Stats::Scope scope(Stats::Operation::Deserialize);
+#endif
+		Budget budget(limits);
+		Tag tag = deserialize(in, flags, false, true, budget, resource);
+#ifdef NBT_WITH_STATS
+		scope.finish(tag.isValid());
+#endif
+		return tag;
+	}
+
+	inline const Data& Tag::serialize(SerializationCache& cache, SerializationFlag flags) const {
+		if (!isShared() || flags != cache.m_flags)
+			cache.clear();
+		cache.m_flags = flags;
+
+		cache.m_nextEntries.clear();
+
+#ifdef NBT_WITH_STATS
+		Stats::Scope scope(Stats::Operation::Serialize);
+#endif
+		DataOutput out{ cache.m_next };
+		serializeHeader(out, flags, isRootNameHidden(flags));
+		cache.writePayload(*this, out);
+		cache.m_next.resize(out.size);
+#ifdef NBT_WITH_STATS
+		scope.finish(out.size, true);
+#endif
+
+		std::swap(cache.m_data, cache.m_next);
+		std::swap(cache.m_entries, cache.m_nextEntries);
+		if (isShared()) {
+			cache.m_tree = *this;
+			cache.buildTable();
+		} else {
+			cache.m_entries.clear();
+			cache.m_table.clear();
+		}
+		return cache.m_data;
+	}
+
+	inline void SerializationCache::clear() {
+		m_tree = Tag::End();
+		m_data.clear();
+		m_entries.clear();
+		m_table.clear();
+	}
+
+	inline void SerializationCache::writePayload(const Tag& tag, Tag::DataOutput& out) {
+		const Tag::SharedValue* shared = std::get_if<Tag::SharedIndex>(&tag.m_value);
+		const void* node = shared == nullptr ? nullptr : shared->node;
+		if (node == nullptr) {
+			tag.serializePayload(out, m_flags);
+			return;
+		}
+
+		const Entry* cached = find(node);
+		if (cached != nullptr) {
+			// Reuse the bytes and keep the entries of the subtree for the next round.
+			size_t offset = out.size;
+			out.write(m_data.data() + cached->offset, cached->size);
+
+			uint32_t first = uint32_t(cached - m_entries.data());
+			uint32_t shift = uint32_t(m_nextEntries.size()) - first;
+			for (uint32_t i = first; i < cached->end; ++i) {
+				Entry entry = m_entries[i];
+				entry.offset = entry.offset - cached->offset + offset;
+				entry.end += shift;
+				m_nextEntries.push_back(entry);
+			}
+			return;
+		}
+
+		size_t index = m_nextEntries.size();
+		m_nextEntries.push_back({ node, out.size, 0, 0 });
+
+		if (tag.type() == Tag::Type::List || tag.type() == Tag::Type::Compound)
+			tag.serializeContainer(out, m_flags, [&](const Tag& child) { writePayload(child, out); });
+		else
+			tag.serializePayload(out, m_flags);
+
+		m_nextEntries[index].size = out.size - m_nextEntries[index].offset;
+		m_nextEntries[index].end = uint32_t(m_nextEntries.size());
+	}
+
+	inline const SerializationCache::Entry* SerializationCache::find(const void* node) const noexcept {
+		if (m_table.empty())
+			return nullptr;
+
+		size_t mask = m_table.size() - 1;
+		for (size_t slot = hashNode(node) & mask; m_table[slot] != 0; slot = (slot + 1) & mask) {
+			const Entry& entry = m_entries[m_table[slot] - 1];
+			if (entry.node == node)
+				return &entry;
+		}
+		return nullptr;
+	}
+
+	inline void SerializationCache::buildTable() {
+		m_table.assign(std::bit_ceil(m_entries.size() * 2 + 1), 0);
+
+		// A node the tree holds twice keeps its first entry.
+		size_t mask = m_table.size() - 1;
+		for (uint32_t i = 0; i < m_entries.size(); ++i) {
+			size_t slot = hashNode(m_entries[i].node) & mask;
+			for (; m_table[slot] != 0; slot = (slot + 1) & mask) {
+				if (m_entries[m_table[slot] - 1].node == m_entries[i].node)
+					break;
+			}
+			if (m_table[slot] == 0)
+				m_table[slot] = i + 1;
+		}
+	}
+
+	inline size_t SerializationCache::hashNode(const void* node) noexcept {
+		return size_t((uint64_t(reinterpret_cast<uintptr_t>(node)) >> 4) * 0x9e3779b97f4a7c15ull >> 32);
+	}
+
+	template<typename T>
+	struct SchemaCodec::Traits {
+		using Element = void;
+		static constexpr bool isSequence = false;
+		static constexpr bool isOptional = false;
+	};
+
+	template<typename E, typename A>
+	struct SchemaCodec::Traits<std::vector<E, A>> {
+		using Element = E;
+		static constexpr bool isSequence = true;
+		static constexpr bool isOptional = false;
+		static constexpr size_t size = 0;
+	};
+
+	template<typename E, size_t N>
+	struct SchemaCodec::Traits<std::array<E, N>> {
+		using Element = E;
+		static constexpr bool isSequence = true;
+		static constexpr bool isOptional = false;
+		static constexpr size_t size = N;
+	};
+
+	template<typename E>
+	struct SchemaCodec::Traits<std::optional<E>> {
+		using Element = E;
+		static constexpr bool isSequence = false;
+		static constexpr bool isOptional = true;
+	};
+
+	template<typename T>
+	inline constexpr Tag::Type SchemaCodec::tagType() noexcept {
+		using Element = typename Traits<T>::Element;
+		if constexpr (std::is_same_v<T, bool> || std::is_same_v<T, int8_t>) return Tag::Type::Byte;
+		else if constexpr (std::is_same_v<T, int16_t>) return Tag::Type::Short;
+		else if constexpr (std::is_same_v<T, int32_t>) return Tag::Type::Int;
+		else if constexpr (std::is_same_v<T, int64_t>) return Tag::Type::Long;
+		else if constexpr (std::is_same_v<T, float>) return Tag::Type::Float;
+		else if constexpr (std::is_same_v<T, double>) return Tag::Type::Double;
+		else if constexpr (std::is_same_v<T, std::string> || std::is_same_v<T, std::pmr::string>) return Tag::Type::String;
+		else if constexpr (Traits<T>::isSequence && std::is_same_v<Element, int8_t>) return Tag::Type::ByteArray;
+		else if constexpr (Traits<T>::isSequence && std::is_same_v<Element, int32_t>) return Tag::Type::IntArray;
+		else if constexpr (Traits<T>::isSequence && std::is_same_v<Element, int64_t>) return Tag::Type::LongArray;
+		else if constexpr (Traits<T>::isSequence) return Tag::Type::List;
+		else if constexpr (requires { Schema<T>::fields; }) return Tag::Type::Compound;
+		else static_assert(sizeof(T) == 0, "nbt::Schema: no tag type for this member type");
+	}
+
+	template<typename T>
+	inline bool decode(const void* data, const void* end, T& value, SerializationFlag flags) {
+		return SchemaCodec::decodeDocument(data, end, value, flags);
+	}
+
+	template<typename T>
+	inline Data encode(const T& value, SerializationFlag flags) {
+		Data data;
+		encode(data, value, flags);
+		return data;
+	}
+
+	template<typename T>
+	inline void encode(Data& data, const T& value, SerializationFlag flags) {
+		SchemaCodec::encodeDocument(data, value, flags);
+	}
+
+	template<typename T>
+	inline bool SchemaCodec::decodeDocument(const void* data, const void* end, T& value, SerializationFlag flags) {
+		const uint8_t* it = static_cast<const uint8_t*>(data);
+		bool error = false;
+		if (Tag::Type(Tag::readNumericalData<uint8_t>(it, end, flags, error)) != Tag::Type::Compound || error)
+			return false;
+
+		if (!bool(flags & SerializationFlag::JavaNetwork)) {
+			uint16_t nameSize = Tag::readNumericalData<uint16_t>(it, end, flags, error);
+			Tag::skipData(it, end, nameSize, error);
+			if (error)
+				return false;
+		}
+		return readCompound(it, end, value, flags);
+	}
+
+	template<typename T>
+	inline void SchemaCodec::encodeDocument(Data& data, const T& value, SerializationFlag flags) {
+		Tag::DataOutput out{ data, data.size() };
+		Tag::writeNumericalData(out, uint8_t(Tag::Type::Compound), flags);
+		if (!bool(flags & SerializationFlag::JavaNetwork))
+			Tag::writeNumericalData(out, uint16_t(0), flags);
+		writeCompound(out, value, flags);
+		data.resize(out.size);
+	}
+
+	template<typename T>
+	inline bool SchemaCodec::readPayload(const uint8_t*& it, const void* end, T& value, SerializationFlag flags) {
+		bool error = false;
+		constexpr Tag::Type type = tagType<T>();
+		if constexpr (type == Tag::Type::Compound) {
+			return readCompound(it, end, value, flags);
+		} else if constexpr (std::is_same_v<T, bool>) {
+			value = Tag::readNumericalData<int8_t>(it, end, flags, error) != 0;
+		} else if constexpr (std::is_arithmetic_v<T>) {
+			value = Tag::readNumericalData<T>(it, end, flags, error);
+		} else if constexpr (type == Tag::Type::String) {
+			uint16_t size = Tag::readNumericalData<uint16_t>(it, end, flags, error);
+			const uint8_t* chars = it;
+			Tag::skipData(it, end, size, error);
+			if (!error)
+				value.assign(reinterpret_cast<const char*>(chars), size);
+		} else {
+			using Element = typename Traits<T>::Element;
+			Tag::Type elementType = tagType<Element>();
+			if constexpr (type == Tag::Type::List) {
+				elementType = Tag::Type(Tag::readNumericalData<uint8_t>(it, end, flags, error));
+			}
+
+			// Every element takes at least one byte, which bounds the length before allocating.
+			int32_t size = Tag::readNumericalData<int32_t>(it, end, flags, error);
+			size_t remaining = size_t(static_cast<const uint8_t*>(end) - it);
+			if (error || size < 0 || size_t(size) > remaining)
+				return false;
+			if (size != 0 && elementType != tagType<Element>())
+				return false;
+
+			if constexpr (Traits<T>::size == 0) {
+				value.resize(size_t(size));
+			} else if (size_t(size) != Traits<T>::size) {
+				return false;
+			}
+
+			if constexpr (type == Tag::Type::List) {
+				for (auto& element : value) {
+					if (!readPayload(it, end, element, flags))
+						return false;
+				}
+			} else if (Tag::IsVarIntType<Element> && Tag::isVarInt(flags)) {
+				for (auto& element : value)
+					element = Tag::readNumericalData<Element>(it, end, flags, error);
+			} else {
+				const uint8_t* values = it;
+				Tag::skipData(it, end, size_t(size) * sizeof(Element), error);
+				if (!error)
+					Tag::copyNumericalData<Element>(value.data(), values, size_t(size), flags);
+			}
+		}
+		return !error;
+	}
+
+	template<typename T>
+	inline bool SchemaCodec::readCompound(const uint8_t*& it, const void* end, T& value, SerializationFlag flags) {
+		constexpr auto& fields = Schema<T>::fields;
+		constexpr size_t count = std::tuple_size_v<std::remove_cvref_t<decltype(fields)>>;
+		std::array<bool, count> seen{};
+
+		bool error = false;
+		while (true) {
+			Tag::Type type = Tag::Type(Tag::readNumericalData<uint8_t>(it, end, flags, error));
+			if (error)
+				return false;
+			if (type == Tag::Type::End)
+				break;
+
+			uint16_t nameSize = Tag::readNumericalData<uint16_t>(it, end, flags, error);
+			std::string_view name(reinterpret_cast<const char*>(it), error ? 0 : nameSize);
+			Tag::skipData(it, end, nameSize, error);
+			if (error)
+				return false;
+
+			// The field list is known at compile time, so this unrolls into one comparison and
+			// one specialized reader per field.
+			bool isKnown = false;
+			bool isRead = [&]<size_t... I>(std::index_sequence<I...>) {
+				return ((name == std::get<I>(fields).name ? (isKnown = true, seen[I] = true, readField<T, I>(type, it, end, value, flags)) : false) || ...);
+			}(std::make_index_sequence<count>());
+
+			if (!isKnown) {
+				Tag::skipPayload(type, it, end, flags, error);
+				if (error)
+					return false;
+			} else if (!isRead) {
+				return false;
+			}
+		}
+
+		return [&]<size_t... I>(std::index_sequence<I...>) {
+			auto check = [&](auto& member, bool isSeen) {
+				if constexpr (Traits<std::remove_cvref_t<decltype(member)>>::isOptional) {
+					if (!isSeen)
+						member.reset();
+					return true;
+				} else {
+					return isSeen;
+				}
+			};
+			return (check(value.*(std::get<I>(fields).member), seen[I]) && ...);
+		}(std::make_index_sequence<count>());
+	}
+
+	template<typename T, size_t I>
+	inline bool SchemaCodec::readField(Tag::Type type, const uint8_t*& it, const void* end, T& value, SerializationFlag flags) {
+		auto& member = value.*(std::get<I>(Schema<T>::fields).member);
+		using Member = std::remove_cvref_t<decltype(member)>;
+		if constexpr (Traits<Member>::isOptional) {
+			if (type != tagType<typename Traits<Member>::Element>())
+				return false;
+			return readPayload(it, end, member.emplace(), flags);
+		} else {
+			if (type != tagType<Member>())
+				return false;
+			return readPayload(it, end, member, flags);
+		}
+	}
+
+	template<typename T>
+	inline void SchemaCodec::writePayload(Tag::DataOutput& out, const T& value, SerializationFlag flags) {
+		constexpr Tag::Type type = tagType<T>();
+		if constexpr (type == Tag::Type::Compound) {
+			writeCompound(out, value, flags);
+		} else if constexpr (std::is_same_v<T, bool>) {
+			Tag::writeNumericalData(out, int8_t(value), flags);
+		} else if constexpr (std::is_arithmetic_v<T>) {
+			Tag::writeNumericalData(out, value, flags);
+		} else if constexpr (type == Tag::Type::String) {
+			Tag::writeNumericalData(out, uint16_t(value.size()), flags);
+			out.write(value.data(), value.size());
+		} else if constexpr (type == Tag::Type::List) {
+			// Empty lists are written as lists of End, like Tag does.
+			Tag::writeNumericalData(out, uint8_t(value.empty() ? Tag::Type::End : tagType<typename Traits<T>::Element>()), flags);
+			Tag::writeNumericalData(out, int32_t(value.size()), flags);
+			for (const auto& element : value)
+				writePayload(out, element, flags);
+		} else {
+			Tag::writeNumericalData(out, int32_t(value.size()), flags);
+			Tag::writeArrayData(out, value.data(), value.size(), flags);
+		}
+	}
+
+	template<typename T>
+	inline void SchemaCodec::writeCompound(Tag::DataOutput& out, const T& value, SerializationFlag flags) {
+		std::apply([&](const auto&... fields) {
+			(writeField(out, fields.name, value.*(fields.member), flags), ...);
+		}, Schema<T>::fields);
+		Tag::writeNumericalData(out, uint8_t(Tag::Type::End), flags);
+	}
+
+	template<typename M>
+	inline void SchemaCodec::writeField(Tag::DataOutput& out, std::string_view name, const M& member, SerializationFlag flags) {
+		if constexpr (Traits<M>::isOptional) {
+			if (member.has_value())
+				writeField(out, name, *member, flags);
+		} else {
+			Tag::writeNumericalData(out, uint8_t(tagType<M>()), flags);
+			Tag::writeNumericalData(out, uint16_t(name.size()), flags);
+			out.write(name.data(), name.size());
+			writePayload(out, member, flags);
+		}
+	}
+
+	inline size_t packedLength(size_t count, unsigned bits, PackedLayout layout) noexcept {
+		if (bits == 0 || bits > 16)
+			return 0;
+		if (layout == PackedLayout::Spanning)
+			return (count * bits + 63) / 64;
+
+		size_t perLong = 64 / bits;
+		return (count + perLong - 1) / perLong;
+	}
+
+	inline bool unpackBits(std::span<const int64_t> src, unsigned bits, PackedLayout layout, std::span<uint16_t> dst) noexcept {
+		return BitPacking::unpack(reinterpret_cast<const uint8_t*>(src.data()), src.size(), std::endian::native == std::endian::big, bits, layout, dst);
+	}
+
+	inline bool unpackBits(ArrayView<int64_t> src, unsigned bits, PackedLayout layout, std::span<uint16_t> dst) noexcept {
+		return BitPacking::unpack(src, bits, layout, dst);
+	}
+
+	inline bool packBits(std::span<const uint16_t> src, unsigned bits, PackedLayout layout, std::span<int64_t> dst) noexcept {
+		return BitPacking::pack(src, bits, layout, dst);
+	}
+
+	inline bool packBits(std::span<const uint16_t> src, unsigned bits, PackedLayout layout, std::pmr::vector<int64_t>& dst) {
+		if (bits == 0 || bits > 16)
+			return false;
+		dst.resize(packedLength(src.size(), bits, layout));
+		return packBits(src, bits, layout, std::span<int64_t>(dst));
+	}
+
+	inline BitPacking::Pattern::Pattern(unsigned bits, PackedLayout layout) noexcept : mask((1u << bits) - 1) {
+		if (layout == PackedLayout::Spanning) {
+			// 64 indices fill exactly `bits` longs.
+			entries = 64;
+			bytes = bits * sizeof(int64_t);
+			for (size_t i = 0; i < entries; ++i) {
+				offsets[i] = uint32_t(i * bits / 8);
+				shifts[i] = uint32_t(i * bits % 8);
+			}
+		} else {
+			// A whole number of longs that also makes a whole number of vectors of 8 indices.
+			size_t perLong = 64 / bits;
+			entries = std::lcm(perLong, size_t(8));
+			bytes = entries / perLong * sizeof(int64_t);
+			for (size_t i = 0; i < entries; ++i) {
+				offsets[i] = uint32_t(i / perLong * sizeof(int64_t) + i % perLong * bits / 8);
+				shifts[i] = uint32_t(i % perLong * bits % 8);
+			}
+		}
+	}
+
+	// Converts the longs a block at a time into little-endian order in a small buffer, with
+	// zeroed padding so the last index can be read as a full word, and unpacks from there.
+	inline bool BitPacking::unpack(const uint8_t* src, size_t length, bool isBigEndian, unsigned bits, PackedLayout layout, std::span<uint16_t> dst) noexcept {
+		size_t required = packedLength(dst.size(), bits, layout);
+		if (bits == 0 || bits > 16 || length < required)
+			return false;
+
+		Pattern pattern(bits, layout);
+		size_t periods = BlockSize / pattern.bytes;
+		alignas(32) uint8_t block[BlockSize + sizeof(uint64_t)];
+		for (size_t done = 0, read = 0; done < dst.size();) {
+			size_t entries = std::min(periods * pattern.entries, dst.size() - done);
+			size_t bytes = std::min(periods * pattern.bytes, (required - read) * sizeof(int64_t));
+			if (isBigEndian)
+				Tag::byteSwapData<sizeof(int64_t)>(block, src + read * sizeof(int64_t), bytes / sizeof(int64_t));
+			else
+				memcpy(block, src + read * sizeof(int64_t), bytes);
+			memset(block + bytes, 0, sizeof(uint64_t));
+
+			for (size_t i = 0; i < entries; i += pattern.entries)
+				unpackPeriod(block + i / pattern.entries * pattern.bytes, pattern, dst.data() + done + i, std::min(pattern.entries, entries - i));
+			done += entries;
+			read += bytes / sizeof(int64_t);
+		}
+		return true;
+	}
+
+	inline bool BitPacking::unpack(ArrayView<int64_t> src, unsigned bits, PackedLayout layout, std::span<uint16_t> dst) noexcept {
+		return unpack(src.m_data, src.m_size, !bool(src.m_flags & SerializationFlag::LittleEndian), bits, layout, dst);
+	}
+
+	// Packing writes each long once from a 64 bit accumulator; unlike unpacking there is no
+	// byte order to fix up, as `dst` holds native longs.
+	inline bool BitPacking::pack(std::span<const uint16_t> src, unsigned bits, PackedLayout layout, std::span<int64_t> dst) noexcept {
+		size_t length = packedLength(src.size(), bits, layout);
+		if (bits == 0 || bits > 16 || dst.size() < length)
+			return false;
+
+		uint16_t used = 0;
+		for (uint16_t index : src)
+			used |= index;
+		if ((uint32_t(used) >> bits) != 0)
+			return false;
+
+		if (layout == PackedLayout::Padded) {
+			size_t perLong = 64 / bits;
+			for (size_t i = 0, index = 0; i < length; ++i) {
+				uint64_t value = 0;
+				size_t end = std::min(index + perLong, src.size());
+				for (unsigned shift = 0; index < end; ++index, shift += bits)
+					value |= uint64_t(src[index]) << shift;
+				dst[i] = int64_t(value);
+			}
+		} else {
+			uint64_t value = 0;
+			unsigned filled = 0;
+			size_t i = 0;
+			for (uint16_t index : src) {
+				value |= uint64_t(index) << filled;
+				filled += bits;
+				if (filled >= 64) {
+					dst[i++] = int64_t(value);
+					filled -= 64;
+					value = filled ? uint64_t(index) >> (bits - filled) : 0;
+				}
+			}
+			if (filled)
+				dst[i] = int64_t(value);
+		}
+		return true;
+	}
+
+	inline void BitPacking::unpackPeriod(const uint8_t* src, const Pattern& pattern, uint16_t* dst, size_t count) noexcept {
+		size_t i = 0;
+
+#if defined(__AVX2__)
+		// Eight indices at a time: gather the words at their offsets, shift each by its own
+		// amount and narrow to 16 bits.
+		const __m256i mask = _mm256_set1_epi32(int(pattern.mask));
+		for (; i + 8 <= count; i += 8) {
+			__m256i offsets = _mm256_load_si256(reinterpret_cast<const __m256i*>(pattern.offsets + i));
+			__m256i shifts = _mm256_load_si256(reinterpret_cast<const __m256i*>(pattern.shifts + i));
+			__m256i words = _mm256_i32gather_epi32(reinterpret_cast<const int*>(src), offsets, 1);
+			__m256i values = _mm256_and_si256(_mm256_srlv_epi32(words, shifts), mask);
+			__m128i packed = _mm_packus_epi32(_mm256_castsi256_si128(values), _mm256_extracti128_si256(values, 1));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), packed);
+		}
+#endif
+
+		for (; i < count; ++i) {
+			uint32_t word;
+			memcpy(&word, src + pattern.offsets[i], sizeof(word));
+			if constexpr (std::endian::native == std::endian::big)
+				Tag::byteSwapData<sizeof(word)>(reinterpret_cast<uint8_t*>(&word), reinterpret_cast<const uint8_t*>(&word), 1);
+			dst[i] = uint16_t((word >> pattern.shifts[i]) & pattern.mask);
+		}
+	}
+
+#ifdef NBT_WITH_STATS
+	inline Stats::Snapshot Stats::snapshot() {
+		Registry& registry = Stats::registry();
+		std::lock_guard lock(registry.mutex);
+		Snapshot total = registry.retired;
+		for (const Counters* counters : registry.threads)
+			add(total, *counters);
+
+		const Snapshot& baseline = registry.baseline;
+		for (size_t i = 0; i < TypeCount; ++i) {
+			total.types[i].count -= baseline.types[i].count;
+			total.types[i].bytes -= baseline.types[i].bytes;
+		}
+		total.allocations -= baseline.allocations;
+		total.allocatedBytes -= baseline.allocatedBytes;
+		for (size_t i = 0; i < OperationCount; ++i) {
+			total.operations[i].calls -= baseline.operations[i].calls;
+			total.operations[i].bytes -= baseline.operations[i].bytes;
+			total.operations[i].time -= baseline.operations[i].time;
+		}
+		total.maxDepth = registry.maxDepth.load(std::memory_order_relaxed);
+		return total;
+	}
+
+	// Other threads' slots cannot be cleared from here, so resetting moves the baseline that
+	// snapshot() subtracts instead.
+	inline void Stats::reset() {
+		Registry& registry = Stats::registry();
+		std::lock_guard lock(registry.mutex);
+		Snapshot total = registry.retired;
+		for (const Counters* counters : registry.threads)
+			add(total, *counters);
+		registry.baseline = total;
+		registry.maxDepth.store(0, std::memory_order_relaxed);
+	}
+
+	inline void Stats::setTraceCallback(TraceCallback callback) noexcept {
+		registry().trace.store(callback, std::memory_order_release);
+	}
+
+	inline Stats::Scope::Scope(Operation operation)
+		: m_counters(local()), m_operation(operation), m_decoded(m_counters.decoded), m_start(std::chrono::steady_clock::now()) {
+	}
+
+	inline void Stats::Scope::finish(bool isValid) {
+		finish(size_t(m_counters.decoded - m_decoded), isValid);
+	}
+
+	inline void Stats::Scope::finish(size_t bytes, bool isValid) {
+		auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_start);
+		size_t operation = size_t(m_operation);
+		m_counters.calls[operation].add(1);
+		m_counters.bytes[operation].add(bytes);
+		m_counters.nanoseconds[operation].add(uint64_t(duration.count()));
+
+		Registry& registry = Stats::registry();
+		if (m_counters.peak != 0) {
+			size_t maxDepth = registry.maxDepth.load(std::memory_order_relaxed);
+			while (m_counters.peak > maxDepth && !registry.maxDepth.compare_exchange_weak(maxDepth, m_counters.peak, std::memory_order_relaxed));
+			m_counters.peak = 0;
+		}
+
+		if (TraceCallback trace = registry.trace.load(std::memory_order_acquire))
+			trace(Span{ m_operation, bytes, isValid, m_start, duration });
+	}
+
+	inline Stats::Registry& Stats::registry() {
+		// Never destroyed, so threads exiting during shutdown can still hand in their counters.
+		static Registry* registry = new Registry();
+		return *registry;
+	}
+
+	inline Stats::Counters& Stats::local() {
+		// Registered on first use and folded into the retired totals when the thread exits.
+		struct Slot {
+			Counters counters;
+
+			Slot() {
+				Registry& registry = Stats::registry();
+				std::lock_guard lock(registry.mutex);
+				registry.threads.push_back(&counters);
+			}
+
+			~Slot() {
+				Registry& registry = Stats::registry();
+				std::lock_guard lock(registry.mutex);
+				add(registry.retired, counters);
+				std::erase(registry.threads, &counters);
+			}
+		};
+		static thread_local Slot slot;
+		return slot.counters;
+	}
+
+	inline void Stats::add(Snapshot& total, const Counters& counters) {
+		for (size_t i = 0; i < TypeCount; ++i) {
+			total.types[i].count += counters.typeCounts[i].get();
+			total.types[i].bytes += counters.typeBytes[i].get();
+		}
+		total.allocations += counters.allocations.get();
+		total.allocatedBytes += counters.allocatedBytes.get();
+		for (size_t i = 0; i < OperationCount; ++i) {
+			total.operations[i].calls += counters.calls[i].get();
+			total.operations[i].bytes += counters.bytes[i].get();
+			total.operations[i].time += std::chrono::nanoseconds(counters.nanoseconds[i].get());
+		}
+	}
+
+	inline void Stats::addHeader(Tag::Type type, size_t nameSize, bool isNameHidden, SerializationFlag flags) {
+		size_t bytes = sizeof(uint8_t);
+		if (!isNameHidden)
+			bytes += Tag::numericalSize(uint16_t(nameSize), flags) + nameSize;
+
+		Counters& counters = local();
+		counters.typeBytes[size_t(type)].add(bytes);
+		counters.decoded += bytes;
+	}
+
+	// Containers count only their own framing, as their children are counted on their own.
+	inline void Stats::addPayload(const Tag& tag, Tag::Type type, SerializationFlag flags) {
+		size_t bytes = 0;
+		switch (type) {
+		case Tag::Type::String:
+			{
+				const auto& str = tag.stringValue();
+				bytes = tag.serializedPayloadSize(flags);
+				if (str.capacity() > std::pmr::string().capacity())
+					addAllocation(str.capacity() + 1);
+			}
+			break;
+
+		case Tag::Type::ByteArray:
+			bytes = tag.serializedPayloadSize(flags);
+			addAllocation(tag.byteArrayValue().capacity() * sizeof(int8_t));
+			break;
+
+		case Tag::Type::IntArray:
+			bytes = tag.serializedPayloadSize(flags);
+			addAllocation(tag.intArrayValue().capacity() * sizeof(int32_t));
+			break;
+
+		case Tag::Type::LongArray:
+			bytes = tag.serializedPayloadSize(flags);
+			addAllocation(tag.longArrayValue().capacity() * sizeof(int64_t));
+			break;
+
+		case Tag::Type::List:
+			{
+				const auto& list = tag.listValue();
+				bytes = sizeof(uint8_t) + Tag::numericalSize(int32_t(list.size()), flags);
+				addAllocation(list.capacity() * sizeof(Tag));
+			}
+			break;
+
+		case Tag::Type::Compound:
+			{
+				const auto& compound = std::get<size_t(Tag::Type::Compound)>(tag.m_value);
+				addAllocation(compound.children.capacity() * sizeof(Tag));
+				if (compound.index != nullptr)
+					addAllocation((compound.index[0] + 1) * sizeof(uint32_t));
+			}
+			break;
+
+		default:
+			bytes = tag.serializedPayloadSize(flags);
+			break;
+		}
+
+		Counters& counters = local();
+		counters.typeCounts[size_t(type)].add(1);
+		counters.typeBytes[size_t(type)].add(bytes);
+		counters.decoded += bytes;
+	}
+
+	inline void Stats::addAllocation(size_t bytes) {
+		if (bytes == 0)
+			return;
+
+		Counters& counters = local();
+		counters.allocations.add(1);
+		counters.allocatedBytes.add(bytes);
+	}
+
+	inline void Stats::enter() {
+		Counters& counters = local();
+		counters.peak = std::max(counters.peak, ++counters.depth);
+	}
+
+	inline void Stats::leave() {
+		--local().depth;
+	}
+#endif
+
+	inline Compression detectCompression(const void* data, size_t size) noexcept {
+		const uint8_t* bytes = static_cast<const uint8_t*>(data);
+		if (size >= 2 && bytes[0] == 0x1f && bytes[1] == 0x8b)
+			return Compression::Gzip;
+		if (size >= 2 && (bytes[0] & 0x0f) == 8 && (bytes[0] >> 4) <= 7 && (bytes[0] << 8 | bytes[1]) % 31 == 0)
+			return Compression::Zlib;
+		return Compression::None;
+	}
+
+	inline StreamInput::StreamInput(Source source, size_t bufferSize) : m_source(std::move(source)), m_buffer(std::max(bufferSize, sizeof(int64_t))) {}
+
+	inline StreamInput StreamInput::fromFileDescriptor(int fd, size_t bufferSize) {
+		return StreamInput(fileDescriptorSource(fd), bufferSize);
+	}
+
+	inline StreamInput StreamInput::fromStream(std::istream& stream, size_t bufferSize) {
+		return StreamInput(streamSource(stream), bufferSize);
+	}
+
+	inline StreamInput::Source StreamInput::memorySource(const void* data, size_t size) {
+		return [it = static_cast<const uint8_t*>(data), size](void* dst, size_t capacity) mutable {
+			size_t chunk = std::min(size, capacity);
+			if (chunk != 0)
+				memcpy(dst, it, chunk);
+			it += chunk;
+			size -= chunk;
+			return chunk;
+		};
+	}
+
+	inline StreamInput::Source StreamInput::fileDescriptorSource(int fd) {
+		return [fd](void* dst, size_t size) -> size_t {
+			while (true) {
+#if defined(_WIN32)
+				int got = _read(fd, dst, unsigned(std::min<size_t>(size, INT32_MAX)));
+#else
+				ssize_t got = ::read(fd, dst, size);
+#endif
+				if (got < 0 && errno == EINTR)
+					continue;
+				return got < 0 ? 0 : size_t(got);
+			}
+		};
+	}
+
+	inline StreamInput::Source StreamInput::streamSource(std::istream& stream) {
+		return [&stream](void* dst, size_t size) {
+			stream.read(static_cast<char*>(dst), std::streamsize(size));
+			return size_t(stream.gcount());
+		};
+	}
+
+	inline bool StreamInput::read(void* dst, size_t size) {
+		uint8_t* out = static_cast<uint8_t*>(dst);
+		while (size > 0) {
+			if (m_position == m_size) {
+				m_position = 0;
+				m_size = size >= m_buffer.size() ? 0 : m_source(m_buffer.data(), m_buffer.size());
+
+				if (m_size == 0) {
+					size_t got = m_source(out, size);
+					if (got == 0)
+						return false;
+					out += got;
+					size -= got;
+					continue;
+				}
+			}
+
+			size_t chunk = std::min(size, m_size - m_position);
+			memcpy(out, m_buffer.data() + m_position, chunk);
+			m_position += chunk;
+			out += chunk;
+			size -= chunk;
+		}
+		return true;
+	}
+
+	inline size_t StreamInput::remaining() const noexcept {
+		return SIZE_MAX;
+	}
+
+	template<typename T>
+	inline bool StreamInput::readArray(T* dst, size_t count, SerializationFlag flags) {
+		if (!read(dst, count * sizeof(T)))
+			return false;
+
+		Tag::copyNumericalData<T>(dst, dst, count, flags);
+		return true;
+	}
+
+	inline StreamOutput::StreamOutput(Sink sink, size_t bufferSize) : m_sink(std::move(sink)), m_buffer(std::max(bufferSize, sizeof(int64_t))) {}
+
+	inline StreamOutput::~StreamOutput() {
+		close();
+	}
+
+	inline StreamOutput StreamOutput::fromFileDescriptor(int fd, size_t bufferSize) {
+		return StreamOutput(fileDescriptorSink(fd), bufferSize);
+	}
+
+	inline StreamOutput StreamOutput::fromStream(std::ostream& stream, size_t bufferSize) {
+		return StreamOutput(streamSink(stream), bufferSize);
+	}
+
+	inline StreamOutput::Sink StreamOutput::fileDescriptorSink(int fd) {
+		return [fd](const void* data, size_t size) {
+			const char* it = static_cast<const char*>(data);
+			while (size > 0) {
+#if defined(_WIN32)
+				int written = _write(fd, it, unsigned(std::min<size_t>(size, INT32_MAX)));
+#else
+				ssize_t written = ::write(fd, it, size);
+#endif
+				if (written < 0 && errno == EINTR)
+					continue;
+				if (written <= 0)
+					return false;
+				it += written;
+				size -= size_t(written);
+			}
+			return true;
+		};
+	}
+
+	inline StreamOutput::Sink StreamOutput::streamSink(std::ostream& stream) {
+		return [&stream](const void* data, size_t size) {
+			stream.write(static_cast<const char*>(data), std::streamsize(size));
+			return bool(stream);
+		};
+	}
+
+	inline void StreamOutput::write(const void* src, size_t size) {
+		if (m_size + size > m_buffer.size())
+			flush();
+
+		if (size >= m_buffer.size()) {
+			if (!m_error && !m_sink(src, size))
+				m_error = true;
+		} else if (size != 0) {
+			memcpy(m_buffer.data() + m_size, src, size);
+			m_size += size;
+		}
+	}
+
+	inline bool StreamOutput::flush() {
+		if (m_size != 0 && !m_error && !m_sink(m_buffer.data(), m_size))
+			m_error = true;
+		m_size = 0;
+		return !m_error;
+	}
+
+	inline bool StreamOutput::close() {
+		flush();
+		if (!m_isClosed && !m_error && !m_sink(nullptr, 0))
+			m_error = true;
+		m_isClosed = true;
+		return !m_error;
+	}
+
+	inline bool StreamOutput::isValid() const noexcept {
+		return !m_error;
+	}
+
+	template<typename T>
+	inline void StreamOutput::writeArray(const T* src, size_t count, SerializationFlag flags) {
+		if (!Tag::needsByteSwap(flags)) {
+			write(src, count * sizeof(T));
+			return;
+		}
+
+		while (count > 0) {
+			size_t chunk = std::min(count, (m_buffer.size() - m_size) / sizeof(T));
+			if (chunk == 0) {
+				flush();
+				continue;
+			}
+
+			Tag::copyNumericalData<T>(m_buffer.data() + m_size, src, chunk, flags);
+			m_size += chunk * sizeof(T);
+			src += chunk;
+			count -= chunk;
+		}
+	}
+
+	inline bool TagWriter::writeHeader(Type type, std::string_view name) {
+		if (m_error)
+			return false;
+
+		if (m_frames.empty()) {
+			if (m_isRootWritten) {
+				m_error = true;
+				return false;
+			}
+			m_isRootWritten = true;
+
+			Tag::writeNumericalData(m_out, uint8_t(type), m_flags);
+			if (!(type == Type::Compound && bool(m_flags & SerializationFlag::JavaNetwork))) {
+				Tag::writeNumericalData(m_out, uint16_t(name.size()), m_flags);
+				Tag::writeData(m_out, name.data(), name.size());
+			}
+			return true;
+		}
+
+		Frame& frame = m_frames.back();
+		if (frame.isList) {
+			if (frame.elementType != type || frame.remaining == 0) {
+				m_error = true;
+				return false;
+			}
+			--frame.remaining;
+		} else {
+			Tag::writeNumericalData(m_out, uint8_t(type), m_flags);
+			Tag::writeNumericalData(m_out, uint16_t(name.size()), m_flags);
+			Tag::writeData(m_out, name.data(), name.size());
+		}
+		return true;
+	}
+
+	template<typename T>
+	inline void TagWriter::writeScalar(Type type, std::string_view name, T value) {
+		if (writeHeader(type, name))
+			Tag::writeNumericalData(m_out, value, m_flags);
+	}
+
+	inline void TagWriter::beginCompound(std::string_view name) {
+		if (writeHeader(Type::Compound, name))
+			m_frames.push_back(Frame{ Type::End, 0, false });
+	}
+
+	inline void TagWriter::endCompound() {
+		if (m_frames.empty() || m_frames.back().isList) {
+			m_error = true;
+			return;
+		}
+
+		m_frames.pop_back();
+		Tag::writeNumericalData(m_out, uint8_t(Type::End), m_flags);
+	}
+
+	inline void TagWriter::beginList(std::string_view name, Type elementType, size_t count) {
+		if (writeHeader(Type::List, name)) {
+			Tag::writeNumericalData(m_out, uint8_t(count == 0 ? Type::End : elementType), m_flags);
+			Tag::writeNumericalData(m_out, int32_t(count), m_flags);
+			m_frames.push_back(Frame{ elementType, count, true });
+		}
+	}
+
+	inline void TagWriter::endList() {
+		if (m_frames.empty() || !m_frames.back().isList || m_frames.back().remaining != 0) {
+			m_error = true;
+			return;
+		}
+
+		m_frames.pop_back();
+	}
+
+	inline void TagWriter::writeByte(std::string_view name, int8_t value) {
+		writeScalar(Type::Byte, name, value);
+	}
+
+	inline void TagWriter::writeShort(std::string_view name, int16_t value) {
+		writeScalar(Type::Short, name, value);
+	}
+
+	inline void TagWriter::writeInt(std::string_view name, int32_t value) {
+		writeScalar(Type::Int, name, value);
+	}
+
+	inline void TagWriter::writeLong(std::string_view name, int64_t value) {
+		writeScalar(Type::Long, name, value);
+	}
+
+	inline void TagWriter::writeFloat(std::string_view name, float value) {
+		writeScalar(Type::Float, name, value);
+	}
+
+	inline void TagWriter::writeDouble(std::string_view name, double value) {
+		writeScalar(Type::Double, name, value);
+	}
+
+	inline void TagWriter::writeByteArray(std::string_view name, std::span<const int8_t> value) {
+		if (writeHeader(Type::ByteArray, name)) {
+			Tag::writeNumericalData(m_out, int32_t(value.size()), m_flags);
+			Tag::writeData(m_out, value.data(), value.size());
+		}
+	}
+
+	inline void TagWriter::writeString(std::string_view name, std::string_view value) {
+		if (writeHeader(Type::String, name)) {
+			Tag::writeNumericalData(m_out, uint16_t(value.size()), m_flags);
+			Tag::writeData(m_out, value.data(), value.size());
+		}
+	}
+
+	inline void TagWriter::writeIntArray(std::string_view name, std::span<const int32_t> value) {
+		if (writeHeader(Type::IntArray, name)) {
+			Tag::writeNumericalData(m_out, int32_t(value.size()), m_flags);
+			Tag::writeArrayData(m_out, value.data(), value.size(), m_flags);
+		}
+	}
+
+	inline void TagWriter::writeLongArray(std::string_view name, std::span<const int64_t> value) {
+		if (writeHeader(Type::LongArray, name)) {
+			Tag::writeNumericalData(m_out, int32_t(value.size()), m_flags);
+			Tag::writeArrayData(m_out, value.data(), value.size(), m_flags);
+		}
+	}
+
+	inline void TagWriter::writeTag(const Tag& tag) {
+		if (writeHeader(tag.type(), tag.name()))
+			tag.serializePayload(m_out, m_flags);
+	}
+
+	inline bool TagWriter::isValid() const noexcept {
+		return !m_error && m_out.isValid();
+	}
+
+	inline TagParser::TagParser(SerializationFlag flags, std::pmr::memory_resource* resource) : TagParser(flags, DeserializeLimits{}, resource) {}
+
+	inline TagParser::TagParser(SerializationFlag flags, const DeserializeLimits& limits, std::pmr::memory_resource* resource) :
+		m_flags(flags), m_limits(limits), m_budget(limits), m_resource(resource) {}
+
+	inline size_t TagParser::feed(std::span<const uint8_t> data) {
+		const uint8_t* it = data.data();
+		const uint8_t* end = it + data.size();
+		while (m_step != Step::Done && m_step != Step::Error && advance(it, end)) {}
+		return size_t(it - data.data());
+	}
 
+	inline bool TagParser::isComplete() const noexcept {
+		return m_step == Step::Done;
+	}
+
+	inline bool TagParser::isValid() const noexcept {
+		return m_step != Step::Error;
+	}
+
+	inline Tag TagParser::take() {
 		Tag tag;
-		if (!isNameHidden) {
-			tag.m_hasName = true;
-			tag.m_name.resize(readNumericalData<uint16_t>(it, end, flags, tag.m_error));
-			readData(it, end, tag.m_name.data(), tag.m_name.size(), tag.m_error);
-		}
-
-		if (tag.isValid()) {
-			switch (type) {
-			case Type::End: tag.m_value.emplace<size_t(Type::End)>(0); break;
-			case Type::Byte: if (it + 1 > end) { tag.m_error = true; } else { tag.m_value.emplace<size_t(Type::Byte)>(*it++); } break;
-			case Type::Short: tag.m_value.emplace<size_t(Type::Short)>(readNumericalData<int16_t>(it, end, flags, tag.m_error)); break;
-			case Type::Int: tag.m_value.emplace<size_t(Type::Int)>(readNumericalData<int32_t>(it, end, flags, tag.m_error)); break;
-			case Type::Long: tag.m_value.emplace<size_t(Type::Long)>(readNumericalData<int64_t>(it, end, flags, tag.m_error)); break;
-			case Type::Float: tag.m_value.emplace<size_t(Type::Float)>(readNumericalData<float>(it, end, flags, tag.m_error)); break;
-			case Type::Double: tag.m_value.emplace<size_t(Type::Double)>(readNumericalData<double>(it, end, flags, tag.m_error)); break;
-			case Type::ByteArray:
-				{
-					std::vector<int8_t> byteArray;
-					byteArray.resize(std::max(readNumericalData<int32_t>(it, end, flags, tag.m_error), 0));
-					readData(it, end, byteArray.data(), byteArray.size(), tag.m_error);
-					tag.m_value.emplace<size_t(Type::ByteArray)>(std::move(byteArray));
-				}
-				break;
+		if (m_step == Step::Done)
+			tag = std::move(m_tag);
+		else
+			tag.setError();
 
-			case Type::String:
-				{
-					std::string str;
-					str.resize(readNumericalData<uint16_t>(it, end, flags, tag.m_error));
-					readData(it, end, str.data(), str.size(), tag.m_error);
-					tag.m_value.emplace<size_t(Type::String)>(std::move(str));
-				}
-				break;
+		reset();
+		return tag;
+	}
 
-			case Type::List:
-				{
-					Type listType = Type(*it++);
-					if (it >= end)
-						tag.m_error = true;
-
-					std::vector<Tag> tags;
-					int32_t size = std::max(readNumericalData<int32_t>(it, end, flags, tag.m_error), 0);
-					tags.reserve(size);
-
-					for (size_t i = 0; i < size && tag.isValid(); ++i) {
-						Tag child = deserialize(it, end, flags, true, false);
-						if (!child.isValid() || child.type() != listType)
-							tag.m_error = true;
-						tags.emplace_back(std::move(child));
-					}
+	inline void TagParser::reset() {
+		m_budget = Tag::Budget(m_limits);
+		m_step = Step::Type;
+		m_pendingSize = 0;
+		m_tag = Tag();
+		m_frames.clear();
+	}
 
-					tag.m_value.emplace<size_t(Type::List)>(std::move(tags));
+	// Runs one step of the state machine, returning false when it needs more input.
+	inline bool TagParser::advance(const uint8_t*& it, const uint8_t* end) {
+		switch (m_step) {
+		case Step::Type:
+			{
+				uint8_t type = 0;
+				if (!readNumber(it, end, type))
+					return false;
+				if (type > uint8_t(Type::LongArray))
+					return fail();
+
+				m_type = Type(type);
+				if (!m_frames.empty() && m_type == Type::End) {
+					closeFrame();
+					return true;
 				}
-				break;
 
-			case Type::Compound:
-				{
-					std::vector<Tag> tags;
-
-					while (tag.isValid()) {
-						Tag child = deserialize(it, end, flags, false, false);
-						if (!child.isValid())
-							tag.m_error = true;
-						if (child.type() == Type::End)
-							break;
-						tags.emplace_back(std::move(child));
-					}
+				if (m_type != Type::End && !m_budget.addTag(0))
+					return fail();
+
+				bool isNameHidden = m_type == Type::End || (m_frames.empty() && m_type == Type::Compound && bool(m_flags & SerializationFlag::JavaNetwork));
+				m_tag = Tag();
+				m_step = isNameHidden ? Step::Payload : Step::NameSize;
+				return true;
+			}
+
+		case Step::NameSize:
+			{
+				uint16_t size = 0;
+				if (!readNumber(it, end, size))
+					return false;
+				if (!m_budget.addBytes(size))
+					return fail();
+				m_name.clear();
+				m_remaining = size;
+				m_step = Step::Name;
+				return true;
+			}
 
-					tag.m_value.emplace<size_t(Type::Compound)>(std::move(tags));
+		case Step::Name:
+			{
+				// Names that arrive in one piece go to the intern table without a copy.
+				if (m_name.empty() && m_remaining <= size_t(end - it)) {
+					m_tag.setName(std::string_view(reinterpret_cast<const char*>(it), m_remaining));
+					it += m_remaining;
+					m_step = Step::Payload;
+					return true;
 				}
-				break;
 
-			case Type::IntArray:
-				{
-					std::vector<int32_t> arr;
-					arr.resize(std::max(readNumericalData<int32_t>(it, end, flags, tag.m_error), 0));
+				size_t size = std::min(m_remaining, size_t(end - it));
+				m_name.append(reinterpret_cast<const char*>(it), size);
+				it += size;
+				m_remaining -= size;
+				if (m_remaining != 0)
+					return false;
 
-					for (size_t i = 0; i < arr.size() && tag.isValid(); ++i)
-						arr[i] = readNumericalData<int32_t>(it, end, flags, tag.m_error);
+				m_tag.setName(std::string_view(m_name));
+				m_step = Step::Payload;
+				return true;
+			}
 
-					tag.m_value.emplace<size_t(Type::IntArray)>(std::move(arr));
-				}
-				break;
+		case Step::Payload:
+			return readPayload(it, end);
 
-			case Type::LongArray:
-				{
-					std::vector<int64_t> arr;
-					arr.resize(std::max(readNumericalData<int32_t>(it, end, flags, tag.m_error), 0));
+		case Step::ListType:
+			{
+				uint8_t type = 0;
+				if (!readNumber(it, end, type))
+					return false;
+				m_elementType = Type(type);
+				m_step = Step::ListSize;
+				return true;
+			}
+
+		case Step::ListSize:
+			{
+				int32_t size = 0;
+				if (!readNumber(it, end, size))
+					return false;
 
-					for (size_t i = 0; i < arr.size() && tag.isValid(); ++i)
-						arr[i] = readNumericalData<int64_t>(it, end, flags, tag.m_error);
+				// Lists of End are read as empty, as Tag::deserialize does. The elements are
+				// charged up front, which comes to the same as charging them one by one.
+				size_t count = m_elementType == Type::End ? 0 : size_t(std::max(size, 0));
+				if (m_frames.size() >= m_limits.maxDepth || count > m_budget.tags || !m_budget.addArray(count, sizeof(Tag)))
+					return fail();
+				m_budget.tags -= count;
 
-					tag.m_value.emplace<size_t(Type::LongArray)>(std::move(arr));
-				}
+				m_frames.push_back(Frame{ std::move(m_tag), std::pmr::vector<Tag>(m_resource), Type::List, m_elementType, count });
+				if (m_frames.back().remaining == 0)
+					closeFrame();
+				else
+					beginPayload(m_elementType);
+				return true;
+			}
+
+		case Step::Elements:
+			return readElements(it, end);
+
+		default:
+			return false;
+		}
+	}
+
+	inline bool TagParser::readPayload(const uint8_t*& it, const uint8_t* end) {
+		auto& value = m_tag.m_value;
+		switch (m_type) {
+		case Type::End: value.emplace<size_t(Type::End)>(0); break;
+		case Type::Byte: { int8_t number = 0; if (!readNumber(it, end, number)) return false; value.emplace<size_t(Type::Byte)>(number); break; }
+		case Type::Short: { int16_t number = 0; if (!readNumber(it, end, number)) return false; value.emplace<size_t(Type::Short)>(number); break; }
+		case Type::Int: { int32_t number = 0; if (!readNumber(it, end, number)) return false; value.emplace<size_t(Type::Int)>(number); break; }
+		case Type::Long: { int64_t number = 0; if (!readNumber(it, end, number)) return false; value.emplace<size_t(Type::Long)>(number); break; }
+		case Type::Float: { float number = 0; if (!readNumber(it, end, number)) return false; value.emplace<size_t(Type::Float)>(number); break; }
+		case Type::Double: { double number = 0; if (!readNumber(it, end, number)) return false; value.emplace<size_t(Type::Double)>(number); break; }
+
+		case Type::String:
+			{
+				uint16_t size = 0;
+				if (!readNumber(it, end, size))
+					return false;
+				if (!m_budget.addArray(size, sizeof(char)))
+					return fail();
+				value.emplace<size_t(Type::String)>(m_resource);
+				m_remaining = size;
+				m_step = Step::Elements;
+				return true;
+			}
+
+		case Type::ByteArray:
+		case Type::IntArray:
+		case Type::LongArray:
+			{
+				int32_t size = 0;
+				if (!readNumber(it, end, size))
+					return false;
+
+				size_t elementSize = m_type == Type::ByteArray ? sizeof(int8_t) : m_type == Type::IntArray ? sizeof(int32_t) : sizeof(int64_t);
+				if (!m_budget.addArray(size_t(std::max(size, 0)), elementSize))
+					return fail();
+				if (m_type == Type::ByteArray)
+					value.emplace<size_t(Type::ByteArray)>(m_resource);
+				else if (m_type == Type::IntArray)
+					value.emplace<size_t(Type::IntArray)>(m_resource);
+				else
+					value.emplace<size_t(Type::LongArray)>(m_resource);
+				m_remaining = size_t(std::max(size, 0));
+				m_step = Step::Elements;
+				return true;
+			}
+
+		case Type::List:
+			m_step = Step::ListType;
+			return true;
+
+		case Type::Compound:
+			if (m_frames.size() >= m_limits.maxDepth)
+				return fail();
+			m_frames.push_back(Frame{ std::move(m_tag), std::pmr::vector<Tag>(m_resource), Type::Compound, Type::End, 0 });
+			m_step = Step::Type;
+			return true;
+
+		default:
+			return fail();
+		}
+
+		complete();
+		return true;
+	}
+
+	// Strings and arrays are filled as their bytes come in, rather than sized up front from a
+	// length the input may not back up.
+	inline bool TagParser::readElements(const uint8_t*& it, const uint8_t* end) {
+		switch (m_type) {
+		case Type::String:
+			{
+				size_t size = std::min(m_remaining, size_t(end - it));
+				std::get<size_t(Type::String)>(m_tag.m_value).append(reinterpret_cast<const char*>(it), size);
+				it += size;
+				m_remaining -= size;
 				break;
+			}
 
-			default:
+		case Type::ByteArray:
+			{
+				size_t size = std::min(m_remaining, size_t(end - it));
+				auto& arr = std::get<size_t(Type::ByteArray)>(m_tag.m_value);
+				arr.insert(arr.end(), reinterpret_cast<const int8_t*>(it), reinterpret_cast<const int8_t*>(it) + size);
+				it += size;
+				m_remaining -= size;
 				break;
 			}
 
+		case Type::IntArray:
+			if (!readArray<int32_t>(it, end))
+				return false;
+			break;
+
+		case Type::LongArray:
+			if (!readArray<int64_t>(it, end))
+				return false;
+			break;
+
+		default:
+			return fail();
 		}
-		return tag;
+
+		if (m_remaining != 0)
+			return false;
+
+		complete();
+		return true;
 	}
 
-	inline void Tag::writeData(std::vector<uint8_t>& data, const void* src, size_t size) {
-		size_t offset = data.size();
-		data.resize(data.size() + size);
-		memcpy(data.data() + offset, src, size);
+	template<typename T>
+	inline bool TagParser::readArray(const uint8_t*& it, const uint8_t* end) {
+		auto& arr = std::get<std::pmr::vector<T>>(m_tag.m_value);
+		if (Tag::isVarInt(m_flags)) {
+			for (T value = 0; m_remaining != 0 && readNumber(it, end, value); --m_remaining)
+				arr.push_back(value);
+			return m_step != Step::Error;
+		}
+
+		// An element split between two feeds goes through the pending buffer, whole ones are
+		// converted straight from the input.
+		T value = 0;
+		if (m_pendingSize != 0) {
+			if (!readNumber(it, end, value))
+				return false;
+			arr.push_back(value);
+			--m_remaining;
+		}
+
+		size_t count = std::min(m_remaining, size_t(end - it) / sizeof(T));
+		size_t offset = arr.size();
+		arr.resize(offset + count);
+		Tag::copyNumericalData<T>(arr.data() + offset, it, count, m_flags);
+		it += count * sizeof(T);
+		m_remaining -= count;
+
+		if (m_remaining != 0 && readNumber(it, end, value)) {
+			arr.push_back(value);
+			--m_remaining;
+		}
+		return true;
 	}
 
-	inline void Tag::readData(const uint8_t*& it, const void* end, void* dst, size_t size, bool& error) {
-		if (it + size > end || error) {
-			error = true;
-			return;
+	// Reads one number, gathering its bytes in the pending buffer when the input ends part way
+	// through it. Returns false if the number is not complete yet or is malformed.
+	template<typename T>
+	inline bool TagParser::readNumber(const uint8_t*& it, const uint8_t* end, T& value) {
+		bool error = false;
+		if (m_pendingSize == 0 && isWhole<T>(it, end)) {
+			value = Tag::readNumericalData<T>(it, end, m_flags, error);
+			return !error || fail();
 		}
-		memcpy(dst, it, size);
-		it += size;
+
+		while (it != end && !isWhole<T>(m_pending, m_pending + m_pendingSize))
+			m_pending[m_pendingSize++] = *it++;
+		if (!isWhole<T>(m_pending, m_pending + m_pendingSize))
+			return false;
+
+		const uint8_t* pending = m_pending;
+		value = Tag::readNumericalData<T>(pending, m_pending + m_pendingSize, m_flags, error);
+		m_pendingSize = 0;
+		return !error || fail();
 	}
 
+	// Whether [it, end) holds all the bytes of the next number. A VarInt is whole once its
+	// last byte is in, or once it runs to the longest allowed size, when decoding rejects it.
 	template<typename T>
-	inline void Tag::writeNumericalData(std::vector<uint8_t>& data, T src, SerializationFlag flags) {
-		writeData(data, &src, sizeof(T));
+	inline bool TagParser::isWhole(const uint8_t* it, const uint8_t* end) const noexcept {
+		size_t available = size_t(end - it);
+		if constexpr (Tag::IsVarIntType<T>) {
+			if (Tag::isVarInt(m_flags)) {
+				if (available >= Tag::MaxVarIntSize<T>)
+					return true;
+				return std::find_if(it, end, [](uint8_t byte) { return (byte & 0x80) == 0; }) != end;
+			}
+		}
+		return available >= sizeof(T);
+	}
 
-		if constexpr (std::endian::native == std::endian::little) {
-			if (!bool(flags & SerializationFlag::Bedrock)) {
-				std::reverse(data.begin() + data.size() - sizeof(T), data.begin() + data.size());
+	inline void TagParser::beginPayload(Type type) {
+		m_tag = Tag();
+		m_type = type;
+		m_step = Step::Payload;
+	}
+
+	// Hands the finished m_tag to its parent, closing each list that it fills up on the way.
+	inline void TagParser::complete() {
+		while (!m_frames.empty()) {
+			Frame& frame = m_frames.back();
+			frame.children.emplace_back(std::move(m_tag));
+			if (frame.type == Type::Compound) {
+				m_step = Step::Type;
+				return;
 			}
-		} else {
-			if (bool(flags & SerializationFlag::Bedrock)) {
-				std::reverse(data.begin() + data.size() - sizeof(T), data.begin() + data.size());
+			if (--frame.remaining != 0) {
+				beginPayload(frame.elementType);
+				return;
 			}
+
+			Frame closed = std::move(frame);
+			m_frames.pop_back();
+			m_tag = std::move(closed.tag);
+			m_tag.m_value.emplace<size_t(Type::List)>(std::move(closed.children));
 		}
+		m_step = Step::Done;
 	}
 
-	template<typename T>
-	inline T Tag::readNumericalData(const uint8_t*& it, const void* end, SerializationFlag flags, bool& error) {
-		union {
-			T t;
-			uint8_t[sizeof(T)] bytes;
-		} data;
+	inline void TagParser::closeFrame() {
+		Frame closed = std::move(m_frames.back());
+		m_frames.pop_back();
+		m_tag = std::move(closed.tag);
+		if (closed.type == Type::List) {
+			m_tag.m_value.emplace<size_t(Type::List)>(std::move(closed.children));
+		} else {
+			m_tag.m_value.emplace<size_t(Type::Compound)>(std::move(closed.children));
+			m_tag.buildIndex();
+		}
+		complete();
+	}
 
-		readData(it, end, &data.t, sizeof(T), error);
+	inline bool TagParser::fail() {
+		m_step = Step::Error;
+		m_frames.clear();
+		return false;
+	}
 
-		if (!error) {
-			if constexpr (std::endian::native == std::endian::little) {
-				if (!bool(flags & SerializationFlag::Bedrock)) {
-					std::reverse(data.bytes, data.bytes + sizeof(T));
+#ifdef NBT_WITH_ZLIB
+	inline StreamInput::Source inflateSource(StreamInput::Source source) {
+		struct State {
+			StreamInput::Source source;
+			std::vector<uint8_t> input = std::vector<uint8_t>(StreamInput::DefaultBufferSize);
+			z_stream stream{};
+			Compression compression = Compression::None;
+			bool isDetected = false;
+			bool isInitialized = false;
+			bool isEnd = false;
+
+			~State() {
+				if (isInitialized)
+					inflateEnd(&stream);
+			}
+
+			bool refill() {
+				stream.next_in = input.data();
+				stream.avail_in = uInt(source(input.data(), input.size()));
+				return stream.avail_in != 0;
+			}
+		};
+
+		auto state = std::make_shared<State>();
+		state->source = std::move(source);
+
+		return [state](void* dst, size_t size) -> size_t {
+			State& s = *state;
+			if (!s.isDetected) {
+				s.isDetected = true;
+				size_t got = 0;
+				while (got < 2) {
+					size_t chunk = s.source(s.input.data() + got, s.input.size() - got);
+					if (chunk == 0)
+						break;
+					got += chunk;
 				}
-			} else {
-				if (bool(flags & SerializationFlag::Bedrock)) {
-					std::reverse(data.bytes, data.bytes + sizeof(T));
+
+				s.stream.next_in = s.input.data();
+				s.stream.avail_in = uInt(got);
+				s.compression = detectCompression(s.input.data(), got);
+				if (s.compression != Compression::None) {
+					s.isInitialized = inflateInit2(&s.stream, 15 + 32) == Z_OK;
+					s.isEnd = !s.isInitialized;
+				}
+			}
+
+			if (s.compression == Compression::None) {
+				if (s.stream.avail_in == 0)
+					return s.source(dst, size);
+
+				size_t chunk = std::min<size_t>(size, s.stream.avail_in);
+				memcpy(dst, s.stream.next_in, chunk);
+				s.stream.next_in += chunk;
+				s.stream.avail_in -= uInt(chunk);
+				return chunk;
+			}
+
+			s.stream.next_out = static_cast<Bytef*>(dst);
+			s.stream.avail_out = uInt(std::min<size_t>(size, UINT32_MAX));
+			while (!s.isEnd && s.stream.avail_out == uInt(std::min<size_t>(size, UINT32_MAX))) {
+				if (s.stream.avail_in == 0 && !s.refill()) {
+					s.isEnd = true;
+					break;
 				}
+
+				int result = inflate(&s.stream, Z_NO_FLUSH);
+				if (result == Z_STREAM_END || (result != Z_OK && result != Z_BUF_ERROR))
+					s.isEnd = true;
+			}
+			return std::min<size_t>(size, UINT32_MAX) - s.stream.avail_out;
+		};
+	}
+
+	inline StreamOutput::Sink deflateSink(StreamOutput::Sink sink, Compression compression, int level) {
+		if (compression == Compression::None)
+			return sink;
+
+		struct State {
+			StreamOutput::Sink sink;
+			std::vector<uint8_t> output = std::vector<uint8_t>(StreamOutput::DefaultBufferSize);
+			z_stream stream{};
+			bool isInitialized = false;
+
+			~State() {
+				if (isInitialized)
+					deflateEnd(&stream);
+			}
+		};
+
+		auto state = std::make_shared<State>();
+		state->sink = std::move(sink);
+		state->isInitialized = deflateInit2(&state->stream, level, Z_DEFLATED, compression == Compression::Gzip ? 15 + 16 : 15, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+
+		return [state](const void* data, size_t size) {
+			State& s = *state;
+			if (!s.isInitialized)
+				return false;
+
+			bool isFinish = size == 0;
+			s.stream.next_in = static_cast<Bytef*>(const_cast<void*>(data));
+			s.stream.avail_in = uInt(size);
+
+			int result = Z_OK;
+			do {
+				s.stream.next_out = s.output.data();
+				s.stream.avail_out = uInt(s.output.size());
+				result = deflate(&s.stream, isFinish ? Z_FINISH : Z_NO_FLUSH);
+				if (result == Z_STREAM_ERROR)
+					return false;
+
+				size_t produced = s.output.size() - s.stream.avail_out;
+				if (produced != 0 && !s.sink(s.output.data(), produced))
+					return false;
+			} while (s.stream.avail_out == 0 || (isFinish && result != Z_STREAM_END));
+
+			return isFinish ? s.sink(nullptr, 0) : true;
+		};
+	}
+#endif
+
+	inline ThreadPool::ThreadPool(size_t threadCount) : m_ranges(new Range[(std::max)(threadCount, size_t(1))]) {
+		for (size_t i = 1; i < threadCount; ++i)
+			m_threads.emplace_back([this, i]() { run(i); });
+	}
+
+	inline ThreadPool::~ThreadPool() {
+		{
+			std::lock_guard lock(m_mutex);
+			m_isStopping = true;
+		}
+		m_wake.notify_all();
+
+		for (auto& thread : m_threads)
+			thread.join();
+	}
+
+	inline size_t ThreadPool::size() const noexcept {
+		return m_threads.size() + 1;
+	}
+
+	inline void ThreadPool::parallelFor(size_t count, const std::function<void(size_t index)>& task) {
+		std::lock_guard callLock(m_callMutex);
+		{
+			std::lock_guard lock(m_mutex);
+			for (size_t i = 0; i < size(); ++i) {
+				std::lock_guard rangeLock(m_ranges[i].mutex);
+				m_ranges[i].begin = count * i / size();
+				m_ranges[i].end = count * (i + 1) / size();
+			}
+			m_task = &task;
+			m_active = m_threads.size();
+			++m_generation;
+		}
+		m_wake.notify_all();
+
+		work(0, task);
+
+		std::unique_lock lock(m_mutex);
+		m_idle.wait(lock, [this]() { return m_active == 0; });
+		m_task = nullptr;
+	}
+
+	inline void ThreadPool::run(size_t self) {
+		uint64_t generation = 0;
+		std::unique_lock lock(m_mutex);
+
+		while (true) {
+			m_wake.wait(lock, [&]() { return m_isStopping || m_generation != generation; });
+			if (m_isStopping)
+				return;
+
+			generation = m_generation;
+			const auto& task = *m_task;
+			lock.unlock();
+
+			work(self, task);
+
+			lock.lock();
+			if (--m_active == 0)
+				m_idle.notify_one();
+		}
+	}
+
+	inline void ThreadPool::work(size_t self, const std::function<void(size_t)>& task) {
+		Range& range = m_ranges[self];
+		while (true) {
+			size_t index;
+			{
+				std::lock_guard lock(range.mutex);
+				index = range.begin < range.end ? range.begin++ : SIZE_MAX;
+			}
+
+			if (index != SIZE_MAX)
+				task(index);
+			else if (!steal(self))
+				return;
+		}
+	}
+
+	inline bool ThreadPool::steal(size_t self) {
+		for (size_t offset = 1; offset < size(); ++offset) {
+			Range& victim = m_ranges[(self + offset) % size()];
+			size_t begin, end;
+			{
+				std::lock_guard lock(victim.mutex);
+				if (victim.begin >= victim.end)
+					continue;
+				begin = victim.begin + (victim.end - victim.begin) / 2;
+				end = victim.end;
+				victim.end = begin;
+			}
+
+			std::lock_guard lock(m_ranges[self].mutex);
+			m_ranges[self].begin = begin;
+			m_ranges[self].end = end;
+			return true;
+		}
+		return false;
+	}
+
+	inline RegionFile::~RegionFile() {
+		close();
+	}
+
+	inline bool RegionFile::open(const std::string& path, bool isWritable) {
+		close();
+
+#if defined(_WIN32)
+		m_fd = _open(path.c_str(), _O_BINARY | (isWritable ? _O_RDWR | _O_CREAT : _O_RDONLY), _S_IREAD | _S_IWRITE);
+#else
+		m_fd = ::open(path.c_str(), isWritable ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+#endif
+		if (m_fd < 0)
+			return false;
+		m_isWritable = isWritable;
+
+		struct stat info;
+		if (fstat(m_fd, &info) != 0) {
+			close();
+			return false;
+		}
+
+		if (size_t(info.st_size) < 2 * SectorSize) {
+			std::vector<uint8_t> header(2 * SectorSize, 0);
+			if (!isWritable || !writeAt(0, header.data(), header.size())) {
+				close();
+				return false;
 			}
-			return data.t;
+		}
+
+		if (!map()) {
+			close();
+			return false;
+		}
+		return true;
+	}
+
+	inline void RegionFile::close() {
+		unmap();
+		if (m_fd >= 0) {
+#if defined(_WIN32)
+			_close(m_fd);
+#else
+			::close(m_fd);
+#endif
+		}
+		m_fd = -1;
+	}
+
+	inline bool RegionFile::isOpen() const noexcept {
+		return m_data != nullptr;
+	}
+
+	inline bool RegionFile::hasChunk(int x, int z) const noexcept {
+		return !chunkData(x, z).empty();
+	}
+
+	inline uint32_t RegionFile::timestamp(int x, int z) const noexcept {
+		if (!isOpen())
+			return 0;
+		return Tag::decodeNumericalData<uint32_t>(m_data + SectorSize + chunkIndex(x, z) * sizeof(uint32_t), SerializationFlag::None);
+	}
+
+	inline Compression RegionFile::chunkCompression(int x, int z) const noexcept {
+		std::span<const uint8_t> payload;
+		uint8_t type = 0;
+		chunkPayload(chunkIndex(x, z), payload, type);
+		return type == 1 ? Compression::Gzip : type == 2 ? Compression::Zlib : Compression::None;
+	}
+
+	inline std::span<const uint8_t> RegionFile::chunkData(int x, int z) const noexcept {
+		std::span<const uint8_t> payload;
+		uint8_t type = 0;
+		chunkPayload(chunkIndex(x, z), payload, type);
+		return payload;
+	}
+
+	inline Tag RegionFile::readChunk(int x, int z, std::pmr::memory_resource* resource) const {
+		return readChunk(chunkIndex(x, z), resource);
+	}
+
+	inline std::vector<Tag> RegionFile::readChunks(ThreadPool& pool) const {
+		std::vector<Tag> chunks(ChunkCount, Tag::End());
+		pool.parallelFor(ChunkCount, [&](size_t index) {
+			chunks[index] = readChunk(index, std::pmr::get_default_resource());
+		});
+		return chunks;
+	}
+
+	inline std::vector<Tag> Tag::deserialize(std::span<const Payload> payloads, ThreadPool& pool, std::pmr::memory_resource* resource) {
+		// The placeholders own nothing. Assigning a result over one move-constructs it in place,
+		// so the tree keeps what it allocated from `resource` rather than being copied.
+		std::vector<Tag> tags(payloads.size(), Tag::End());
+		pool.parallelFor(payloads.size(), [&](size_t index) {
+			const auto& payload = payloads[index];
+			tags[index] = deserialize(payload.data, static_cast<const uint8_t*>(payload.data) + payload.size, payload.flags, resource);
+		});
+		return tags;
+	}
+
+	inline std::vector<Data> Tag::serialize(std::span<const Tag> tags, ThreadPool& pool, SerializationFlag flags) {
+		std::vector<Data> data(tags.size());
+		pool.parallelFor(tags.size(), [&](size_t index) {
+			data[index] = tags[index].serialize(flags);
+		});
+		return data;
+	}
+
+	inline bool RegionFile::writeChunk(int x, int z, const Tag& tag, Compression compression) {
+		if (!isOpen() || !m_isWritable)
+			return false;
+
+		Data sectors(5);
+		if (compression == Compression::None) {
+			tag.serialize(sectors);
 		} else {
-			return T(0);
+#ifdef NBT_WITH_ZLIB
+			StreamOutput out(deflateSink([&sectors](const void* data, size_t size) {
+				sectors.insert(sectors.end(), static_cast<const uint8_t*>(data), static_cast<const uint8_t*>(data) + size);
+				return true;
+			}, compression));
+			tag.serialize(out);
+			if (!out.close())
+				return false;
+#else
+			return false;
+#endif
+		}
+
+		size_t sectorCount = (sectors.size() + SectorSize - 1) / SectorSize;
+		if (sectorCount > 0xff)
+			return false;
+
+		Tag::BufferOutput header{ sectors.data() };
+		Tag::writeNumericalData(header, uint32_t(sectors.size() - 4), SerializationFlag::None);
+		Tag::writeNumericalData(header, uint8_t(compression == Compression::Gzip ? 1 : compression == Compression::Zlib ? 2 : 3), SerializationFlag::None);
+		sectors.resize(sectorCount * SectorSize, 0);
+
+		// Find room: keep the chunk in place when it still fits, otherwise take the first run
+		// of free sectors, which may extend past the current end of the file.
+		size_t index = chunkIndex(x, z);
+		size_t fileSectors = (m_size + SectorSize - 1) / SectorSize;
+		std::vector<bool> used(fileSectors, false);
+		used[0] = used[1] = true;
+		for (size_t i = 0; i < ChunkCount; ++i) {
+			uint32_t entry = location(i);
+			if (i == index)
+				continue;
+			for (size_t sector = entry >> 8; sector < (entry >> 8) + (entry & 0xff) && sector < fileSectors; ++sector)
+				used[sector] = true;
+		}
+
+		uint32_t previous = location(index);
+		size_t offset = previous >> 8;
+		if (offset < 2 || sectorCount > (previous & 0xff)) {
+			size_t run = 0;
+			for (offset = 2; offset + run < fileSectors && run < sectorCount; ) {
+				if (used[offset + run]) {
+					offset += run + 1;
+					run = 0;
+				} else {
+					++run;
+				}
+			}
+		}
+
+		uint8_t entry[4];
+		Tag::BufferOutput entryOutput{ entry };
+		Tag::writeNumericalData(entryOutput, uint32_t(offset << 8 | sectorCount), SerializationFlag::None);
+
+		uint8_t time[4];
+		Tag::BufferOutput timeOutput{ time };
+		Tag::writeNumericalData(timeOutput, uint32_t(std::time(nullptr)), SerializationFlag::None);
+
+		if (!writeAt(uint64_t(offset) * SectorSize, sectors.data(), sectors.size())
+			|| !writeAt(index * sizeof(uint32_t), entry, sizeof(entry))
+			|| !writeAt(SectorSize + index * sizeof(uint32_t), time, sizeof(time)))
+			return false;
+
+		unmap();
+		return map();
+	}
+
+	inline size_t RegionFile::chunkIndex(int x, int z) noexcept {
+		return size_t(x & (Width - 1)) + size_t(z & (Width - 1)) * Width;
+	}
+
+	inline uint32_t RegionFile::location(size_t index) const noexcept {
+		return Tag::decodeNumericalData<uint32_t>(m_data + index * sizeof(uint32_t), SerializationFlag::None);
+	}
+
+	inline bool RegionFile::chunkPayload(size_t index, std::span<const uint8_t>& payload, uint8_t& type) const noexcept {
+		if (!isOpen())
+			return false;
+
+		uint32_t entry = location(index);
+		size_t start = size_t(entry >> 8) * SectorSize;
+		if (entry == 0 || start < 2 * SectorSize || start + 5 > m_size)
+			return false;
+
+		size_t length = Tag::decodeNumericalData<uint32_t>(m_data + start, SerializationFlag::None);
+		if (length < 1 || length > m_size - start - 4)
+			return false;
+
+		type = m_data[start + 4];
+		payload = std::span<const uint8_t>(m_data + start + 5, length - 1);
+		return true;
+	}
+
+	inline Tag RegionFile::readChunk(size_t index, std::pmr::memory_resource* resource) const {
+		std::span<const uint8_t> payload;
+		uint8_t type = 0;
+		if (chunkPayload(index, payload, type)) {
+			if (type == 3)
+				return Tag::deserialize(payload.data(), payload.data() + payload.size(), SerializationFlag::None, resource);
+
+#ifdef NBT_WITH_ZLIB
+			if (type == 1 || type == 2) {
+				StreamInput in(inflateSource(StreamInput::memorySource(payload.data(), payload.size())));
+				return Tag::deserialize(in, SerializationFlag::None, resource);
+			}
+#endif
+		}
+
+		Tag errorTag;
+		errorTag.setError();
+		return errorTag;
+	}
+
+	inline bool RegionFile::writeAt(uint64_t offset, const void* data, size_t size) {
+		const char* it = static_cast<const char*>(data);
+		while (size > 0) {
+#if defined(_WIN32)
+			if (_lseeki64(m_fd, int64_t(offset), SEEK_SET) < 0)
+				return false;
+			int written = _write(m_fd, it, unsigned(std::min<size_t>(size, INT32_MAX)));
+#else
+			ssize_t written = ::pwrite(m_fd, it, size, off_t(offset));
+#endif
+			if (written < 0 && errno == EINTR)
+				continue;
+			if (written <= 0)
+				return false;
+			it += written;
+			offset += uint64_t(written);
+			size -= size_t(written);
+		}
+		return true;
+	}
+
+	inline bool RegionFile::map() {
+		struct stat info;
+		if (fstat(m_fd, &info) != 0 || size_t(info.st_size) < 2 * SectorSize)
+			return false;
+		m_size = size_t(info.st_size);
+
+#if defined(_WIN32)
+		m_contents.resize(m_size);
+		size_t offset = 0;
+		_lseeki64(m_fd, 0, SEEK_SET);
+		while (offset < m_size) {
+			int got = _read(m_fd, m_contents.data() + offset, unsigned(std::min<size_t>(m_size - offset, INT32_MAX)));
+			if (got <= 0)
+				return false;
+			offset += size_t(got);
 		}
+		m_data = m_contents.data();
+#else
+		void* data = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, m_fd, 0);
+		if (data == MAP_FAILED)
+			return false;
+		m_data = static_cast<const uint8_t*>(data);
+#endif
+		return true;
+	}
+
+	inline void RegionFile::unmap() {
+#if defined(_WIN32)
+		m_contents.clear();
+#else
+		if (m_data != nullptr)
+			munmap(const_cast<uint8_t*>(m_data), m_size);
+#endif
+		m_data = nullptr;
+		m_size = 0;
 	}
 }
\ No newline at end of file
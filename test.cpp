@@ -0,0 +1,848 @@
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <initializer_list>
+#include <limits>
+#include <memory_resource>
+#include <span>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <nbt.hpp>
+
+#include "test_support.hpp"
+
+// Regression tests, one suite per command line argument so CTest reports them separately.
+
+static int failures = 0;
+
+#define CHECK(condition) \
+	do { \
+		if (!(condition)) { \
+			std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+			++failures; \
+		} \
+	} while (false)
+
+static const nbt::SerializationFlag allFlags[] = {
+	nbt::SerializationFlag::None, nbt::SerializationFlag::Bedrock,
+	nbt::SerializationFlag::JavaNetwork, nbt::SerializationFlag::BedrockNetwork
+};
+
+static nbt::Tag makeDocument() {
+	std::pmr::vector<nbt::Tag> items;
+	for (int i = 0; i < 3; ++i) {
+		items.push_back(nbt::Tag::Compound({
+			nbt::Tag::String("id", "minecraft:stone"),
+			nbt::Tag::Byte("Count", int8_t(i + 1)),
+			nbt::Tag::List("Lore", { nbt::Tag::String("line"), nbt::Tag::String("other line") })
+		}));
+	}
+
+	return nbt::Tag::Compound("root", {
+		nbt::Tag::Int("x", -123456), nbt::Tag::Long("Time", INT64_MIN), nbt::Tag::Short("s", -2),
+		nbt::Tag::Float("f", 1.5f), nbt::Tag::Double("d", -0.25),
+		nbt::Tag::ByteArray("bytes", { 1, -2, 3 }),
+		nbt::Tag::IntArray("ints", { INT32_MIN, -1, 0, 1, INT32_MAX }),
+		nbt::Tag::LongArray("longs", { INT64_MIN, 0, INT64_MAX }),
+		nbt::Tag::List("Items", std::move(items)),
+		nbt::Tag::List("empty", {}),
+		nbt::Tag::Compound("nested", { nbt::Tag::Compound("deeper", {}) })
+	});
+}
+
+// Decodes `data` with the buffer, stream and resumable decoders, checking that they agree, and
+// returns the buffer decoder's result.
+static nbt::Tag decodeAll(std::span<const uint8_t> data, nbt::SerializationFlag flags, const nbt::DeserializeLimits& limits = {}) {
+	nbt::Tag tag = nbt::Tag::deserialize(data.data(), data.data() + data.size(), flags, limits);
+
+	nbt::StreamInput in(nbt::StreamInput::memorySource(data.data(), data.size()), 16);
+	nbt::Tag streamed = nbt::Tag::deserialize(in, flags, limits);
+	CHECK(streamed.isValid() == tag.isValid());
+
+	nbt::TagParser parser(flags, limits);
+	for (size_t i = 0; i < data.size() && parser.isValid() && !parser.isComplete(); i += 7)
+		parser.feed(data.subspan(i, std::min<size_t>(7, data.size() - i)));
+	CHECK(parser.isComplete() == tag.isValid());
+
+	if (tag.isValid()) {
+		nbt::Data encoded = tag.serialize(flags);
+		CHECK(streamed.serialize(flags) == encoded);
+		CHECK(parser.take().serialize(flags) == encoded);
+	}
+	return tag;
+}
+
+// Root compound named "" holding one tag of `type` named "a", followed by `payload`.
+static nbt::Data wrap(nbt::Tag::Type type, std::initializer_list<uint8_t> payload) {
+	nbt::Data data{ 10, 0, 0, uint8_t(type), 0, 1, 'a' };
+	data.insert(data.end(), payload);
+	return data;
+}
+
+static nbt::Data nestedCompounds(size_t depth) {
+	nbt::Data data{ 10, 0, 0 };
+	for (size_t i = 1; i < depth; ++i)
+		data.insert(data.end(), { 10, 0, 1, 'a' });
+	data.insert(data.end(), depth, 0);
+	return data;
+}
+
+static nbt::Data nestedLists(size_t depth) {
+	nbt::Data data{ 10, 0, 0, 9, 0, 1, 'a' };
+	for (size_t i = 2; i < depth; ++i)
+		data.insert(data.end(), { 9, 0, 0, 0, 1 });
+	data.insert(data.end(), { 1, 0, 0, 0, 0, 0 });
+	return data;
+}
+
+struct Walker : nbt::Visitor {};
+
+static void testLimits() {
+	// A few bytes claiming arrays of 2^31 - 1 elements must fail without allocating for them.
+	for (auto type : { nbt::Tag::Type::ByteArray, nbt::Tag::Type::IntArray, nbt::Tag::Type::LongArray }) {
+		nbt::Data data = wrap(type, { 0x7f, 0xff, 0xff, 0xff, 1, 2, 3, 4, 5, 6, 7, 8 });
+		CHECK(data.size() <= 20);
+
+		CountingResource resource;
+		CHECK(!nbt::Tag::deserialize(data.data(), data.data() + data.size(), nbt::SerializationFlag::None, &resource).isValid());
+		CHECK(resource.peak < 1024 * 1024);
+
+		nbt::StreamInput in(nbt::StreamInput::memorySource(data.data(), data.size()));
+		CHECK(!nbt::Tag::deserialize(in, nbt::SerializationFlag::None, &resource).isValid());
+		CHECK(resource.peak < 1024 * 1024);
+
+		nbt::TagParser parser(nbt::SerializationFlag::None, &resource);
+		parser.feed(data);
+		CHECK(!parser.isComplete());
+		CHECK(resource.peak < 1024 * 1024);
+
+		nbt::DeserializeLimits limits;
+		limits.maxArrayLength = 1000;
+		nbt::TagParser limited(nbt::SerializationFlag::None, limits);
+		limited.feed(data);
+		CHECK(!limited.isValid());
+		decodeAll(data, nbt::SerializationFlag::None, limits);
+	}
+
+	// Nesting past the limit is rejected by every decoder and walker; MaxDepth is 512.
+	for (auto nested : { nestedCompounds, nestedLists }) {
+		nbt::DeserializeLimits limits;
+		limits.maxDepth = 64;
+		CHECK(decodeAll(nested(64), nbt::SerializationFlag::None, limits).isValid());
+		CHECK(!decodeAll(nested(65), nbt::SerializationFlag::None, limits).isValid());
+
+		for (size_t depth : { size_t(512), size_t(513), size_t(100000) }) {
+			nbt::Data data = nested(depth);
+			bool isValid = depth <= 512;
+			CHECK(decodeAll(data, nbt::SerializationFlag::None).isValid() == isValid);
+
+			Walker walker;
+			CHECK(nbt::Tag::visit(data.data(), data.data() + data.size(), walker) == isValid);
+			CHECK(nbt::TagIndex(data.data(), data.data() + data.size()).isValid() == isValid);
+		}
+	}
+
+	// Elements of End take no input, so a list of them is read as empty whatever its length.
+	{
+		nbt::Data data = wrap(nbt::Tag::Type::List, { 0, 0x7f, 0xff, 0xff, 0xff, 0 });
+		nbt::Tag tag = decodeAll(data, nbt::SerializationFlag::None);
+		CHECK(tag.isValid() && tag["a"].listValue().empty());
+
+		Walker walker;
+		CHECK(nbt::Tag::visit(data.data(), data.data() + data.size(), walker));
+		nbt::TagIndex index(data.data(), data.data() + data.size());
+		CHECK(index.isValid() && index.childCount(index.find(index.root(), "a")) == 0);
+
+		nbt::TagView view = *nbt::TagView(data.data(), data.data() + data.size()).compoundValue().begin();
+		CHECK(view.isValid() && view.listSize() == 0);
+		CHECK(view.listValue().begin() == view.listValue().end());
+	}
+
+	// The root and its ten members make eleven tags.
+	{
+		std::pmr::vector<nbt::Tag> members;
+		for (int i = 0; i < 10; ++i)
+			members.push_back(nbt::Tag::Int(std::pmr::string(1, char('a' + i)), i));
+		nbt::Data data = nbt::Tag::Compound("", std::move(members)).serialize();
+
+		nbt::DeserializeLimits limits;
+		limits.maxTags = 11;
+		CHECK(decodeAll(data, nbt::SerializationFlag::None, limits).isValid());
+		limits.maxTags = 10;
+		CHECK(!decodeAll(data, nbt::SerializationFlag::None, limits).isValid());
+	}
+
+	{
+		nbt::Data data = nbt::Tag::Compound("", { nbt::Tag::String("s", std::pmr::string(1000, 'x')) }).serialize();
+
+		nbt::DeserializeLimits limits;
+		limits.maxBytes = 100000;
+		CHECK(decodeAll(data, nbt::SerializationFlag::None, limits).isValid());
+		limits.maxBytes = 500;
+		CHECK(!decodeAll(data, nbt::SerializationFlag::None, limits).isValid());
+	}
+
+	// Every prefix of a valid document is incomplete to all three decoders.
+	for (auto flags : allFlags) {
+		nbt::Data data = makeDocument().serialize(flags);
+		CHECK(decodeAll(data, flags).isValid());
+		for (size_t size = 0; size < data.size(); ++size)
+			CHECK(!decodeAll(std::span(data.data(), size), flags).isValid());
+	}
+}
+
+// Checks that stringify output parses back to the same tree, compact and pretty.
+static void checkRoundTrip(const nbt::Tag& tag) {
+	nbt::Data expected = tag.serialize();
+	for (bool pretty : { false, true }) {
+		nbt::StringifyOptions options;
+		options.pretty = pretty;
+		std::string text = tag.stringify(options);
+
+		nbt::ParseError error;
+		nbt::Tag parsed = nbt::Tag::parse(text, error);
+		CHECK(parsed.isValid());
+		CHECK(parsed.serialize() == expected);
+		if (parsed.serialize() != expected)
+			std::fprintf(stderr, "  %s\n  parsed back as %s\n", text.c_str(), parsed.stringify().c_str());
+	}
+}
+
+static void checkParseError(std::string_view text, std::string_view message) {
+	nbt::ParseError error;
+	nbt::Tag tag = nbt::Tag::parse(text, error);
+	CHECK(!tag.isValid() && error.message == message);
+}
+
+static void testSnbt() {
+	checkRoundTrip(makeDocument());
+	checkRoundTrip(nbt::Tag::Compound("", {
+		nbt::Tag::Byte("min", INT8_MIN), nbt::Tag::Byte("max", INT8_MAX),
+		nbt::Tag::Short("smin", INT16_MIN), nbt::Tag::Int("imin", INT32_MIN), nbt::Tag::Long("lmin", INT64_MIN), nbt::Tag::Long("lmax", INT64_MAX),
+		nbt::Tag::Float("tiny", 1e-45f), nbt::Tag::Float("third", 1.0f / 3), nbt::Tag::Double("big", 1.7976931348623157e308), nbt::Tag::Double("zero", -0.0),
+		nbt::Tag::String("quotes", "say \"hi\" it's \\ here"), nbt::Tag::String("number", "123"), nbt::Tag::String("bool", "true"),
+		nbt::Tag::String("unicode", "\xc3\xa9\xe2\x82\xac"), nbt::Tag::String("", ""),
+		nbt::Tag::String("needs quotes", "a b"), nbt::Tag::String("colon:name", "x"),
+		nbt::Tag::List("lists", { nbt::Tag::List({ nbt::Tag::Int(1) }), nbt::Tag::List({}) }),
+		nbt::Tag::List("compounds", { nbt::Tag::Compound({}), nbt::Tag::Compound({ nbt::Tag::Byte("b", 0) }) }),
+		nbt::Tag::List("arrays", { nbt::Tag::IntArray({}), nbt::Tag::IntArray({ -1 }) }),
+		nbt::Tag::ByteArray("bytes", {}), nbt::Tag::LongArray("longs", { INT64_MIN })
+	}));
+	checkRoundTrip(nbt::Tag::Int("named root", 7));
+	checkRoundTrip(nbt::Tag::List({ nbt::Tag::String("a"), nbt::Tag::String("b") }));
+
+	// Suffixed integers that do not fit their type are errors, however many digits they have.
+	checkParseError("{a:300b}", "number out of range");
+	checkParseError("{a:-40000s}", "number out of range");
+	checkParseError("{a:99999999999}", "number out of range");
+	checkParseError("{a:99999999999999999999l}", "number out of range");
+	checkParseError("{a:-99999999999999999999b}", "number out of range");
+
+	// Non-finite floats have no SNBT literal but must still read back as the same value.
+	constexpr float infinity = std::numeric_limits<float>::infinity();
+	constexpr double nan = std::numeric_limits<double>::quiet_NaN();
+	checkRoundTrip(nbt::Tag::Compound("", {
+		nbt::Tag::Float("inf", infinity), nbt::Tag::Float("-inf", -infinity), nbt::Tag::Float("nan", float(nan)),
+		nbt::Tag::Double("inf", double(infinity)), nbt::Tag::Double("-inf", -double(infinity)), nbt::Tag::Double("nan", nan)
+	}));
+	nbt::Tag ranges = nbt::Tag::parse("{a:1e39f,b:-1e999,c:1e-999d,d:-0.0000e-99999999999999999999f,e:1e99999999999999999999d}");
+	CHECK(ranges.isValid() && ranges["a"].floatValue() == infinity && ranges["b"].doubleValue() == -double(infinity));
+	CHECK(ranges.isValid() && ranges["c"].doubleValue() == 0 && ranges["d"].floatValue() == 0 && std::signbit(ranges["d"].floatValue()));
+	CHECK(ranges.isValid() && ranges["e"].doubleValue() == double(infinity));
+
+	// Words that are not numbers stay unquoted strings.
+	nbt::Tag words = nbt::Tag::parse("{a:1.5b,b:12ab,c:-,d:1e5x,e:-inf,f:nan}");
+	CHECK(words.isValid() && words["a"].stringValue() == "1.5b" && words["b"].stringValue() == "12ab");
+	CHECK(words.isValid() && words["c"].stringValue() == "-" && words["d"].stringValue() == "1e5x");
+	CHECK(words.isValid() && words["e"].stringValue() == "-inf" && words["f"].stringValue() == "nan");
+}
+
+// Overrides only the Int event, which must then see Ints alone.
+struct IntVisitor : nbt::Visitor {
+	std::vector<int32_t> values;
+
+	nbt::VisitResult intValue(std::string_view, int32_t value) {
+		values.push_back(value);
+		return nbt::VisitResult::Continue;
+	}
+};
+
+struct EventVisitor : nbt::Visitor {
+	std::string events;
+
+	nbt::VisitResult byteValue(std::string_view name, int8_t) { return add(name, "b"); }
+	nbt::VisitResult shortValue(std::string_view name, int16_t) { return add(name, "s"); }
+	nbt::VisitResult intValue(std::string_view name, int32_t) { return add(name, "i"); }
+	nbt::VisitResult longValue(std::string_view name, int64_t) { return add(name, "l"); }
+	nbt::VisitResult floatValue(std::string_view name, float) { return add(name, "f"); }
+	nbt::VisitResult doubleValue(std::string_view name, double) { return add(name, "d"); }
+
+	nbt::VisitResult add(std::string_view name, const char* type) {
+		events += std::string(name) + ":" + type + ",";
+		return nbt::VisitResult::Continue;
+	}
+};
+
+static void testVisit() {
+	nbt::Tag tag = nbt::Tag::Compound("", {
+		nbt::Tag::Byte("b", 1), nbt::Tag::Short("s", 2), nbt::Tag::Int("i", 3),
+		nbt::Tag::Long("l", 4), nbt::Tag::Float("f", 5.0f), nbt::Tag::Double("d", 2.5)
+	});
+	for (auto flags : allFlags) {
+		nbt::Data data = tag.serialize(flags);
+
+		IntVisitor ints;
+		CHECK(nbt::Tag::visit(data.data(), data.data() + data.size(), ints, flags));
+		CHECK(ints.values == std::vector<int32_t>{ 3 });
+
+		EventVisitor events;
+		CHECK(nbt::Tag::visit(data.data(), data.data() + data.size(), events, flags));
+		CHECK(events.events == "b:b,s:s,i:i,l:l,f:f,d:d,");
+	}
+}
+
+// The factories take std::string and std::vector as well as the pmr types they store.
+static void testFactories() {
+	std::string name = "name";
+	std::string text = "text";
+	std::vector<nbt::Tag> tags;
+	tags.push_back(nbt::Tag::String(name, text));
+	tags.push_back(nbt::Tag::ByteArray("bytes", std::vector<int8_t>{ 1, -2 }));
+	tags.push_back(nbt::Tag::IntArray(std::string("ints"), std::vector<int32_t>{ INT32_MIN }));
+	tags.push_back(nbt::Tag::LongArray(std::string_view("longs"), std::vector<int64_t>{ INT64_MAX }));
+	tags.push_back(nbt::Tag::List("list", std::vector<nbt::Tag>{ nbt::Tag::String(text) }));
+	nbt::Tag compound = nbt::Tag::Compound(name, std::move(tags));
+
+	nbt::Tag expected = nbt::Tag::Compound("name", {
+		nbt::Tag::String("name", "text"),
+		nbt::Tag::ByteArray("bytes", { 1, -2 }),
+		nbt::Tag::IntArray("ints", { INT32_MIN }),
+		nbt::Tag::LongArray("longs", { INT64_MAX }),
+		nbt::Tag::List("list", { nbt::Tag::String("text") })
+	});
+	CHECK(compound.serialize() == expected.serialize());
+
+	// The accessors return pmr types, which convert to the std ones explicitly.
+	std::string value(compound["name"].stringValue());
+	CHECK(value == text);
+}
+
+// A compound whose payload is about `size` bytes, to fill a given number of sectors.
+static nbt::Tag makeChunk(int32_t id, size_t size) {
+	return nbt::Tag::Compound("", {
+		nbt::Tag::Int("id", id),
+		nbt::Tag::ByteArray("fill", std::pmr::vector<int8_t>(size, int8_t(id)))
+	});
+}
+
+// Reads and overwrites big-endian 32-bit words of the file at `path`.
+static uint32_t readWord(const std::filesystem::path& path, std::streamoff offset) {
+	std::ifstream file(path, std::ios::binary);
+	uint8_t bytes[4] = {};
+	file.seekg(offset);
+	file.read(reinterpret_cast<char*>(bytes), sizeof(bytes));
+	return uint32_t(bytes[0]) << 24 | uint32_t(bytes[1]) << 16 | uint32_t(bytes[2]) << 8 | bytes[3];
+}
+
+static void patchWord(const std::filesystem::path& path, std::streamoff offset, uint32_t value) {
+	std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+	uint8_t bytes[4] = { uint8_t(value >> 24), uint8_t(value >> 16), uint8_t(value >> 8), uint8_t(value) };
+	file.seekp(offset);
+	file.write(reinterpret_cast<const char*>(bytes), sizeof(bytes));
+}
+
+static void testRegion() {
+	std::filesystem::path path = std::filesystem::temp_directory_path() / "nbt_test_region.mca";
+	std::filesystem::remove(path);
+	constexpr size_t sector = nbt::RegionFile::SectorSize;
+
+	{
+		nbt::RegionFile region;
+		CHECK(region.open(path.string(), true));
+		CHECK(region.writeChunk(0, 0, makeChunk(1, 100), nbt::Compression::None));
+		CHECK(region.writeChunk(1, 0, makeChunk(2, 100), nbt::Compression::None));
+		CHECK(region.writeChunk(-1, -1, makeChunk(3, 100), nbt::Compression::None));
+		CHECK(region.hasChunk(31, 31) && !region.hasChunk(2, 0));
+		CHECK(region.chunkCompression(0, 0) == nbt::Compression::None && region.timestamp(0, 0) != 0);
+		CHECK(std::filesystem::file_size(path) == 5 * sector);
+
+		// Outgrowing its sector moves chunk (0, 0) past its neighbours, which stay intact.
+		CHECK(region.writeChunk(0, 0, makeChunk(4, 2 * sector), nbt::Compression::None));
+		CHECK(std::filesystem::file_size(path) == 8 * sector);
+		CHECK(region.readChunk(0, 0).serialize() == makeChunk(4, 2 * sector).serialize());
+		CHECK(region.readChunk(1, 0).serialize() == makeChunk(2, 100).serialize());
+		CHECK(region.readChunk(31, 31).serialize() == makeChunk(3, 100).serialize());
+
+		// A chunk that shrinks stays where it is, and a new one fills the sector freed above.
+		CHECK(region.writeChunk(0, 0, makeChunk(5, 100), nbt::Compression::None));
+		CHECK(region.writeChunk(5, 5, makeChunk(6, 100), nbt::Compression::None));
+		CHECK(std::filesystem::file_size(path) == 8 * sector);
+		CHECK(region.readChunk(0, 0).serialize() == makeChunk(5, 100).serialize());
+		CHECK(region.readChunk(5, 5).serialize() == makeChunk(6, 100).serialize());
+	}
+
+	{
+		nbt::RegionFile region;
+		CHECK(region.open(path.string()));
+		CHECK(!region.writeChunk(2, 0, makeChunk(7, 100), nbt::Compression::None));
+		CHECK(region.readChunk(1, 0).serialize() == makeChunk(2, 100).serialize());
+		CHECK(!region.readChunk(2, 0).isValid());
+
+		nbt::ThreadPool pool(2);
+		std::vector<nbt::Tag> chunks = region.readChunks(pool);
+		CHECK(chunks[0].serialize() == makeChunk(5, 100).serialize() && !chunks[2].isValid());
+	}
+
+	// Locations into the header or past the end, and lengths of zero or past the end, are
+	// rejected rather than read.
+	patchWord(path, 0 * 4, 1 << 8 | 1);
+	patchWord(path, 1 * 4, 100 << 8 | 1);
+	patchWord(path, std::streamoff(readWord(path, (31 + 31 * 32) * 4) >> 8) * std::streamoff(sector), 0);
+	patchWord(path, std::streamoff(readWord(path, (5 + 5 * 32) * 4) >> 8) * std::streamoff(sector), 0xfffffff0);
+	{
+		nbt::RegionFile region;
+		CHECK(region.open(path.string()));
+		for (auto [x, z] : { std::pair(0, 0), std::pair(1, 0), std::pair(31, 31), std::pair(5, 5) })
+			CHECK(!region.hasChunk(x, z) && !region.readChunk(x, z).isValid());
+	}
+
+	std::filesystem::remove(path);
+}
+
+// Packs `states` one bit at a time, as a reference for packBits.
+static std::vector<int64_t> naivePack(const std::vector<uint16_t>& states, unsigned bits, nbt::PackedLayout layout) {
+	size_t perLong = 64 / bits;
+	size_t length = layout == nbt::PackedLayout::Padded ? (states.size() + perLong - 1) / perLong : (states.size() * bits + 63) / 64;
+	std::vector<uint64_t> longs(length, 0);
+	for (size_t i = 0; i < states.size(); ++i) {
+		size_t first = layout == nbt::PackedLayout::Padded ? i / perLong * 64 + i % perLong * bits : i * bits;
+		for (unsigned bit = 0; bit < bits; ++bit) {
+			if (states[i] >> bit & 1)
+				longs[(first + bit) / 64] |= uint64_t(1) << ((first + bit) % 64);
+		}
+	}
+	return std::vector<int64_t>(longs.begin(), longs.end());
+}
+
+static void testPacked() {
+	for (unsigned bits = 1; bits <= 16; ++bits) {
+		for (auto layout : { nbt::PackedLayout::Padded, nbt::PackedLayout::Spanning }) {
+			for (size_t count : { size_t(1), size_t(100), size_t(4096) }) {
+				std::vector<uint16_t> states(count);
+				for (size_t i = 0; i < count; ++i)
+					states[i] = uint16_t((i * 2654435761u >> 7) & ((1u << bits) - 1));
+				if (count > 1)
+					states[count - 1] = uint16_t((1u << bits) - 1);
+
+				std::vector<int64_t> expected = naivePack(states, bits, layout);
+				std::pmr::vector<int64_t> packed;
+				CHECK(nbt::packBits(states, bits, layout, packed));
+				CHECK(nbt::packedLength(count, bits, layout) == expected.size());
+				CHECK(std::vector<int64_t>(packed.begin(), packed.end()) == expected);
+
+				std::vector<uint16_t> out(count);
+				CHECK(nbt::unpackBits(std::span<const int64_t>(packed), bits, layout, out) && out == states);
+
+				// Through the serialized bytes, in both byte orders.
+				for (auto flags : { nbt::SerializationFlag::None, nbt::SerializationFlag::Bedrock }) {
+					nbt::Data data = nbt::Tag::LongArray("data", packed).serialize(flags);
+					nbt::TagView view(data.data(), data.data() + data.size(), flags);
+					std::fill(out.begin(), out.end(), uint16_t(0));
+					CHECK(nbt::unpackBits(view.longArrayValue(), bits, layout, out) && out == states);
+				}
+
+				// Too short a source or destination is refused.
+				CHECK(!nbt::unpackBits(std::span<const int64_t>(packed).first(packed.size() - 1), bits, layout, out));
+				std::vector<int64_t> shortDst(packed.size() - 1);
+				CHECK(!nbt::packBits(states, bits, layout, std::span<int64_t>(shortDst)));
+			}
+
+			// An index wider than `bits` is refused.
+			if (bits < 16) {
+				std::vector<uint16_t> wide = { 0, uint16_t(1u << bits) };
+				std::pmr::vector<int64_t> packed;
+				CHECK(!nbt::packBits(wide, bits, layout, packed));
+			}
+		}
+	}
+
+	for (unsigned bits : { 0u, 17u }) {
+		std::vector<uint16_t> states(64, 0);
+		std::pmr::vector<int64_t> packed(64, 0);
+		CHECK(nbt::packedLength(states.size(), bits, nbt::PackedLayout::Padded) == 0);
+		CHECK(!nbt::packBits(states, bits, nbt::PackedLayout::Padded, packed));
+		CHECK(!nbt::packBits(states, bits, nbt::PackedLayout::Spanning, std::span<int64_t>(packed)));
+		CHECK(!nbt::unpackBits(std::span<const int64_t>(packed), bits, nbt::PackedLayout::Spanning, states));
+	}
+}
+
+static void testBatch() {
+	// Batch results are assigned over placeholders and must still live on the given resource.
+	{
+		std::pmr::synchronized_pool_resource resource;
+		nbt::ThreadPool pool(2);
+		nbt::Data document = makeDocument().serialize();
+		std::vector<nbt::Tag::Payload> payloads(4, { document.data(), document.size() });
+		for (const nbt::Tag& tag : nbt::Tag::deserialize(payloads, pool, &resource))
+			CHECK(tag.serialize() == document && tag.compoundValue().get_allocator().resource() == &resource);
+	}
+
+	// Results come back in input order and match doing each item alone, also with fewer items
+	// than threads, where most threads find nothing of their own and must steal or stay idle.
+	for (size_t threads : { 1, 4 }) {
+		nbt::ThreadPool pool(threads);
+		for (size_t count : { 0, 1, 3, 4, 37 }) {
+			std::vector<nbt::Tag> tags;
+			for (size_t i = 0; i < count; ++i)
+				tags.push_back(makeChunk(int32_t(i), i * 100));
+
+			std::vector<nbt::Data> data = nbt::Tag::serialize(tags, pool, nbt::SerializationFlag::Bedrock);
+			CHECK(data.size() == count);
+			for (size_t i = 0; i < data.size(); ++i)
+				CHECK(data[i] == tags[i].serialize(nbt::SerializationFlag::Bedrock));
+
+			std::vector<nbt::Tag::Payload> payloads;
+			std::vector<nbt::Data> encoded;
+			for (size_t i = 0; i < count; ++i)
+				encoded.push_back(tags[i].serialize(allFlags[i % std::size(allFlags)]));
+			for (size_t i = 0; i < count; ++i)
+				payloads.push_back({ encoded[i].data(), encoded[i].size() - (i % 5 == 4), allFlags[i % std::size(allFlags)] });
+
+			std::vector<nbt::Tag> decoded = nbt::Tag::deserialize(payloads, pool);
+			CHECK(decoded.size() == count);
+			for (size_t i = 0; i < decoded.size(); ++i) {
+				// Every fifth payload is cut short and must fail in its own slot.
+				if (i % 5 == 4)
+					CHECK(!decoded[i].isValid());
+				else
+					CHECK(decoded[i].serialize() == tags[i].serialize() && decoded[i]["id"].intValue() == int32_t(i));
+			}
+		}
+	}
+}
+
+#ifdef NBT_WITH_ZLIB
+static nbt::Data compress(const nbt::Tag& tag, nbt::Compression compression) {
+	nbt::Data data;
+	nbt::StreamOutput out(nbt::deflateSink([&data](const void* bytes, size_t size) {
+		data.insert(data.end(), static_cast<const uint8_t*>(bytes), static_cast<const uint8_t*>(bytes) + size);
+		return true;
+	}, compression));
+	CHECK(tag.serialize(out) && out.close());
+	return data;
+}
+
+// Decodes `data` through inflateSource, which detects its compression, with a small window so
+// the input is pulled in many pieces.
+static nbt::Tag decompress(std::span<const uint8_t> data) {
+	nbt::StreamInput in(nbt::inflateSource(nbt::StreamInput::memorySource(data.data(), data.size())), 64);
+	return nbt::Tag::deserialize(in);
+}
+
+static void testZlib() {
+	nbt::Tag tag = makeDocument();
+	nbt::Data expected = tag.serialize();
+	CHECK(nbt::detectCompression(expected.data(), expected.size()) == nbt::Compression::None);
+	CHECK(decompress(expected).serialize() == expected);
+
+	for (auto compression : { nbt::Compression::Gzip, nbt::Compression::Zlib }) {
+		nbt::Data data = compress(tag, compression);
+		CHECK(nbt::detectCompression(data.data(), data.size()) == compression);
+		CHECK(decompress(data).serialize() == expected);
+
+		// Cut off anywhere before its trailer, the stream ends early and decoding fails cleanly.
+		size_t trailer = compression == nbt::Compression::Gzip ? 8 : 4;
+		for (size_t size = 0; size + trailer + 1 < data.size(); ++size)
+			CHECK(!decompress(std::span(data.data(), size)).isValid());
+	}
+}
+#endif
+
+// Counts the tags under `view` by iterating, checking each one is valid.
+static size_t countViews(const nbt::TagView& view) {
+	CHECK(view.isValid());
+	size_t count = 1;
+	if (view.type() == nbt::Tag::Type::Compound)
+		for (const nbt::TagView& child : view.compoundValue())
+			count += countViews(child);
+	if (view.type() == nbt::Tag::Type::List)
+		for (const nbt::TagView& child : view.listValue())
+			count += countViews(child);
+	return count;
+}
+
+static size_t countTags(const nbt::Tag& tag) {
+	size_t count = 1;
+	if (tag.type() == nbt::Tag::Type::Compound)
+		for (const nbt::Tag& child : tag.compoundValue())
+			count += countTags(child);
+	if (tag.type() == nbt::Tag::Type::List)
+		for (const nbt::Tag& child : tag.listValue())
+			count += countTags(child);
+	return count;
+}
+
+// Checks that compiling `path` throws, naming `message`.
+static void checkQueryError(std::string_view path, std::string_view message) {
+	try {
+		nbt::Query query(path);
+		CHECK(!"query compiled");
+	} catch (const std::invalid_argument& error) {
+		CHECK(std::string_view(error.what()).find(message) != std::string_view::npos);
+	}
+}
+
+static void testView() {
+	checkQueryError("a[99999999999999999999]", "list index out of range");
+	checkQueryError("a[-1]", "invalid list index");
+	checkQueryError("a.[0]", "empty member name");
+
+	// A list of End claiming millions of elements has none to match or to allocate views for.
+	for (nbt::Data data : { wrap(nbt::Tag::Type::List, { 0, 0x01, 0, 0, 0, 0 }), wrap(nbt::Tag::Type::List, { 0, 0x7f, 0xff, 0xff, 0xff, 0 }) }) {
+		CHECK(nbt::Query("a[*]").select(data.data(), data.data() + data.size()).empty());
+		CHECK(nbt::Query("a[*]").extract(data.data(), data.data() + data.size()).empty());
+		CHECK(nbt::Query("a[0]").select(data.data(), data.data() + data.size()).empty());
+	}
+
+	nbt::Tag tag = makeDocument();
+	nbt::Query query("Items[*].Lore[1]");
+	for (auto flags : allFlags) {
+		nbt::Data data = tag.serialize(flags);
+		CHECK(countViews(nbt::TagView(data.data(), data.data() + data.size(), flags)) == countTags(tag));
+		CHECK(query.select(data.data(), data.data() + data.size(), flags).size() == 3);
+
+		// Truncated documents are invalid up front, and queries never hand out partial matches.
+		for (size_t size = 0; size < data.size(); ++size) {
+			CHECK(!nbt::TagView(data.data(), data.data() + size, flags).isValid());
+			for (const nbt::TagView& match : query.select(data.data(), data.data() + size, flags))
+				CHECK(match.isValid() && match.stringValue() == "other line");
+		}
+	}
+}
+
+static void testAssign() {
+	// Assigning a tag from inside its own tree, with the value's type changing or not.
+	for (bool move : { false, true }) {
+		nbt::Tag root = makeDocument();
+		nbt::Data nested = root["nested"].serialize();
+		if (move)
+			root = std::move(*root.editChild("nested"));
+		else
+			root = root["nested"];
+		CHECK(root.name() == "nested" && root.serialize() == nested);
+
+		nbt::Tag list = nbt::Tag::List("l", { nbt::Tag::List({ nbt::Tag::Int(1), nbt::Tag::Int(2) }) });
+		if (move)
+			list = std::move(list.editChild(0));
+		else
+			list = list.listValue()[0];
+		CHECK(!list.hasName() && list.listValue().size() == 2 && list.listValue()[1].intValue() == 2);
+
+		nbt::Tag self = makeDocument();
+		nbt::Data data = self.serialize();
+		nbt::Tag& alias = self;
+		if (move)
+			self = std::move(alias);
+		else
+			self = alias;
+		CHECK(self.serialize() == data);
+	}
+	static_assert(std::is_nothrow_move_assignable_v<nbt::Tag>);
+
+	// Members reached through editChild keep their names, which the compound's index is keyed
+	// on, whatever is assigned to them; copies and other tags do not.
+	std::pmr::vector<nbt::Tag> members;
+	for (int i = 0; i < 12; ++i)
+		members.push_back(nbt::Tag::Int(std::pmr::string(1, char('a' + i)), i));
+	for (bool shared : { false, true }) {
+		nbt::Tag root = nbt::Tag::Compound("", members);
+		if (shared)
+			root.share();
+		*root.editChild("a") = nbt::Tag::Int("renamed", 100);
+		root.editChild(1) = nbt::Tag::String("other", "b");
+		nbt::Tag moved = std::move(*root.editChild("c"));
+		std::swap(*root.editChild("d"), *root.editChild("e"));
+		nbt::Tag copy = *root.editChild("f");
+		copy = nbt::Tag::Int("g", 6);
+		CHECK(root.find("renamed") == nullptr && root.find("other") == nullptr);
+		CHECK(root["a"].intValue() == 100 && root["b"].stringValue() == "b" && root.find("c") != nullptr);
+		CHECK(root["d"].intValue() == 4 && root["e"].intValue() == 3 && moved.name() == "c" && copy.name() == "g");
+
+		// Renaming one would hide it from lookups once the compound is indexed, so it throws.
+		bool threw = false;
+		try {
+			root.editChild("f")->setName("zz");
+		} catch (const std::logic_error&) {
+			threw = true;
+		}
+		root.editChild("f")->setName("f");
+		CHECK(threw && root.find("zz") == nullptr && root["f"].name() == "f");
+
+		// Members moving down over pinned ones on removal, and whole compounds assigned over
+		// them, take their own names along.
+		root.removeChild("b");
+		CHECK(root.compoundValue()[1].name() == "c" && root["e"].intValue() == 3 && root["l"].intValue() == 11);
+		root.editChild("l");
+		root.setValue(nbt::Tag::Compound(members));
+		CHECK(root.compoundValue().back().name() == "l" && root["a"].intValue() == 0);
+	}
+}
+
+static void testCache() {
+	// Cached output has to match a fresh encoding byte for byte under every combination of
+	// flags, before and after edits, and when one cache switches between flags.
+	nbt::Tag tag = makeDocument();
+	tag.share();
+	nbt::SerializationCache shared;
+	for (int round = 0; round < 3; ++round) {
+		for (uint8_t bits = 0; bits < 8; ++bits) {
+			auto flags = nbt::SerializationFlag(bits);
+			nbt::SerializationCache cache;
+			for (int i = 0; i < 2; ++i)
+				CHECK(tag.serialize(cache, flags) == tag.serialize(flags));
+			CHECK(tag.serialize(shared, flags) == tag.serialize(flags));
+		}
+
+		if (round == 0) {
+			tag.editChild("nested")->editChild("deeper")->addChild(nbt::Tag::List("added", {}));
+		} else {
+			tag.editChild("Items")->editChild(1).setValue(nbt::Tag::Compound({}));
+			tag.editChild("empty")->addChild(nbt::Tag::Long(-1));
+		}
+	}
+}
+
+struct Arrays {
+	std::vector<int32_t> ints;
+	std::vector<int64_t> longs;
+};
+
+template<> struct nbt::Schema<Arrays> {
+	static constexpr auto fields = std::tuple(nbt::field("ints", &Arrays::ints), nbt::field("longs", &Arrays::longs));
+};
+
+// Copies out every int and long array it is shown.
+struct ArrayVisitor : nbt::Visitor {
+	std::vector<std::vector<int64_t>> arrays;
+
+	nbt::VisitResult intArray(std::string_view, nbt::ArrayView<int32_t> values) {
+		arrays.emplace_back(values.begin(), values.end());
+		return nbt::VisitResult::Continue;
+	}
+
+	nbt::VisitResult longArray(std::string_view, nbt::ArrayView<int64_t> values) {
+		arrays.emplace_back(values.begin(), values.end());
+		return nbt::VisitResult::Continue;
+	}
+};
+
+static void testVarInt() {
+	// Arrays of the longest VarInts, batched through a stack buffer that every encoder writes
+	// whole words into.
+	Arrays arrays;
+	arrays.ints.assign(300, INT32_MIN);
+	arrays.longs.assign(300, INT64_MIN);
+	nbt::Tag tag = nbt::Tag::Compound("", {
+		nbt::Tag::IntArray("ints", std::pmr::vector<int32_t>(arrays.ints.begin(), arrays.ints.end())),
+		nbt::Tag::LongArray("longs", std::pmr::vector<int64_t>(arrays.longs.begin(), arrays.longs.end()))
+	});
+
+	for (auto flags : allFlags) {
+		nbt::Data data = tag.serialize(flags);
+		CHECK(data.size() == tag.serializedSize(flags));
+		CHECK(nbt::encode(arrays, flags) == data);
+
+		std::vector<uint8_t> buffer(data.size());
+		CHECK(tag.serialize(std::span<uint8_t>(buffer), flags) == data.size() && nbt::Data(buffer.begin(), buffer.end()) == data);
+
+		nbt::Data streamed;
+		{
+			nbt::StreamOutput out([&](const void* bytes, size_t size) {
+				streamed.insert(streamed.end(), static_cast<const uint8_t*>(bytes), static_cast<const uint8_t*>(bytes) + size);
+				return true;
+			}, 64);
+			CHECK(tag.serialize(out, flags) && out.close());
+		}
+		CHECK(streamed == data);
+
+		nbt::Tag decoded = decodeAll(data, flags);
+		CHECK(decoded.isValid() && decoded["ints"].intArrayValue() == tag["ints"].intArrayValue());
+		CHECK(decoded.isValid() && decoded["longs"].longArrayValue() == tag["longs"].longArrayValue());
+
+		Arrays back;
+		CHECK(nbt::decode(data.data(), data.data() + data.size(), back, flags) && back.ints == arrays.ints && back.longs == arrays.longs);
+	}
+
+	// Visiting decodes VarInt arrays into one buffer reused from array to array, which must not
+	// leave anything of a longer array in a shorter one.
+	std::pmr::vector<int32_t> ints(1000);
+	for (size_t i = 0; i < ints.size(); ++i)
+		ints[i] = int32_t(i * 2654435761u);
+	nbt::Tag mixed = nbt::Tag::Compound("", {
+		nbt::Tag::LongArray("a", { INT64_MIN, -1, 0, INT64_MAX }), nbt::Tag::IntArray("b", ints),
+		nbt::Tag::IntArray("c", { 7, -7 }), nbt::Tag::LongArray("d", {}),
+		nbt::Tag::List("e", { nbt::Tag::IntArray({ 1 }), nbt::Tag::IntArray(ints) })
+	});
+	for (auto flags : allFlags) {
+		nbt::Data encoded = mixed.serialize(flags);
+		ArrayVisitor visitor;
+		CHECK(nbt::Tag::visit(encoded.data(), encoded.data() + encoded.size(), visitor, flags));
+		std::vector<int64_t> wide(ints.begin(), ints.end());
+		CHECK(visitor.arrays == (std::vector<std::vector<int64_t>>{ { INT64_MIN, -1, 0, INT64_MAX }, wide, { 7, -7 }, {}, { 1 }, wide }));
+	}
+
+	// An empty list is a type and a one byte length under VarInt, whichever serializer writes it.
+	nbt::Tag small = nbt::Tag::Compound("", { nbt::Tag::List("l", {}), nbt::Tag::Int("i", 1) });
+	small.share();
+	nbt::SerializationCache cache;
+	nbt::Data data = small.serialize(nbt::SerializationFlag::BedrockNetwork);
+	CHECK(data.size() == 12);
+	CHECK(small.serialize(cache, nbt::SerializationFlag::BedrockNetwork) == data);
+	CHECK(small.serialize(cache, nbt::SerializationFlag::BedrockNetwork) == data);
+	CHECK(decodeAll(data, nbt::SerializationFlag::BedrockNetwork).isValid());
+}
+
+int main(int argc, char** argv) {
+	const char* suite = argc > 1 ? argv[1] : "all";
+	bool all = std::strcmp(suite, "all") == 0;
+
+	if (all || std::strcmp(suite, "limits") == 0)
+		testLimits();
+	if (all || std::strcmp(suite, "varint") == 0)
+		testVarInt();
+	if (all || std::strcmp(suite, "cache") == 0)
+		testCache();
+	if (all || std::strcmp(suite, "snbt") == 0)
+		testSnbt();
+	if (all || std::strcmp(suite, "visit") == 0)
+		testVisit();
+	if (all || std::strcmp(suite, "assign") == 0)
+		testAssign();
+	if (all || std::strcmp(suite, "view") == 0)
+		testView();
+	if (all || std::strcmp(suite, "factories") == 0)
+		testFactories();
+	if (all || std::strcmp(suite, "region") == 0)
+		testRegion();
+	if (all || std::strcmp(suite, "packed") == 0)
+		testPacked();
+	if (all || std::strcmp(suite, "batch") == 0)
+		testBatch();
+#ifdef NBT_WITH_ZLIB
+	if (all || std::strcmp(suite, "zlib") == 0)
+		testZlib();
+#endif
+
+	if (failures != 0)
+		std::fprintf(stderr, "%d checks failed\n", failures);
+	return failures == 0 ? 0 : 1;
+}
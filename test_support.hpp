@@ -0,0 +1,30 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory_resource>
+
+// Shared by the test, fuzz and bench programs; not part of the library.
+
+// Tracks the bytes allocated through it, at most and right now.
+class CountingResource : public std::pmr::memory_resource {
+public:
+	size_t bytes = 0;
+	size_t peak = 0;
+
+private:
+	void* do_allocate(size_t size, size_t alignment) override {
+		bytes += size;
+		peak = std::max(peak, bytes);
+		return std::pmr::new_delete_resource()->allocate(size, alignment);
+	}
+
+	void do_deallocate(void* ptr, size_t size, size_t alignment) override {
+		bytes -= size;
+		std::pmr::new_delete_resource()->deallocate(ptr, size, alignment);
+	}
+
+	bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+		return this == &other;
+	}
+};